@@ -1,4 +1,6 @@
 #include <RayCamera.h>
+#include <RTUtil/geomtools.hpp>
+#include <algorithm>
 #include <math.h>
 
 RayCamera::RayCamera()
@@ -15,6 +17,7 @@ RayCamera::RayCamera()
     this->vw = (eye - lookDir).normalized();
     this->vv = upDir.normalized();
     this->vu = vv.cross(vw);
+    updateTransform();
 }
 
 RayCamera::RayCamera(
@@ -30,6 +33,7 @@ RayCamera::RayCamera(
     this->vw = (-lookDir).normalized();
     this->vv = upDir.normalized();
     this->vu = vv.cross(vw);
+    updateTransform();
 }
 
 void RayCamera::orbit(float theta, float phi)
@@ -47,6 +51,24 @@ void RayCamera::orbit(float theta, float phi)
     this->eye = yRot * this->eye;
     this->vw = yRot * this->vw;
     this->vv = yRot * this->vv;
+    updateTransform();
+}
+
+void RayCamera::setView(Eigen::Vector3f eye, Eigen::Vector3f target, Eigen::Vector3f up)
+{
+    this->eye = eye;
+    this->lookDir = target - eye;
+    this->upDir = up;
+
+    this->vw = (eye - target).normalized();
+    this->vu = up.cross(vw).normalized();
+    this->vv = vw.cross(vu);
+    updateTransform();
+}
+
+Eigen::Vector3f RayCamera::getEye()
+{
+    return this->eye;
 }
 
 void RayCamera::zoom(float z)
@@ -59,19 +81,32 @@ Eigen::Vector3f RayCamera::getvw()
     return this->vw;
 }
 
-RTCRay RayCamera::generateRay(float u, float v)
+void RayCamera::updateTransform()
 {
-
     float width = abs(2 * tan(hfov / 2));
-
     float height = abs(width / aspectRatio);
 
-    // printf("The width and height are: %f, %f \n", width, height);
+    // dir = -w + (width * u - width / 2) * u_basis + (height * v - height / 2) * v_basis
+    screenToWorld.col(0) = vu * width;
+    screenToWorld.col(1) = vv * height;
+    screenToWorld.col(2) = (vw * -1) - vu * (width / 2) - vv * (height / 2);
+    worldToScreen = screenToWorld.inverse();
+}
 
-    float cu = (width * u) - (width / 2);
-    float cv = (height * v) - (height / 2);
+bool RayCamera::project(const Eigen::Vector3f &p, Eigen::Vector2f &screen) const
+{
+    // Undo the screen-to-world transform; the third coordinate is the depth along the
+    // view axis, by which the direction was scaled
+    Eigen::Vector3f s = worldToScreen * (p - eye);
+    if (s.z() <= 0)
+        return false;
+    screen = Eigen::Vector2f(s.x() / s.z(), s.y() / s.z());
+    return true;
+}
 
-    Eigen::Vector3f dir = (vw * -1) + (vu * cu) + (vv * cv);
+RTCRay RayCamera::generateRay(float u, float v)
+{
+    Eigen::Vector3f dir = screenToWorld * Eigen::Vector3f(u, v, 1);
 
     struct RTCRay ray;
     ray.org_x = eye.x();
@@ -82,10 +117,101 @@ RTCRay RayCamera::generateRay(float u, float v)
     ray.dir_z = dir.z();
     ray.tnear = 0;
     ray.tfar = std::numeric_limits<float>::infinity();
-    ray.mask = 0;
+    ray.mask = CameraRays;
     ray.flags = 0;
 
     return ray;
 }
 
-float RayCamera::getAspect() { return aspectRatio; }
\ No newline at end of file
+void RayCamera::generateRays(int x0, int y0, int x1, int y1, int imageWidth, int imageHeight,
+                             const float *offsets, const float *lensSamples, RayBuffer &rays) const
+{
+    int w = x1 - x0;
+    int n = w * (y1 - y0);
+    rays.resize(n);
+
+    // Fold the image size into the transform so that each direction is a multiply-add
+    // per axis from raster coordinates.  The loops below are plain float arithmetic
+    // over the SoA arrays so the compiler can vectorize them.
+    Eigen::Vector3f dx = screenToWorld.col(0) / imageWidth;
+    Eigen::Vector3f dy = screenToWorld.col(1) / imageHeight;
+    Eigen::Vector3f base = screenToWorld.col(2);
+
+    float *dir_x = rays.dir_x.data();
+    float *dir_y = rays.dir_y.data();
+    float *dir_z = rays.dir_z.data();
+    for (int y = y0; y < y1; y++)
+    {
+        int row = (y - y0) * w;
+        const float *o = offsets ? offsets + 2 * row : nullptr;
+        for (int i = 0; i < w; i++)
+        {
+            float px = x0 + i + (o ? o[2 * i] : 0.5f);
+            float py = y + (o ? o[2 * i + 1] : 0.5f);
+            dir_x[row + i] = base.x() + dx.x() * px + dy.x() * py;
+            dir_y[row + i] = base.y() + dx.y() * px + dy.y() * py;
+            dir_z[row + i] = base.z() + dx.z() * px + dy.z() * py;
+        }
+    }
+
+    std::fill_n(rays.org_x.begin(), n, eye.x());
+    std::fill_n(rays.org_y.begin(), n, eye.y());
+    std::fill_n(rays.org_z.begin(), n, eye.z());
+
+    // Thin lens: each pinhole direction has unit length along the view axis, so
+    // scaling it by the focus distance lands on the plane in focus.  Move the origin
+    // to the ray's point on the aperture and aim at that point.
+    if (hasLens() && lensSamples)
+    {
+        for (int k = 0; k < n; k++)
+        {
+            Eigen::Vector2f lens = apertureRadius * sampleAperture(Eigen::Vector2f(lensSamples[2 * k], lensSamples[2 * k + 1]));
+            Eigen::Vector3f offset = vu * lens.x() + vv * lens.y();
+            rays.org_x[k] += offset.x();
+            rays.org_y[k] += offset.y();
+            rays.org_z[k] += offset.z();
+            dir_x[k] = dir_x[k] * focusDistance - offset.x();
+            dir_y[k] = dir_y[k] * focusDistance - offset.y();
+            dir_z[k] = dir_z[k] * focusDistance - offset.z();
+        }
+    }
+
+    std::fill_n(rays.tnear.begin(), n, 0.f);
+    std::fill_n(rays.time.begin(), n, 0.f);
+    std::fill_n(rays.tfar.begin(), n, std::numeric_limits<float>::infinity());
+    std::fill_n(rays.mask.begin(), n, unsigned(CameraRays));
+    std::fill_n(rays.flags.begin(), n, 0u);
+    for (int k = 0; k < n; k++)
+        rays.id[k] = k;
+    std::fill_n(rays.geomID.begin(), n, RTC_INVALID_GEOMETRY_ID);
+    std::fill_n(rays.instID.begin(), n, RTC_INVALID_GEOMETRY_ID);
+}
+
+float RayCamera::getAspect() { return aspectRatio; }
+
+void RayCamera::setLens(float apertureRadius, float focusDistance, int blades, float bladeRotation)
+{
+    this->apertureRadius = std::max(apertureRadius, 0.f);
+    this->focusDistance = focusDistance;
+    this->blades = blades;
+    this->bladeRotation = bladeRotation;
+}
+
+Eigen::Vector2f RayCamera::sampleAperture(const Eigen::Vector2f &sample) const
+{
+    if (blades < 3)
+        return RTUtil::squareToUniformDiskConcentric(sample);
+
+    // Pick one of the polygon's triangular wedges with the first coordinate, reuse
+    // what is left of it, and sample the wedge uniformly
+    float x = sample.x() * blades;
+    int wedge = std::min(int(x), blades - 1);
+    x -= wedge;
+
+    float a0 = bladeRotation + 2 * M_PI * wedge / blades;
+    float a1 = bladeRotation + 2 * M_PI * (wedge + 1) / blades;
+    float su = sqrtf(x);
+    float b0 = su * (1 - sample.y());
+    float b1 = su * sample.y();
+    return Eigen::Vector2f(b0 * cosf(a0) + b1 * cosf(a1), b0 * sinf(a0) + b1 * sinf(a1));
+}
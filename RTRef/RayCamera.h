@@ -1,6 +1,10 @@
+#pragma once
+
 #include <RTUtil/Camera.hpp>
 #include <Eigen/Core>
 #include <ext/embree/include/embree3/rtcore.h>
+#include <raybuffer.h>
+#include <visibility.h>
 #include <stdio.h>
 
 class RayCamera
@@ -30,6 +34,21 @@ class RayCamera
   float near;
   float far;
 
+  // Thin lens: aperture radius in world units (0 for a pinhole), distance from the eye
+  // to the plane in focus, and the number and rotation (radians) of the aperture
+  // blades (fewer than 3 for a round aperture)
+  float apertureRadius = 0;
+  float focusDistance = 1;
+  int blades = 0;
+  float bladeRotation = 0;
+
+  // Takes normalized screen coordinates (u, v, 1) to an unnormalized ray direction.
+  // Rebuilt whenever the basis changes, so rays cost one matrix-vector product.
+  Eigen::Matrix3f screenToWorld;
+  Eigen::Matrix3f worldToScreen;
+
+  void updateTransform();
+
 public:
   /// Initalizes a default Camera.
   RayCamera();
@@ -54,8 +73,38 @@ public:
   // Generate a ray passing through (u,v) (normalized coords)
   RTCRay generateRay(float u, float v);
 
+  /// Generate the primary rays for the pixels [x0, x1) x [y0, y1) of an image of
+  /// imageWidth x imageHeight pixels, in row-major order from (x0, y0), ready to trace.
+  /// @param offsets Position of each ray within its pixel, as (x, y) pairs in [0, 1),
+  ///                or null to shoot through pixel centers.
+  /// @param lensSamples Uniform (x, y) pairs in [0, 1) choosing each ray's point on
+  ///                    the aperture; ignored by a pinhole camera, and when null every
+  ///                    ray leaves from the center of the lens.
+  void generateRays(int x0, int y0, int x1, int y1, int imageWidth, int imageHeight,
+                    const float *offsets, const float *lensSamples, RayBuffer &rays) const;
+
+  /// Turn the camera into a thin lens with the given aperture radius and focus
+  /// distance.  With 3 or more blades the aperture is a regular polygon, which gives
+  /// polygonal bokeh.  A radius of 0 restores the pinhole.
+  void setLens(float apertureRadius, float focusDistance, int blades = 0, float bladeRotation = 0);
+
+  bool hasLens() const { return apertureRadius > 0; }
+
+  /// Find where the pinhole ray through world point p crosses the screen, in the
+  /// normalized coordinates generateRay takes.  Returns false if p is behind the camera.
+  bool project(const Eigen::Vector3f &p, Eigen::Vector2f &screen) const;
+
+  /// Map a uniform sample in [0, 1)^2 to a uniformly distributed point on the unit
+  /// aperture (the unit disk, or the polygon inscribed in it)
+  Eigen::Vector2f sampleAperture(const Eigen::Vector2f &sample) const;
+
   void orbit(float theta, float phi);
 
+  /// Place the Camera at eye, looking at the point target.
+  void setView(Eigen::Vector3f eye, Eigen::Vector3f target, Eigen::Vector3f up);
+
+  Eigen::Vector3f getEye();
+
   Eigen::Vector3f getvw();
 
   void zoom(float z);
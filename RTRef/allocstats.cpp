@@ -0,0 +1,95 @@
+#include <allocstats.h>
+
+#ifdef RTREF_COUNT_ALLOCATIONS
+
+#include <atomic>
+#include <new>
+#include <stdlib.h>
+
+// Relaxed: only the totals matter, and an uncontended add costs next to nothing beside
+// malloc
+static std::atomic<long long> allocations(0);
+
+bool countingAllocations()
+{
+  return true;
+}
+
+long long heapAllocations()
+{
+  return allocations.load(std::memory_order_relaxed);
+}
+
+static void *allocate(size_t size)
+{
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  while (true)
+  {
+    if (void *p = malloc(size ? size : 1))
+      return p;
+    std::new_handler handler = std::get_new_handler();
+    if (!handler)
+      return nullptr;
+    handler();
+  }
+}
+
+void *operator new(size_t size)
+{
+  void *p = allocate(size);
+  if (!p)
+    throw std::bad_alloc();
+  return p;
+}
+
+void *operator new[](size_t size)
+{
+  void *p = allocate(size);
+  if (!p)
+    throw std::bad_alloc();
+  return p;
+}
+
+void *operator new(size_t size, const std::nothrow_t &) noexcept
+{
+  return allocate(size);
+}
+
+void *operator new[](size_t size, const std::nothrow_t &) noexcept
+{
+  return allocate(size);
+}
+
+void operator delete(void *p) noexcept
+{
+  free(p);
+}
+
+void operator delete[](void *p) noexcept
+{
+  free(p);
+}
+
+void operator delete(void *p, const std::nothrow_t &) noexcept
+{
+  free(p);
+}
+
+void operator delete[](void *p, const std::nothrow_t &) noexcept
+{
+  free(p);
+}
+
+#else
+
+bool countingAllocations()
+{
+  return false;
+}
+
+long long heapAllocations()
+{
+  return 0;
+}
+
+#endif
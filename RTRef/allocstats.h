@@ -0,0 +1,13 @@
+#pragma once
+
+// Counts of the program's heap allocations through operator new, which allocstats.cpp
+// replaces with versions that count calls before going to malloc.  Memory that Embree
+// and TBB allocate through their own allocators is not counted.  The replacements are
+// only built when configured with -DRTREF_COUNT_ALLOCATIONS=ON; otherwise nothing is
+// counted.
+
+/// Whether this build counts allocations
+bool countingAllocations();
+
+/// Calls to any operator new since the program started (0 if not counting)
+long long heapAllocations();
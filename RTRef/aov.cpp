@@ -0,0 +1,134 @@
+#include <aov.h>
+#include <imageio.h>
+#include <algorithm>
+#include <math.h>
+#include <sstream>
+#include <stdio.h>
+
+static const char *Names[] = {"depth", "normal", "albedo", "id", "lights", "samples", "time", "variance"};
+
+const char *AOVFilm::name(AOV aov)
+{
+  return Names[unsigned(aov)];
+}
+
+bool AOVFilm::parse(const std::string &list, unsigned &mask)
+{
+  mask = 0;
+  std::stringstream in(list);
+  std::string item;
+  while (std::getline(in, item, ','))
+  {
+    if (item == "all")
+    {
+      mask = aovBit(AOV::Count) - 1;
+      continue;
+    }
+
+    unsigned a = 0;
+    while (a < unsigned(AOV::Count) && item != Names[a])
+      a++;
+    if (a == unsigned(AOV::Count))
+    {
+      printf("error: unknown AOV %s (use depth, normal, albedo, id, lights, samples, time, variance or all)\n", item.c_str());
+      return false;
+    }
+    mask |= aovBit(AOV(a));
+  }
+  return true;
+}
+
+int AOVFilm::channels(AOV aov) const
+{
+  switch (aov)
+  {
+  case AOV::Normal:
+  case AOV::Albedo:
+    return 3;
+  case AOV::Lights:
+    return 3 * lights;
+  case AOV::Variance:
+    return 2;
+  default:
+    return 1;
+  }
+}
+
+void AOVFilm::configure(unsigned m, int w, int h, int l)
+{
+  mask = m;
+  width = w;
+  height = h;
+  lights = l;
+  for (unsigned a = 0; a < unsigned(AOV::Count); a++)
+  {
+    if (enabled(AOV(a)))
+      planes[a].resize(size_t(channels(AOV(a))) * width * height);
+    else
+      std::vector<float>().swap(planes[a]);
+  }
+  clear();
+}
+
+void AOVFilm::clear()
+{
+  samples = 0;
+  for (unsigned a = 0; a < unsigned(AOV::Count); a++)
+    std::fill(planes[a].begin(), planes[a].end(), AOV(a) == AOV::ID ? -1.f : 0.f);
+}
+
+bool AOVFilm::write(const std::string &prefix) const
+{
+  bool ok = true;
+  int pixels = width * height;
+  for (unsigned a = 0; a < unsigned(AOV::Count); a++)
+  {
+    AOV aov = AOV(a);
+    if (!enabled(aov))
+      continue;
+    const std::vector<float> &data = planes[a];
+    std::string path = prefix + Names[a] + ".pfm";
+
+    if (aov == AOV::Lights)
+    {
+      // One RGB image per light
+      std::vector<float> light(3 * pixels);
+      for (int l = 0; l < lights; l++)
+      {
+        for (int k = 0; k < pixels; k++)
+          for (int c = 0; c < 3; c++)
+            light[3 * k + c] = data[3 * (k * lights + l) + c];
+        std::stringstream name;
+        name << prefix << "light" << l << ".pfm";
+        ok &= writePFM(name.str(), width, height, 3, light.data());
+      }
+    }
+    else if (aov == AOV::Variance)
+    {
+      std::vector<float> variance(pixels);
+      for (int k = 0; k < pixels; k++)
+        variance[k] = std::max(data[2 * k + 1] - data[2 * k] * data[2 * k], 0.f);
+      ok &= writePFM(path, width, height, 1, variance.data());
+    }
+    else
+    {
+      ok &= writePFM(path, width, height, channels(aov), data.data());
+    }
+
+    if (aov == AOV::Time)
+    {
+      // Blue through green to red, scaled to the slowest pixel
+      float slowest = *std::max_element(data.begin(), data.end());
+      std::vector<float> heat(3 * pixels);
+      for (int k = 0; k < pixels; k++)
+      {
+        float t = slowest > 0 ? data[k] / slowest : 0;
+        heat[3 * k] = std::max(2 * t - 1, 0.f);
+        heat[3 * k + 1] = 1 - fabsf(2 * t - 1);
+        heat[3 * k + 2] = std::max(1 - 2 * t, 0.f);
+      }
+      ok &= writePNG(prefix + "time.png", width, height, heat.data());
+    }
+  }
+  return ok;
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+// Arbitrary output variables: per-pixel quantities recorded beside the beauty image in
+// the same render pass, for compositing and debugging
+enum class AOV
+{
+  // Distance from the camera to the first hit; 0 on the background
+  Depth,
+  // Shading normal at the first hit, facing the camera
+  Normal,
+  // Diffuse reflectance at the first hit
+  Albedo,
+  // Geometry ID of the first hit (which also selects its material); -1 on the background
+  ID,
+  // Direct contribution of each light, one RGB plane per light
+  Lights,
+  // Samples accumulated in the pixel, including history carried over a camera move
+  Samples,
+  // Microseconds spent shading each sample
+  Time,
+  // Luminance variance of the illumination (radiance / albedo), stored as its first two
+  // moments
+  Variance,
+  Count
+};
+
+constexpr unsigned aovBit(AOV aov) { return 1u << unsigned(aov); }
+
+// Film planes for the enabled AOVs.  Storage is opt-in: a disabled AOV has an empty
+// plane, and the renderer skips recording it, so beauty-only rendering pays nothing.
+// Planes hold running means over the samples since the last clear(), except ID, which
+// keeps the first sample's value, and Samples, which counts.  They are not filtered
+// with the beauty image's reconstruction filter, so Lights sums to the beauty image
+// exactly only with the box filter.
+class AOVFilm
+{
+public:
+  /// Allocate the planes in mask (a set of aovBit()s) for width x height pixels and
+  /// the given number of lights, and clear them
+  void configure(unsigned mask, int width, int height, int lights);
+
+  /// Restart the running means
+  void clear();
+
+  bool enabled(AOV aov) const { return (mask & aovBit(aov)) != 0; }
+  unsigned enabledMask() const { return mask; }
+
+  /// Channels per pixel of an AOV's plane
+  int channels(AOV aov) const;
+
+  std::vector<float> &plane(AOV aov) { return planes[unsigned(aov)]; }
+  const std::vector<float> &plane(AOV aov) const { return planes[unsigned(aov)]; }
+
+  /// Write each enabled AOV to prefix + name + ".pfm" (one file per light for Lights,
+  /// as lightN), plus a false-color prefix + "time.png" for Time
+  bool write(const std::string &prefix) const;
+
+  /// Name used in file names and on the command line
+  static const char *name(AOV aov);
+
+  /// Parse a comma-separated list of AOV names, or "all".  Returns false (after
+  /// printing the reason) for an unknown name.
+  static bool parse(const std::string &list, unsigned &mask);
+
+  // Passes averaged into the running means
+  unsigned samples = 0;
+
+  int width = 0, height = 0, lights = 0;
+
+private:
+  unsigned mask = 0;
+  std::vector<float> planes[unsigned(AOV::Count)];
+};
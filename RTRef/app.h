@@ -1,5 +1,11 @@
+#pragma once
+
 #include <../RTUtil/ImgGUI.hpp>
 #include <generator.h>
+#include <renderer.h>
+#include <dynamicres.h>
+#include <denoiser.h>
+#include <timer.h>
 #include <../ext/embree/include/embree3/rtcore.h>
 
 #include <sstream>
@@ -10,35 +16,64 @@ class MyGUI : public RTUtil::ImgGUI
 
   shared_ptr<SceneAndCam> sceneCam;
 
+  Renderer renderer;
+
 public:
-  MyGUI(string name, int width, int height, shared_ptr<SceneAndCam> s);
+  MyGUI(string name, int width, int height, shared_ptr<SceneAndCam> s, const Filter &filter = Filter());
   ~MyGUI();
 
   string saveName;
 
-  // int width, height;
-  unsigned int samples = 0;
+  // Keep the accumulated image across camera moves by reprojecting it (toggle with T)
+  bool temporal = true;
 
-  // pixel array for output
-  unsigned char *pixels;
+  // Preview resolution while the camera moves without reprojection; tune with R
+  // (toggle) and [ / ] (target frame time)
+  DynamicResolution resolution;
 
-  Eigen::Vector3f missColor;
+  // Show (and save) the denoised image instead of the raw one; toggle with D
+  bool denoise = false;
+  Denoiser denoiser;
 
-  void computeImage();
+  // Shade point and area lights by resampling light candidates (toggle with L)
+  void setResampling(bool on);
+  bool resampling() const { return renderer.resampler.enabled; }
+
+  // Trace paths of up to maxDepth vertices, optionally guided (toggle guiding with G)
+  void setPathTracing(int maxDepth, bool guiding);
+
+  // Add photon-mapped caustics; see CausticMap
+  void setCaustics(int photons, int gatherCount, float gatherRadius);
+
+  // Render through the wavefront pipeline (toggle with W, which prints its stage times
+  // when turned off), optionally sorting each bounce's rays
+  void setWavefront(bool on, bool sortRays = false);
+  bool wavefront() const { return renderer.wavefront.enabled; }
 
-  RTCRayHit castRay(RTCRay ray, bool shadow);
+  // Order the passes hand out their tiles in
+  void setTileOrder(TileOrder order) { renderer.setTileOrder(order); }
 
-  Eigen::Vector3f computeShading(Eigen::Vector3f incomingDir, Eigen::Vector3f intersection, Eigen::Vector3f normal, std::shared_ptr<nori::BSDF> material);
+  // Render on one thread pool per NUMA node; see Renderer::setNuma
+  void setNuma(bool on, bool pin) { renderer.setNuma(on, pin); }
+
+  // AOVs to record and save next to each saved frame, as a set of aovBit()s
+  unsigned aovs = 0;
+
+  void computeImage();
 
   virtual bool mouseMotionEvent(const Eigen::Vector2i &p, const Eigen::Vector2i &rel, int button, int modifiers) override;
 
   // virtual bool scrollEvent(const Eigen::Vector2i &p, const Eigen::Vector2i &rel) override;
 
-  // virtual bool keyboardEvent(int key, int scancode, int action, int modifiers) override;
-  // bool keyboardEvent(int key, int scancode, int action, int modifiers);
+  virtual bool keyboardEvent(int key, int scancode, int action, int modifiers) override;
 
 private:
   float theta;
   float phi;
   float deltaZoom;
-};
\ No newline at end of file
+
+  // Time since the camera last changed
+  Timer sinceMotion;
+
+  std::vector<float> denoised;
+};
@@ -0,0 +1,443 @@
+#include <bench.h>
+#include <allocstats.h>
+#include <renderer.h>
+#include <denoiser.h>
+#include <perfcounters.h>
+#include <timer.h>
+#include <RTUtil/json.hpp>
+
+#include <algorithm>
+#include <fstream>
+#include <math.h>
+#include <tbb/parallel_for.h>
+
+using json = nlohmann::json;
+
+double benchmarkTrace(shared_ptr<SceneAndCam> sc, int width, int height, int passes, const std::string &outputPath)
+{
+  Timer timer;
+  for (int pass = 0; pass < passes; pass++)
+  {
+    tbb::parallel_for(0, height, [&](int i) {
+      RTCIntersectContext context;
+      rtcInitIntersectContext(&context);
+      for (int j = 0; j < width; j++)
+      {
+        RTCRayHit rayhit;
+        rayhit.ray = sc->cam.generateRay((j + 0.5f) / width, (i + 0.5f) / height);
+        rayhit.hit.geomID = RTC_INVALID_GEOMETRY_ID;
+        rayhit.hit.instID[0] = RTC_INVALID_GEOMETRY_ID;
+        rtcIntersect1(sc->scene, &context, &rayhit);
+      }
+    });
+  }
+  double ms = timer.elapsedMs();
+  double mrays = double(width) * height * passes / (ms * 1000);
+
+  printf("trace: %.2f Mrays/s, %.1f bytes/triangle (%s storage)\n",
+         mrays, sc->report.bytesPerTriangle(), sc->report.compact ? "compact" : "full");
+
+  json j;
+  j["scene"] = sc->report.scene;
+  j["compact"] = sc->report.compact;
+  j["rays"] = double(width) * height * passes;
+  j["ms"] = ms;
+  j["mraysPerSecond"] = mrays;
+  j["bytesPerTriangle"] = sc->report.bytesPerTriangle();
+  j["bvhBytes"] = sc->report.bvhBytes;
+  if (sc->cache)
+  {
+    GeometryCache::Stats stats = sc->cache->stats();
+    j["streaming"] = {{"pageIns", stats.pageIns},
+                      {"evictions", stats.evictions},
+                      {"peakResidentBytes", stats.peakResidentBytes},
+                      {"cacheBytes", sc->report.cacheBytes}};
+  }
+  std::ofstream out(outputPath);
+  out << j.dump(4) << std::endl;
+
+  return mrays;
+}
+
+static double rmse(const std::vector<float> &a, const std::vector<float> &b)
+{
+  double sum = 0;
+  for (size_t i = 0; i < a.size(); i++)
+    sum += double(a[i] - b[i]) * (a[i] - b[i]);
+  return sqrt(sum / a.size());
+}
+
+double benchmarkDenoise(shared_ptr<SceneAndCam> sc, int width, int height, int maxSamples, int referenceSamples, const std::string &outputPath)
+{
+  // Seeded apart from the measured renders, so their errors are not correlated
+  std::vector<float> reference;
+  {
+    Renderer renderer(sc, width, height);
+    renderer.seed = 1;
+    for (int s = 0; s < referenceSamples; s++)
+      renderer.renderPass();
+    reference = renderer.image();
+  }
+
+  Renderer renderer(sc, width, height);
+  renderer.setAOVs(Denoiser::Guides);
+  Denoiser denoiser;
+  std::vector<float> denoised;
+  std::vector<int> counts;
+  std::vector<double> noisyErrors, denoisedErrors;
+  for (int spp = 1; spp <= maxSamples; spp *= 2)
+  {
+    while (int(renderer.sampleCount()) < spp)
+      renderer.renderPass();
+    denoiser.denoise(renderer.image(), renderer.aovs(), width, height, denoised);
+    counts.push_back(spp);
+    noisyErrors.push_back(rmse(renderer.image(), reference));
+    denoisedErrors.push_back(rmse(denoised, reference));
+  }
+
+  // Time repeated runs on the last image; the first run also sizes the buffers
+  double ms = 1e30;
+  for (int run = 0; run < 8; run++)
+    ms = std::min(ms, denoiser.denoise(renderer.image(), renderer.aovs(), width, height, denoised));
+  double msPerMegapixel = ms / (double(width) * height / 1e6);
+
+  printf("denoise: %.1f ms per megapixel (%.1f ms at %dx%d)\n", msPerMegapixel, ms, width, height);
+
+  json levels = json::array();
+  for (size_t i = 0; i < counts.size(); i++)
+  {
+    // Noisy sample count with the same error: interpolated on a log-log scale between
+    // the measured counts that bracket it, or extrapolated from the nearest one
+    double target = denoisedErrors[i];
+    size_t k = 0;
+    while (k < counts.size() && noisyErrors[k] > target)
+      k++;
+    double equal;
+    if (k == 0 || k == counts.size())
+    {
+      size_t n = k == 0 ? 0 : counts.size() - 1;
+      equal = counts[n] * (noisyErrors[n] / target) * (noisyErrors[n] / target);
+    }
+    else
+    {
+      double t = log(noisyErrors[k - 1] / target) / log(noisyErrors[k - 1] / noisyErrors[k]);
+      equal = counts[k - 1] * pow(double(counts[k]) / counts[k - 1], t);
+    }
+
+    printf("  %4d spp: rmse %.4f noisy, %.4f denoised; matches %.1f spp noisy (%.1fx fewer samples)\n",
+           counts[i], noisyErrors[i], denoisedErrors[i], equal, equal / counts[i]);
+    levels.push_back({{"samples", counts[i]},
+                      {"noisyRmse", noisyErrors[i]},
+                      {"denoisedRmse", denoisedErrors[i]},
+                      {"equalQualitySamples", equal},
+                      {"sampleSavings", equal / counts[i]}});
+  }
+
+  json j;
+  j["scene"] = sc->report.scene;
+  j["width"] = width;
+  j["height"] = height;
+  j["referenceSamples"] = referenceSamples;
+  j["iterations"] = denoiser.iterations;
+  j["denoiseMs"] = ms;
+  j["msPerMegapixel"] = msPerMegapixel;
+  j["levels"] = levels;
+  std::ofstream out(outputPath);
+  out << j.dump(4) << std::endl;
+
+  return msPerMegapixel;
+}
+
+double benchmarkGuiding(shared_ptr<SceneAndCam> sc, int width, int height, int maxDepth, double budgetMs, int referenceSamples,
+                        const std::string &outputPath)
+{
+  std::vector<float> reference;
+  {
+    Renderer renderer(sc, width, height);
+    renderer.seed = 1;
+    renderer.maxDepth = maxDepth;
+    renderer.guiding = true;
+    for (int s = 0; s < referenceSamples; s++)
+      renderer.renderPass();
+    reference = renderer.image();
+  }
+
+  json modes = json::array();
+  double errors[2];
+  for (int guided = 0; guided < 2; guided++)
+  {
+    Renderer renderer(sc, width, height);
+    renderer.maxDepth = maxDepth;
+    renderer.guiding = guided != 0;
+    Timer timer;
+    while (timer.elapsedMs() < budgetMs)
+      renderer.renderPass();
+    double ms = timer.elapsedMs();
+    errors[guided] = rmse(renderer.image(), reference);
+
+    printf("  %s: %u spp in %.0f ms, rmse %.4f\n", guided ? "guided" : "bsdf", renderer.sampleCount(), ms, errors[guided]);
+    json mode = {{"guided", guided != 0},
+                 {"samples", renderer.sampleCount()},
+                 {"ms", ms},
+                 {"rmse", errors[guided]}};
+    if (guided)
+    {
+      mode["iterations"] = renderer.guide.iterations();
+      mode["spatialLeaves"] = renderer.guide.leafCount();
+    }
+    modes.push_back(mode);
+  }
+
+  double ratio = errors[1] > 0 ? errors[0] / errors[1] : 0;
+  printf("guiding: %.2fx lower rmse than BSDF sampling in %.0f ms (%.2fx fewer samples for equal error)\n",
+         ratio, budgetMs, ratio * ratio);
+
+  json j;
+  j["scene"] = sc->report.scene;
+  j["width"] = width;
+  j["height"] = height;
+  j["maxDepth"] = maxDepth;
+  j["budgetMs"] = budgetMs;
+  j["referenceSamples"] = referenceSamples;
+  j["modes"] = modes;
+  j["rmseRatio"] = ratio;
+  std::ofstream out(outputPath);
+  out << j.dump(4) << std::endl;
+
+  return ratio;
+}
+
+double benchmarkWavefront(shared_ptr<SceneAndCam> sc, int width, int height, int maxDepth, int passes, const std::string &outputPath)
+{
+  json modes = json::array();
+  std::vector<float> images[2];
+  double times[2];
+  for (int w = 0; w < 2; w++)
+  {
+    Renderer renderer(sc, width, height);
+    renderer.maxDepth = maxDepth;
+    renderer.wavefront.enabled = w != 0;
+    // One pass to warm up the caches and the thread pool
+    renderer.renderPass();
+    renderer.reset();
+    renderer.wavefront.resetTimes();
+
+    Timer timer;
+    for (int s = 0; s < passes; s++)
+      renderer.renderPass();
+    times[w] = timer.elapsedMs();
+    images[w] = renderer.image();
+
+    printf("  %s: %d passes in %.0f ms (%.1f ms per pass)\n", w ? "wavefront" : "per-path", passes, times[w], times[w] / passes);
+    json mode = {{"wavefront", w != 0}, {"passes", passes}, {"ms", times[w]}};
+    if (w)
+    {
+      json stages;
+      for (int s = 0; s < Wavefront::StageCount; s++)
+        stages[Wavefront::stageName(Wavefront::Stage(s))] = renderer.wavefront.stageMs(Wavefront::Stage(s));
+      mode["stageMs"] = stages;
+      mode["pathRays"] = renderer.wavefront.pathRays();
+      mode["shadowRays"] = renderer.wavefront.shadowRays();
+      mode["mraysPerSecond"] = (renderer.wavefront.pathRays() + renderer.wavefront.shadowRays()) / (times[w] * 1e3);
+      renderer.wavefront.printTimes();
+    }
+    modes.push_back(mode);
+  }
+
+  double speedup = times[1] > 0 ? times[0] / times[1] : 0;
+  double difference = rmse(images[0], images[1]);
+  printf("wavefront: %.2fx the per-path speed, rmse %.4f between the two\n", speedup, difference);
+
+  json j;
+  j["scene"] = sc->report.scene;
+  j["width"] = width;
+  j["height"] = height;
+  j["maxDepth"] = maxDepth;
+  j["modes"] = modes;
+  j["speedup"] = speedup;
+  j["rmse"] = difference;
+  std::ofstream out(outputPath);
+  out << j.dump(4) << std::endl;
+
+  return speedup;
+}
+
+double benchmarkLocality(shared_ptr<SceneAndCam> sc, int width, int height, int maxDepth, int passes, const std::string &outputPath)
+{
+  struct Mode
+  {
+    TileOrder order;
+    bool wavefront, sortRays;
+  };
+  const Mode modes[] = {{TileOrder::Rows, false, false},
+                        {TileOrder::Morton, false, false},
+                        {TileOrder::Hilbert, false, false},
+                        {TileOrder::Hilbert, true, false},
+                        {TileOrder::Hilbert, true, true}};
+
+  json results = json::array();
+  double rowsMs = 0, bestMs = 0;
+  bool available = true;
+  for (const Mode &mode : modes)
+  {
+    Renderer renderer(sc, width, height);
+    renderer.maxDepth = maxDepth;
+    renderer.setTileOrder(mode.order);
+    renderer.wavefront.enabled = mode.wavefront;
+    renderer.wavefront.sortRays = mode.sortRays;
+    PerfCounters counters(renderer.threadPool());
+    // One pass to warm up the caches and the thread pool
+    renderer.renderPass();
+    renderer.reset();
+
+    counters.start();
+    Timer timer;
+    for (int s = 0; s < passes; s++)
+      renderer.renderPass();
+    double ms = timer.elapsedMs();
+    counters.stop();
+
+    std::string name = std::string(tileOrderName(mode.order)) + (mode.wavefront ? mode.sortRays ? "+wavefront+sorted" : "+wavefront" : "");
+    json result = {{"mode", name}, {"order", tileOrderName(mode.order)}, {"wavefront", mode.wavefront},
+                   {"sortRays", mode.sortRays}, {"passes", passes}, {"ms", ms}};
+    printf("  %-26s %8.0f ms", name.c_str(), ms);
+    available = counters.available();
+    if (available)
+    {
+      json events;
+      for (int e = 0; e < PerfCounters::EventCount; e++)
+        events[PerfCounters::eventName(PerfCounters::Event(e))] = counters.count(PerfCounters::Event(e));
+      result["counters"] = events;
+      long long instructions = counters.count(PerfCounters::Instructions);
+      printf("  IPC %.2f, L1D misses %.1f / kinst, LLC misses %.2f / kinst",
+             double(instructions) / std::max(counters.count(PerfCounters::Cycles), 1LL),
+             1000.0 * counters.count(PerfCounters::L1DMisses) / std::max(instructions, 1LL),
+             1000.0 * counters.count(PerfCounters::LastLevelMisses) / std::max(instructions, 1LL));
+    }
+    printf("\n");
+    results.push_back(result);
+
+    if (mode.order == TileOrder::Rows && !mode.wavefront)
+      rowsMs = ms;
+    bestMs = bestMs > 0 ? std::min(bestMs, ms) : ms;
+  }
+  if (!available)
+    printf("locality: hardware counters unavailable (see /proc/sys/kernel/perf_event_paranoid); times only\n");
+
+  double speedup = bestMs > 0 ? rowsMs / bestMs : 0;
+  printf("locality: fastest order %.2fx the row order's speed\n", speedup);
+
+  json j;
+  j["scene"] = sc->report.scene;
+  j["width"] = width;
+  j["height"] = height;
+  j["maxDepth"] = maxDepth;
+  j["counters"] = available;
+  j["modes"] = results;
+  j["speedup"] = speedup;
+  std::ofstream out(outputPath);
+  out << j.dump(4) << std::endl;
+
+  return speedup;
+}
+
+double benchmarkNuma(shared_ptr<SceneAndCam> sc, int width, int height, int maxDepth, int passes, const std::string &outputPath)
+{
+  static const char *names[3] = {"single", "numa", "numa+pinned"};
+  json modes = json::array();
+  std::vector<float> reference;
+  double times[3];
+  NumaTopology topology = NumaTopology::detect();
+  printf("numa: %s\n", topology.describe().c_str());
+  for (int m = 0; m < 3; m++)
+  {
+    Renderer renderer(sc, width, height);
+    renderer.maxDepth = maxDepth;
+    if (m > 0)
+      renderer.setNuma(true, m == 2);
+    // One pass to warm up the caches and the thread pools
+    renderer.renderPass();
+    renderer.reset();
+
+    Timer timer;
+    for (int s = 0; s < passes; s++)
+      renderer.renderPass();
+    times[m] = timer.elapsedMs();
+    if (m == 0)
+      reference = renderer.image();
+    double difference = rmse(reference, renderer.image());
+    double msamples = double(width) * height * passes / (times[m] * 1e3);
+
+    printf("  %-12s %d passes in %.0f ms (%.2f Msamples/s), rmse %.4f\n", names[m], passes, times[m], msamples, difference);
+    json mode = {{"mode", names[m]}, {"passes", passes}, {"ms", times[m]}, {"msamplesPerSecond", msamples}, {"rmse", difference}};
+    modes.push_back(mode);
+  }
+
+  double speedup = times[2] > 0 ? times[0] / times[2] : 0;
+  printf("numa: pinned pools %.2fx the single pool's speed\n", speedup);
+
+  json j;
+  j["scene"] = sc->report.scene;
+  j["width"] = width;
+  j["height"] = height;
+  j["maxDepth"] = maxDepth;
+  j["nodes"] = topology.nodes();
+  j["cpus"] = topology.cpus();
+  j["topology"] = topology.describe();
+  j["modes"] = modes;
+  j["speedup"] = speedup;
+  std::ofstream out(outputPath);
+  out << j.dump(4) << std::endl;
+
+  return speedup;
+}
+
+long long benchmarkAllocations(shared_ptr<SceneAndCam> sc, int width, int height, int maxDepth, int passes, const std::string &outputPath)
+{
+  if (!countingAllocations())
+  {
+    printf("allocations: not counted in this build (configure with -DRTREF_COUNT_ALLOCATIONS=ON)\n");
+    return -1;
+  }
+
+  // Caustics only with direct lighting, since paths already find them
+  static const char *names[3] = {"per-path", "wavefront", "caustics"};
+  json modes = json::array();
+  long long total = 0;
+  for (int w = 0; w < 3; w++)
+  {
+    Renderer renderer(sc, width, height);
+    renderer.maxDepth = w < 2 ? maxDepth : 1;
+    renderer.wavefront.enabled = w == 1;
+    renderer.caustics.photons = w == 2 ? 20000 : 0;
+    // Warm up: the thread pool, each thread's scratch and arena, and the photon map
+    for (int s = 0; s < 3; s++)
+      renderer.renderPass();
+    renderer.reset();
+
+    long long before = heapAllocations();
+    Timer timer;
+    for (int s = 0; s < passes; s++)
+      renderer.renderPass();
+    double ms = timer.elapsedMs();
+    long long allocations = heapAllocations() - before;
+    total += allocations;
+
+    printf("  %s: %lld heap allocations in %d passes (%.1f ms per pass)\n", names[w], allocations, passes, ms / passes);
+    json mode = {{"mode", names[w]}, {"maxDepth", renderer.maxDepth}, {"passes", passes}, {"ms", ms}, {"allocations", allocations}};
+    modes.push_back(mode);
+  }
+  printf("allocations: %s\n", total == 0 ? "none in the render loop" : "the render loop allocates");
+
+  json j;
+  j["scene"] = sc->report.scene;
+  j["width"] = width;
+  j["height"] = height;
+  j["maxDepth"] = maxDepth;
+  j["modes"] = modes;
+  j["allocations"] = total;
+  std::ofstream out(outputPath);
+  out << j.dump(4) << std::endl;
+
+  return total;
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <generator.h>
+#include <string>
+
+// Benchmarks run from the command line instead of the interactive viewer.  Each prints
+// its results and writes them as JSON under output/.
+
+/// Trace primary rays only (no shading) for a number of passes over a width x height
+/// image and report throughput alongside the scene's memory per triangle, to compare
+/// storage modes such as LoadOptions::compact.
+/// @return Millions of rays per second.
+double benchmarkTrace(shared_ptr<SceneAndCam> sc, int width, int height, int passes, const std::string &outputPath);
+
+/// Measure the Denoiser on a width x height render of the scene's view.  Renders with
+/// 1, 2, 4, ... maxSamples samples per pixel are compared, before and after denoising,
+/// against an independent referenceSamples render; for each, the report gives the
+/// sample count a noisy render would need to match the denoised error, assuming the
+/// error falls as 1 / sqrt(samples) beyond the measured range.
+/// @return Denoising time in milliseconds per megapixel.
+double benchmarkDenoise(shared_ptr<SceneAndCam> sc, int width, int height, int maxSamples, int referenceSamples, const std::string &outputPath);
+
+/// Compare path tracing with maxDepth vertices per path using BSDF sampling alone and
+/// with path guiding, at equal time: each renders passes of a width x height image for
+/// budgetMs (the guided render including its training), and both are compared against
+/// an independent guided referenceSamples render.
+/// @return The ratio of the BSDF-sampled render's RMSE to the guided one's.
+double benchmarkGuiding(shared_ptr<SceneAndCam> sc, int width, int height, int maxDepth, double budgetMs, int referenceSamples,
+                        const std::string &outputPath);
+
+/// Compare the per-path integrator with the wavefront pipeline on the same passes
+/// (paths of maxDepth vertices over a width x height image), reporting each one's time
+/// and ray throughput, the wavefront's time per stage, and the RMSE between the two
+/// images, which should only differ by noise.
+/// @return The per-path time over the wavefront time.
+double benchmarkWavefront(shared_ptr<SceneAndCam> sc, int width, int height, int maxDepth, int passes, const std::string &outputPath);
+
+/// Compare the memory locality of tile orders on the same passes (paths of maxDepth
+/// vertices over a width x height image): tiles in rows, along a Morton curve and along
+/// a Hilbert curve, and the Hilbert order through the wavefront pipeline with and
+/// without its bounces' rays sorted.  Reports each one's time and, where the kernel
+/// allows, its cycles, instructions and cache misses summed over the threads.
+/// @return The row order's time over the fastest one's.
+double benchmarkLocality(shared_ptr<SceneAndCam> sc, int width, int height, int maxDepth, int passes, const std::string &outputPath);
+
+/// Compare the thread pools on the same passes (paths of maxDepth vertices over a
+/// width x height image): the single pool, one pool per NUMA node without pinning, and
+/// one per node with its threads pinned to the node's CPUs (see Renderer::setNuma).
+/// Reports each one's time and sample throughput, and the RMSE of each image against
+/// the single pool's, which should only differ by noise.
+/// @return The single pool's time over the pinned pools' time.
+double benchmarkNuma(shared_ptr<SceneAndCam> sc, int width, int height, int maxDepth, int passes, const std::string &outputPath);
+
+/// Check that rendering allocates nothing from the heap once warmed up: after a few
+/// passes to size the per-thread buffers and arenas, count the operator new calls (see
+/// allocstats.h) over more passes of paths of maxDepth vertices, per-path and through
+/// the wavefront pipeline, and of direct lighting with caustics (if the scene has lights
+/// that emit photons).
+/// @return The allocations counted over the measured passes; 0 when the render loop is
+/// allocation-free, and -1 when the build does not count allocations.
+long long benchmarkAllocations(shared_ptr<SceneAndCam> sc, int width, int height, int maxDepth, int passes, const std::string &outputPath);
@@ -0,0 +1,231 @@
+#include <caustics.h>
+#include <lights.h>
+#include <sampler.h>
+#include <timer.h>
+#include <tbb/blocked_range.h>
+#include <tbb/enumerable_thread_specific.h>
+#include <tbb/parallel_for.h>
+#include <tbb/parallel_invoke.h>
+#include <algorithm>
+#include <math.h>
+
+static inline float luminance(const Eigen::Vector3f &c)
+{
+  return 0.2126f * c.x() + 0.7152f * c.y() + 0.0722f * c.z();
+}
+
+void CausticMap::clear()
+{
+  std::vector<Photon>().swap(map);
+  valid = false;
+}
+
+double CausticMap::build(shared_ptr<SceneAndCam> sc, unsigned seed)
+{
+  Timer timer;
+  clear();
+
+  RTCBounds bounds;
+  rtcGetSceneBounds(sc->scene, &bounds);
+  float diagonal = Eigen::Vector3f(bounds.upper_x - bounds.lower_x, bounds.upper_y - bounds.lower_y, bounds.upper_z - bounds.lower_z).norm();
+  radius = gatherRadius > 0 ? gatherRadius : 0.01f * diagonal;
+
+  // Pick lights by power
+  std::vector<int> emitters;
+  std::vector<float> cdf;
+  float totalPower = 0;
+  for (int i = 0; i < int(sc->lights.size()); i++)
+  {
+    float power = luminance(sc->lights[i]->emittedPower());
+    if (power <= 0)
+      continue;
+    totalPower += power;
+    emitters.push_back(i);
+    cdf.push_back(totalPower);
+  }
+  valid = true;
+  if (emitters.empty() || photons <= 0)
+    return timer.elapsedMs();
+
+  tbb::enumerable_thread_specific<std::vector<Photon>> stored;
+  tbb::parallel_for(tbb::blocked_range<int>(0, photons, 1024), [&](const tbb::blocked_range<int> &range) {
+    std::vector<Photon> &local = stored.local();
+    PCG32 random(uint64_t(range.begin()), seed);
+    RTCIntersectContext context;
+    rtcInitIntersectContext(&context);
+
+    for (int n = range.begin(); n < range.end(); n++)
+    {
+      float pick = random.nextFloat() * totalPower;
+      int e = std::min(int(std::upper_bound(cdf.begin(), cdf.end(), pick) - cdf.begin()), int(emitters.size()) - 1);
+      const BaseLight &light = *sc->lights[emitters[e]];
+      float probability = (cdf[e] - (e > 0 ? cdf[e - 1] : 0)) / totalPower;
+
+      Eigen::Vector3f origin, dir;
+      Eigen::Vector2f u(random.nextFloat(), random.nextFloat()), v(random.nextFloat(), random.nextFloat());
+      if (!light.samplePhoton(u, v, origin, dir))
+        continue;
+      Eigen::Vector3f power = light.emittedPower() / (probability * photons);
+
+      bool caustic = false;
+      for (int bounce = 0; bounce < maxBounces; bounce++)
+      {
+        RTCRayHit rayhit;
+        rayhit.ray.org_x = origin.x();
+        rayhit.ray.org_y = origin.y();
+        rayhit.ray.org_z = origin.z();
+        rayhit.ray.dir_x = dir.x();
+        rayhit.ray.dir_y = dir.y();
+        rayhit.ray.dir_z = dir.z();
+        rayhit.ray.tnear = .01f;
+        rayhit.ray.tfar = std::numeric_limits<float>::infinity();
+        rayhit.ray.time = 0;
+        rayhit.ray.mask = CameraRays;
+        rayhit.ray.id = 0;
+        rayhit.ray.flags = 0;
+        rayhit.hit.geomID = RTC_INVALID_GEOMETRY_ID;
+        rayhit.hit.instID[0] = RTC_INVALID_GEOMETRY_ID;
+        rtcIntersect1(sc->scene, &context, &rayhit);
+        if (rayhit.hit.geomID == RTC_INVALID_GEOMETRY_ID)
+          break;
+
+        origin += rayhit.ray.tfar * dir;
+        if (caustic)
+        {
+          Photon photon;
+          photon.position = origin;
+          photon.direction = dir;
+          photon.power = power;
+          photon.axis = 0;
+          local.push_back(photon);
+        }
+
+        shared_ptr<nori::BSDF> material = sc->materials.at(rayhit.hit.geomID);
+        const nori::Microfacet *glossy = dynamic_cast<const nori::Microfacet *>(material.get());
+        if (!glossy || glossy->alpha() >= glossyRoughness)
+          break;
+
+        // Continue by the specular lobe alone: the BSDF less its diffuse term
+        Eigen::Vector3f geomNorm(rayhit.hit.Ng_x, rayhit.hit.Ng_y, rayhit.hit.Ng_z);
+        Eigen::Vector3f normal = sc->shadingNormal(rayhit.hit);
+        if (geomNorm.dot(dir) > 0)
+          geomNorm = -geomNorm;
+        if (normal.dot(geomNorm) < 0)
+          normal = -normal;
+        normal.normalize();
+
+        nori::Frame frame(normal);
+        nori::BSDFQueryRecord query(frame.toLocal(-dir));
+        if (material->sample(query, Eigen::Vector2f(random.nextFloat(), random.nextFloat())).isZero())
+          break;
+        float pdf = material->pdf(query);
+        Eigen::Vector3f specular = material->eval(query) - material->diffuseReflectance() / M_PI;
+        Eigen::Vector3f weight = specular * (nori::Frame::cosTheta(query.wo) / pdf);
+        power = power.cwiseProduct(weight.cwiseMax(Eigen::Vector3f::Zero()));
+        dir = frame.toWorld(query.wo);
+        caustic = true;
+
+        // Russian roulette on the reflected fraction
+        float survival = std::min(weight.maxCoeff(), 1.f);
+        if (random.nextFloat() >= survival)
+          break;
+        power /= survival;
+      }
+    }
+  });
+
+  for (const std::vector<Photon> &local : stored)
+    map.insert(map.end(), local.begin(), local.end());
+  balance(map.data(), map.data() + map.size());
+
+  double ms = timer.elapsedMs();
+  printf("caustics: %zu photons stored of %d shot in %.1f ms\n", map.size(), photons, ms);
+  return ms;
+}
+
+void CausticMap::balance(Photon *begin, Photon *end)
+{
+  if (end - begin <= 1)
+  {
+    if (end - begin == 1)
+      begin->axis = 0;
+    return;
+  }
+
+  // Split across the longest extent
+  Eigen::Vector3f lo = begin->position, hi = begin->position;
+  for (const Photon *p = begin + 1; p < end; p++)
+  {
+    lo = lo.cwiseMin(p->position);
+    hi = hi.cwiseMax(p->position);
+  }
+  int axis;
+  (hi - lo).maxCoeff(&axis);
+
+  Photon *mid = begin + (end - begin) / 2;
+  std::nth_element(begin, mid, end, [axis](const Photon &a, const Photon &b) {
+    return a.position[axis] < b.position[axis];
+  });
+  mid->axis = axis;
+
+  // Large subtrees are balanced in parallel; small ones are not worth a task
+  if (end - begin > 4096)
+    tbb::parallel_invoke([&]() { balance(begin, mid); }, [&]() { balance(mid + 1, end); });
+  else
+  {
+    balance(begin, mid);
+    balance(mid + 1, end);
+  }
+}
+
+void CausticMap::nearest(const Photon *begin, const Photon *end, const Eigen::Vector3f &position, float &maxDistance2,
+                         Neighbor *heap, int &size) const
+{
+  while (begin < end)
+  {
+    const Photon *mid = begin + (end - begin) / 2;
+    float offset = position[mid->axis] - mid->position[mid->axis];
+
+    // Search the side of the split holding the position first
+    const Photon *nearBegin = offset < 0 ? begin : mid + 1;
+    const Photon *nearEnd = offset < 0 ? mid : end;
+    nearest(nearBegin, nearEnd, position, maxDistance2, heap, size);
+
+    float distance2 = (mid->position - position).squaredNorm();
+    if (distance2 < maxDistance2)
+    {
+      if (size == gatherCount)
+        std::pop_heap(heap, heap + size--);
+      heap[size++] = Neighbor(distance2, mid);
+      std::push_heap(heap, heap + size);
+      if (size == gatherCount)
+        maxDistance2 = heap[0].first;
+    }
+
+    // Then the far side, only if the split plane is within reach
+    if (offset * offset >= maxDistance2)
+      return;
+    begin = offset < 0 ? mid + 1 : begin;
+    end = offset < 0 ? end : mid;
+  }
+}
+
+Eigen::Vector3f CausticMap::gather(const Eigen::Vector3f &position, const Eigen::Vector3f &normal, const Eigen::Vector3f &diffuse,
+                                   MemoryArena &arena) const
+{
+  if (map.empty() || gatherCount <= 0)
+    return Eigen::Vector3f::Zero();
+
+  MemoryArena::Scope scope(arena);
+  Neighbor *heap = arena.allocate<Neighbor>(gatherCount);
+  int size = 0;
+  float maxDistance2 = radius * radius;
+  nearest(map.data(), map.data() + map.size(), position, maxDistance2, heap, size);
+
+  // Photons that arrived from the front of the surface, over the disc they were found in
+  Eigen::Vector3f flux(0, 0, 0);
+  for (int i = 0; i < size; i++)
+    if (heap[i].second->direction.dot(normal) < 0)
+      flux += heap[i].second->power;
+  return diffuse.cwiseProduct(flux) / float(M_PI * M_PI * maxDistance2);
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <generator.h>
+#include <memoryarena.h>
+#include <vector>
+
+// Photon that reached a surface after at least one glossy reflection
+struct Photon
+{
+  Eigen::Vector3f position;
+  // Direction of travel when it arrived
+  Eigen::Vector3f direction;
+  Eigen::Vector3f power;
+  // Split axis of the kd-tree node this photon is the median of
+  int axis;
+};
+
+// Caustic photon map (Jensen 1996).  A pre-pass shoots photons from the point and area
+// lights, choosing lights in proportion to their power, and follows them through
+// reflections off glossy surfaces (roughness below glossyRoughness, reflected by their
+// specular lobe only).  Each photon that then lands on a surface is stored; the first
+// bounce off a rough surface ends it, since light sampling already covers those paths.
+// The radiance of the diffuse lobe at a shading point is estimated from the nearest
+// photons, which carries the light focused by glossy surfaces that shadow rays
+// through them cannot find.
+//
+// The photons are stored as a balanced kd-tree in one array: each subrange's
+// median photon is its node, and the halves on either side are its subtrees, so the
+// tree needs no pointers and a search touches contiguous memory.  Photons are traced
+// and the tree built in parallel with TBB.
+class CausticMap
+{
+public:
+  // Photons shot per build; 0 turns caustics off
+  int photons = 0;
+  // Nearest photons used per estimate
+  int gatherCount = 50;
+  // Largest gather radius; 0 uses 1% of the scene's diagonal
+  float gatherRadius = 0;
+  float glossyRoughness = 0.3f;
+  int maxBounces = 8;
+
+  bool built() const { return valid; }
+
+  /// Discard the photons, e.g. after the geometry moved; the next build() reshoots them
+  void clear();
+
+  /// Shoot the photons and build the tree
+  /// @return The time taken, in milliseconds.
+  double build(shared_ptr<SceneAndCam> sc, unsigned seed = 0);
+
+  /// Caustic radiance leaving a surface with the given diffuse reflectance, at position
+  /// with normal facing the viewer.  The search's heap of neighbours is taken from arena.
+  Eigen::Vector3f gather(const Eigen::Vector3f &position, const Eigen::Vector3f &normal, const Eigen::Vector3f &diffuse,
+                         MemoryArena &arena) const;
+
+  size_t size() const { return map.size(); }
+
+private:
+  std::vector<Photon> map;
+  float radius = 0;
+  bool valid = false;
+
+  // Arrange [begin, end) as a kd-tree
+  static void balance(Photon *begin, Photon *end);
+
+  // Neighbour of a k-nearest search: squared distance and photon
+  typedef std::pair<float, const Photon *> Neighbor;
+
+  // Add the photons of the subtree [begin, end) within sqrt(maxDistance2) of position to
+  // the max-heap of the nearest (heap[0, size), room for gatherCount), shrinking
+  // maxDistance2 once it is full
+  void nearest(const Photon *begin, const Photon *end, const Eigen::Vector3f &position, float &maxDistance2,
+               Neighbor *heap, int &size) const;
+};
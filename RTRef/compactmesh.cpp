@@ -0,0 +1,198 @@
+#include <compactmesh.h>
+#include <Eigen/Geometry>
+#include <algorithm>
+#include <limits>
+#include <math.h>
+
+static float signNotZero(float x)
+{
+    return x >= 0 ? 1.f : -1.f;
+}
+
+CompactMesh::CompactMesh(const std::vector<Eigen::Vector3f> &positions, const std::vector<Eigen::Vector3f> &normals, const std::vector<unsigned> &indices)
+    : numTris(indices.size() / 3)
+{
+    lower = Eigen::Vector3f::Constant(std::numeric_limits<float>::infinity());
+    Eigen::Vector3f upper = -lower;
+    for (const Eigen::Vector3f &p : positions)
+    {
+        lower = lower.cwiseMin(p);
+        upper = upper.cwiseMax(p);
+    }
+    step = (upper - lower) / 65535.f;
+
+    qpositions.resize(3 * positions.size());
+    for (int i = 0; i < positions.size(); i++)
+    {
+        for (int k = 0; k < 3; k++)
+        {
+            float q = step[k] > 0 ? (positions[i][k] - lower[k]) / step[k] : 0.f;
+            qpositions[3 * i + k] = uint16_t(std::min(std::max(q + 0.5f, 0.f), 65535.f));
+        }
+    }
+
+    if (positions.size() <= 65536)
+        indices16.assign(indices.begin(), indices.end());
+    else
+        indices32.assign(indices.begin(), indices.end());
+
+    // Octahedral encoding: project onto the octahedron |x| + |y| + |z| = 1, fold the
+    // lower half over the upper, and store x and y as 16-bit signed fractions
+    octNormals.resize(2 * normals.size());
+    for (int i = 0; i < normals.size(); i++)
+    {
+        Eigen::Vector3f n = normals[i] / normals[i].lpNorm<1>();
+        float x = n.x(), y = n.y();
+        if (n.z() < 0)
+        {
+            x = (1 - fabsf(n.y())) * signNotZero(n.x());
+            y = (1 - fabsf(n.x())) * signNotZero(n.y());
+        }
+        octNormals[2 * i] = int16_t(roundf(x * 32767));
+        octNormals[2 * i + 1] = int16_t(roundf(y * 32767));
+    }
+}
+
+size_t CompactMesh::bytes() const
+{
+    return qpositions.size() * sizeof(uint16_t) +
+           indices16.size() * sizeof(uint16_t) +
+           indices32.size() * sizeof(uint32_t) +
+           octNormals.size() * sizeof(int16_t);
+}
+
+Eigen::Vector3f CompactMesh::decodeNormal(unsigned i) const
+{
+    float x = octNormals[2 * i] / 32767.f;
+    float y = octNormals[2 * i + 1] / 32767.f;
+    float z = 1 - fabsf(x) - fabsf(y);
+    if (z < 0)
+    {
+        float fx = (1 - fabsf(y)) * signNotZero(x);
+        y = (1 - fabsf(x)) * signNotZero(y);
+        x = fx;
+    }
+    return Eigen::Vector3f(x, y, z).normalized();
+}
+
+Eigen::Vector3f CompactMesh::normal(unsigned primID, float u, float v) const
+{
+    unsigned a, b, c;
+    triangle(primID, a, b, c);
+    return (1 - u - v) * decodeNormal(a) + u * decodeNormal(b) + v * decodeNormal(c);
+}
+
+RTCGeometry CompactMesh::createGeometry(RTCDevice device) const
+{
+    RTCGeometry geom = rtcNewGeometry(device, RTC_GEOMETRY_TYPE_USER);
+    rtcSetGeometryUserPrimitiveCount(geom, numTris);
+    rtcSetGeometryUserData(geom, (void *)this);
+    rtcSetGeometryBoundsFunction(geom, boundsFunction, nullptr);
+    rtcSetGeometryIntersectFunction(geom, intersectFunction);
+    rtcSetGeometryOccludedFunction(geom, occludedFunction);
+    return geom;
+}
+
+void CompactMesh::boundsFunction(const RTCBoundsFunctionArguments *args)
+{
+    const CompactMesh *mesh = (const CompactMesh *)args->geometryUserPtr;
+    unsigned a, b, c;
+    mesh->triangle(args->primID, a, b, c);
+    Eigen::Vector3f v0 = mesh->vertex(a), v1 = mesh->vertex(b), v2 = mesh->vertex(c);
+    Eigen::Vector3f lo = v0.cwiseMin(v1).cwiseMin(v2);
+    Eigen::Vector3f hi = v0.cwiseMax(v1).cwiseMax(v2);
+
+    RTCBounds *bounds = args->bounds_o;
+    bounds->lower_x = lo.x();
+    bounds->lower_y = lo.y();
+    bounds->lower_z = lo.z();
+    bounds->upper_x = hi.x();
+    bounds->upper_y = hi.y();
+    bounds->upper_z = hi.z();
+}
+
+// Moller-Trumbore ray/triangle test.  Returns the distance and the barycentrics of
+// v1 and v2 (Embree's u and v) if the ray hits within [tnear, tfar].
+static bool intersectTriangle(const Eigen::Vector3f &v0, const Eigen::Vector3f &v1, const Eigen::Vector3f &v2,
+                              const Eigen::Vector3f &org, const Eigen::Vector3f &dir, float tnear, float tfar,
+                              float &t, float &u, float &v)
+{
+    Eigen::Vector3f e1 = v1 - v0;
+    Eigen::Vector3f e2 = v2 - v0;
+    Eigen::Vector3f p = dir.cross(e2);
+    float det = e1.dot(p);
+    if (det == 0)
+        return false;
+    float invDet = 1 / det;
+
+    Eigen::Vector3f s = org - v0;
+    u = s.dot(p) * invDet;
+    if (u < 0 || u > 1)
+        return false;
+
+    Eigen::Vector3f q = s.cross(e1);
+    v = dir.dot(q) * invDet;
+    if (v < 0 || u + v > 1)
+        return false;
+
+    t = e2.dot(q) * invDet;
+    return t >= tnear && t <= tfar;
+}
+
+void CompactMesh::intersectFunction(const RTCIntersectFunctionNArguments *args)
+{
+    const CompactMesh *mesh = (const CompactMesh *)args->geometryUserPtr;
+    unsigned a, b, c;
+    mesh->triangle(args->primID, a, b, c);
+    Eigen::Vector3f v0 = mesh->vertex(a), v1 = mesh->vertex(b), v2 = mesh->vertex(c);
+
+    // Same orientation as Embree's own triangles: cross(e2, e1) with e1 = v0 - v1 and
+    // e2 = v2 - v0
+    Eigen::Vector3f Ng = (v1 - v0).cross(v2 - v0);
+
+    unsigned N = args->N;
+    RTCRayN *ray = RTCRayHitN_RayN(args->rayhit, N);
+    RTCHitN *hit = RTCRayHitN_HitN(args->rayhit, N);
+    for (unsigned i = 0; i < N; i++)
+    {
+        if (args->valid[i] != -1)
+            continue;
+
+        Eigen::Vector3f org(RTCRayN_org_x(ray, N, i), RTCRayN_org_y(ray, N, i), RTCRayN_org_z(ray, N, i));
+        Eigen::Vector3f dir(RTCRayN_dir_x(ray, N, i), RTCRayN_dir_y(ray, N, i), RTCRayN_dir_z(ray, N, i));
+        float t, u, v;
+        if (!intersectTriangle(v0, v1, v2, org, dir, RTCRayN_tnear(ray, N, i), RTCRayN_tfar(ray, N, i), t, u, v))
+            continue;
+
+        RTCRayN_tfar(ray, N, i) = t;
+        RTCHitN_Ng_x(hit, N, i) = Ng.x();
+        RTCHitN_Ng_y(hit, N, i) = Ng.y();
+        RTCHitN_Ng_z(hit, N, i) = Ng.z();
+        RTCHitN_u(hit, N, i) = u;
+        RTCHitN_v(hit, N, i) = v;
+        RTCHitN_primID(hit, N, i) = args->primID;
+        RTCHitN_geomID(hit, N, i) = args->geomID;
+        RTCHitN_instID(hit, N, i, 0) = args->context->instID[0];
+    }
+}
+
+void CompactMesh::occludedFunction(const RTCOccludedFunctionNArguments *args)
+{
+    const CompactMesh *mesh = (const CompactMesh *)args->geometryUserPtr;
+    unsigned a, b, c;
+    mesh->triangle(args->primID, a, b, c);
+    Eigen::Vector3f v0 = mesh->vertex(a), v1 = mesh->vertex(b), v2 = mesh->vertex(c);
+
+    unsigned N = args->N;
+    for (unsigned i = 0; i < N; i++)
+    {
+        if (args->valid[i] != -1)
+            continue;
+
+        Eigen::Vector3f org(RTCRayN_org_x(args->ray, N, i), RTCRayN_org_y(args->ray, N, i), RTCRayN_org_z(args->ray, N, i));
+        Eigen::Vector3f dir(RTCRayN_dir_x(args->ray, N, i), RTCRayN_dir_y(args->ray, N, i), RTCRayN_dir_z(args->ray, N, i));
+        float t, u, v;
+        if (intersectTriangle(v0, v1, v2, org, dir, RTCRayN_tnear(args->ray, N, i), RTCRayN_tfar(args->ray, N, i), t, u, v))
+            RTCRayN_tfar(args->ray, N, i) = -std::numeric_limits<float>::infinity();
+    }
+}
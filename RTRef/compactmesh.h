@@ -0,0 +1,72 @@
+#pragma once
+
+#include <ext/embree/include/embree3/rtcore.h>
+#include <Eigen/Core>
+#include <stdint.h>
+#include <vector>
+
+// A triangle mesh stored in as few bytes as practical: positions quantized to 16 bits
+// per axis relative to the mesh bounds, 16-bit indices when the mesh has at most 65536
+// vertices, and normals octahedron-encoded into two 16-bit values.  Embree cannot
+// consume these formats directly, so the mesh is traced as a user geometry whose
+// callbacks decode one triangle at a time.
+class CompactMesh
+{
+public:
+    /// @param positions World-space vertex positions.
+    /// @param normals World-space unit vertex normals, or empty.
+    /// @param indices Three vertex indices per triangle.
+    CompactMesh(const std::vector<Eigen::Vector3f> &positions, const std::vector<Eigen::Vector3f> &normals, const std::vector<unsigned> &indices);
+
+    /// Create (but do not commit) a user geometry that traces this mesh.  The mesh
+    /// must stay alive as long as the geometry.
+    RTCGeometry createGeometry(RTCDevice device) const;
+
+    unsigned numVertices() const { return qpositions.size() / 3; }
+    unsigned numTriangles() const { return numTris; }
+    bool hasNormals() const { return !octNormals.empty(); }
+
+    /// Bytes used by the vertex, index and normal data
+    size_t bytes() const;
+
+    Eigen::Vector3f vertex(unsigned i) const
+    {
+        return lower + Eigen::Vector3f(qpositions[3 * i], qpositions[3 * i + 1], qpositions[3 * i + 2]).cwiseProduct(step);
+    }
+
+    void triangle(unsigned primID, unsigned &a, unsigned &b, unsigned &c) const
+    {
+        if (!indices16.empty())
+        {
+            a = indices16[3 * primID];
+            b = indices16[3 * primID + 1];
+            c = indices16[3 * primID + 2];
+        }
+        else
+        {
+            a = indices32[3 * primID];
+            b = indices32[3 * primID + 1];
+            c = indices32[3 * primID + 2];
+        }
+    }
+
+    /// The vertex normal interpolated at barycentric (u, v) on a triangle
+    Eigen::Vector3f normal(unsigned primID, float u, float v) const;
+
+private:
+    // Decoded position = lower + quantized * step
+    Eigen::Vector3f lower;
+    Eigen::Vector3f step;
+
+    unsigned numTris;
+    std::vector<uint16_t> qpositions;
+    std::vector<uint16_t> indices16;
+    std::vector<uint32_t> indices32;
+    std::vector<int16_t> octNormals;
+
+    Eigen::Vector3f decodeNormal(unsigned i) const;
+
+    static void boundsFunction(const RTCBoundsFunctionArguments *args);
+    static void intersectFunction(const RTCIntersectFunctionNArguments *args);
+    static void occludedFunction(const RTCOccludedFunctionNArguments *args);
+};
@@ -0,0 +1,200 @@
+#include <denoiser.h>
+#include <timer.h>
+#include <Eigen/Core>
+#include <tbb/parallel_for.h>
+#include <algorithm>
+#include <math.h>
+#include <stdlib.h>
+
+// B3-spline weights of the 5-tap kernel
+static const float Kernel[5] = {1.f / 16, 1.f / 4, 3.f / 8, 1.f / 4, 1.f / 16};
+
+static inline float luminance(float r, float g, float b)
+{
+  return 0.2126f * r + 0.7152f * g + 0.0722f * b;
+}
+
+constexpr unsigned Denoiser::Guides;
+
+double Denoiser::denoise(const std::vector<float> &rgb, const AOVFilm &aovs, int width, int height, std::vector<float> &out)
+{
+  Timer timer;
+  if ((aovs.enabledMask() & Guides) != Guides)
+  {
+    out = rgb;
+    return timer.elapsedMs();
+  }
+
+  int pixels = width * height;
+  for (int c = 0; c < 3; c++)
+  {
+    color[0][c].resize(pixels);
+    color[1][c].resize(pixels);
+    albedo[c].resize(pixels);
+    normal[c].resize(pixels);
+  }
+  variance[0].resize(pixels);
+  variance[1].resize(pixels);
+  gradient.resize(pixels);
+  weights.resize(pixels);
+  coverage.resize(pixels);
+
+  const float *depth = aovs.plane(AOV::Depth).data();
+  const float *guideAlbedo = aovs.plane(AOV::Albedo).data();
+  const float *guideNormal = aovs.plane(AOV::Normal).data();
+  const float *moments = aovs.plane(AOV::Variance).data();
+  float samples = float(std::max(aovs.samples, 1u));
+
+  // Split the image into planes and divide out the albedo, leaving the illumination,
+  // which is smooth across texture.  Pixels that missed the scene keep their color.
+  tbb::parallel_for(0, height, [&](int y) {
+    for (int k = y * width; k < (y + 1) * width; k++)
+    {
+      coverage[k] = depth[k] > 0 ? 1.f : 0.f;
+      for (int c = 0; c < 3; c++)
+      {
+        albedo[c][k] = depth[k] > 0 ? std::max(guideAlbedo[3 * k + c], 1e-3f) : 1.f;
+        color[0][c][k] = rgb[3 * k + c] / albedo[c][k];
+        normal[c][k] = guideNormal[3 * k + c];
+      }
+    }
+  });
+
+  // Depth gradient and noise variance of each pixel, from its 3x3 neighbourhood
+  tbb::parallel_for(0, height, [&](int y) {
+    for (int x = 0; x < width; x++)
+    {
+      int k = y * width + x;
+      float dx = 0, dy = 0, m1 = 0, m2 = 0;
+      int count = 0;
+      for (int j = std::max(y - 1, 0); j <= std::min(y + 1, height - 1); j++)
+      {
+        for (int i = std::max(x - 1, 0); i <= std::min(x + 1, width - 1); i++)
+        {
+          int q = j * width + i;
+          if (depth[q] <= 0)
+            continue;
+          m1 += moments[2 * q];
+          m2 += moments[2 * q + 1];
+          count++;
+          if (j == y)
+            dx = std::max(dx, fabsf(depth[q] - depth[k]));
+          if (i == x)
+            dy = std::max(dy, fabsf(depth[q] - depth[k]));
+        }
+      }
+      gradient[k] = std::max(dx, dy);
+
+      // Pooling the neighbours' moments gives a variance estimate even from a single
+      // sample per pixel; dividing by the sample count makes it the variance of the mean
+      m1 /= std::max(count, 1);
+      m2 /= std::max(count, 1);
+      variance[0][k] = std::max(m2 - m1 * m1, 0.f) / samples;
+    }
+  });
+
+  int src = 0;
+  for (int pass = 0; pass < iterations; pass++)
+  {
+    tbb::parallel_for(0, height, [&](int y) {
+      filterRow(y, 1 << pass, src, depth, width, height);
+    });
+    src = 1 - src;
+  }
+
+  out.resize(3 * pixels);
+  tbb::parallel_for(0, height, [&](int y) {
+    for (int k = y * width; k < (y + 1) * width; k++)
+      for (int c = 0; c < 3; c++)
+        out[3 * k + c] = color[src][c][k] * albedo[c][k];
+  });
+
+  return timer.elapsedMs();
+}
+
+void Denoiser::filterRow(int y, int step, int src, const float *depth, int width, int height)
+{
+  typedef Eigen::Map<const Eigen::ArrayXf> Row;
+  typedef Eigen::Map<Eigen::ArrayXf> OutRow;
+
+  int row = y * width;
+  const float *r = color[src][0].data(), *g = color[src][1].data(), *b = color[src][2].data();
+  const float *var = variance[src].data();
+  const float *nx = normal[0].data(), *ny = normal[1].data(), *nz = normal[2].data();
+  const float *ar = albedo[0].data(), *ag = albedo[1].data(), *ab = albedo[2].data();
+  const float *hit = coverage.data();
+
+  // Per-pixel denominators of the luminance and depth weights for this row
+  Eigen::ArrayXf invDeviation = 1 / (sigmaLuminance * Row(var + row, width).sqrt() + 1e-4f);
+  Eigen::ArrayXf depthTolerance = sigmaDepth * Row(gradient.data() + row, width);
+  Eigen::ArrayXf w(width);
+  float invAlbedo = 1 / (sigmaAlbedo * sigmaAlbedo);
+
+  OutRow outR(color[1 - src][0].data() + row, width);
+  OutRow outG(color[1 - src][1].data() + row, width);
+  OutRow outB(color[1 - src][2].data() + row, width);
+  OutRow outVar(variance[1 - src].data() + row, width);
+  OutRow sum(weights.data() + row, width);
+  outR.setZero();
+  outG.setZero();
+  outB.setZero();
+  outVar.setZero();
+  sum.setZero();
+
+  // Apply one tap at a time to the whole row as Eigen array expressions, which are
+  // evaluated a SIMD packet of pixels at a time
+  for (int ky = -2; ky <= 2; ky++)
+  {
+    int qy = y + ky * step;
+    if (qy < 0 || qy >= height)
+      continue;
+
+    for (int kx = -2; kx <= 2; kx++)
+    {
+      int offset = kx * step;
+      int x0 = std::max(0, -offset), x1 = std::min(width, width - offset);
+      int n = x1 - x0;
+      if (n <= 0)
+        continue;
+
+      float h = Kernel[ky + 2] * Kernel[kx + 2];
+      float distance = float(step * (abs(kx) + abs(ky)));
+      // Runs of n pixels starting at the first center pixel p and its neighbour q
+      int p = row + x0, q = qy * width + offset + x0;
+      auto at = [n](const float *plane, int i) { return Row(plane + i, n); };
+
+      w.head(n) = (0.2126f * (at(r, p) - at(r, q)) + 0.7152f * (at(g, p) - at(g, q)) + 0.0722f * (at(b, p) - at(b, q))).abs() * invDeviation.segment(x0, n) +
+                  sigmaNormal * (1.f - (at(nx, p) * at(nx, q) + at(ny, p) * at(ny, q) + at(nz, p) * at(nz, q))).max(0.f) +
+                  (at(depth, p) - at(depth, q)).abs() / (depthTolerance.segment(x0, n) * distance + 1e-3f * at(depth, p) + 1e-6f) +
+                  ((at(ar, p) - at(ar, q)).square() + (at(ag, p) - at(ag, q)).square() + (at(ab, p) - at(ab, q)).square()) * invAlbedo;
+      // Taps on the background carry no weight
+      w.head(n) = h * (-w.head(n)).exp() * at(hit, q);
+
+      outR.segment(x0, n) += w.head(n) * at(r, q);
+      outG.segment(x0, n) += w.head(n) * at(g, q);
+      outB.segment(x0, n) += w.head(n) * at(b, q);
+      outVar.segment(x0, n) += w.head(n).square() * at(var, q);
+      sum.segment(x0, n) += w.head(n);
+    }
+  }
+
+  for (int x = 0; x < width; x++)
+  {
+    int p = row + x;
+    if (depth[p] > 0 && sum[x] > 0)
+    {
+      float inv = 1 / sum[x];
+      outR[x] *= inv;
+      outG[x] *= inv;
+      outB[x] *= inv;
+      outVar[x] *= inv * inv;
+    }
+    else
+    {
+      outR[x] = r[p];
+      outG[x] = g[p];
+      outB[x] = b[p];
+      outVar[x] = var[p];
+    }
+  }
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <aov.h>
+#include <vector>
+
+// Edge-avoiding a-trous wavelet filter (Dammertz et al. 2010) with the variance-guided
+// luminance weight of SVGF (Schied et al. 2017), guided by the albedo, normal, depth and
+// variance AOVs of the first hits, which are far less noisy than the radiance.  The
+// radiance is divided by the albedo so that texture is not blurred, filtered in a few
+// passes of a 5x5 B3-spline kernel whose taps spread out by a factor of two each pass,
+// and multiplied back.  Each tap is weighted down where the normal, depth, albedo or
+// luminance differ from the center pixel by more than the noise explains.
+//
+// The image is kept in planar float buffers and each row is filtered one tap at a time
+// across the whole row, as Eigen array expressions that run on SIMD packets of pixels;
+// rows are spread over TBB worker threads.
+class Denoiser
+{
+public:
+  // The AOVs denoise() needs
+  static constexpr unsigned Guides = aovBit(AOV::Depth) | aovBit(AOV::Normal) | aovBit(AOV::Albedo) | aovBit(AOV::Variance);
+
+  int iterations = 5;
+  // Luminance difference, in standard deviations of the noise, that reduces a tap's
+  // weight by 1/e
+  float sigmaLuminance = 4.f;
+  // Weight falloff with 1 - cos of the angle between normals
+  float sigmaNormal = 64.f;
+  // Depth difference, relative to the change predicted by the local depth gradient
+  float sigmaDepth = 1.f;
+  // Albedo difference (RGB distance)
+  float sigmaAlbedo = 0.1f;
+
+  /// Denoise a flat row-major RGB image laid out like Renderer::image() into out,
+  /// which may be the same vector.  Without the Guides AOVs the image is copied as is.
+  /// @return The time taken, in milliseconds.
+  double denoise(const std::vector<float> &rgb, const AOVFilm &aovs, int width, int height, std::vector<float> &out);
+
+private:
+  // Planar buffers, kept between calls so that denoising every frame does not allocate.
+  // Illumination and its variance are ping-ponged between passes.
+  std::vector<float> color[2][3], variance[2];
+  std::vector<float> albedo[3], normal[3], gradient, weights;
+  // 1 where the scene was hit, 0 on the background
+  std::vector<float> coverage;
+
+  // One pass of the filter over row y with taps step pixels apart, from buffer src
+  // into the other one
+  void filterRow(int y, int step, int src, const float *depth, int width, int height);
+};
@@ -0,0 +1,61 @@
+#include <distribution.h>
+#include <algorithm>
+
+Distribution2D::Distribution2D(const std::vector<float> &weights, int width, int height)
+    : width(width), height(height), conditional(size_t(width + 1) * height), marginal(height + 1)
+{
+  double total = 0;
+  for (float w : weights)
+    total += std::max(w, 0.f);
+
+  marginal[0] = 0;
+  for (int y = 0; y < height; y++)
+  {
+    float *row = &conditional[size_t(width + 1) * y];
+    row[0] = 0;
+    for (int x = 0; x < width; x++)
+      row[x + 1] = row[x] + (total > 0 ? std::max(weights[size_t(width) * y + x], 0.f) : 1.f);
+    marginal[y + 1] = marginal[y] + row[width];
+  }
+}
+
+int Distribution2D::invert(const float *cdf, int n, float &u)
+{
+  float target = u * cdf[n];
+  int i = int(std::upper_bound(cdf + 1, cdf + n + 1, target) - (cdf + 1));
+  i = std::min(i, n - 1);
+  // Skip empty intervals, which upper_bound only lands on at the very end
+  while (i > 0 && cdf[i + 1] <= cdf[i])
+    i--;
+  float span = cdf[i + 1] - cdf[i];
+  u = span > 0 ? std::min((target - cdf[i]) / span, 0.99999994f) : 0.5f;
+  return i;
+}
+
+Eigen::Vector2f Distribution2D::sample(const Eigen::Vector2f &u, float &pdf) const
+{
+  if (height == 0 || marginal[height] <= 0)
+  {
+    pdf = 0;
+    return u;
+  }
+
+  float uy = u.y(), ux = u.x();
+  int y = invert(marginal.data(), height, uy);
+  const float *row = &conditional[size_t(width + 1) * y];
+  int x = invert(row, width, ux);
+
+  // The cell's share of the total weight spread over its area of 1 / (width * height)
+  pdf = (row[x + 1] - row[x]) / marginal[height] * width * height;
+  return Eigen::Vector2f((x + ux) / width, (y + uy) / height);
+}
+
+float Distribution2D::pdf(const Eigen::Vector2f &p) const
+{
+  if (height == 0 || marginal[height] <= 0)
+    return 0;
+  int x = std::min(std::max(int(p.x() * width), 0), width - 1);
+  int y = std::min(std::max(int(p.y() * height), 0), height - 1);
+  const float *row = &conditional[size_t(width + 1) * y];
+  return (row[x + 1] - row[x]) / marginal[height] * width * height;
+}
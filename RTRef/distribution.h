@@ -0,0 +1,34 @@
+#pragma once
+
+#include <Eigen/Core>
+#include <vector>
+
+// Piecewise-constant density over [0, 1)^2 in proportion to a grid of non-negative
+// weights, sampled by inverting the marginal CDF over rows and then the conditional CDF
+// within the chosen row.  Cells are width x height, with row 0 at v = 0.
+class Distribution2D
+{
+public:
+  Distribution2D() {}
+
+  /// @param weights width * height values, row by row.  A grid with no weight at all is
+  /// treated as uniform.
+  Distribution2D(const std::vector<float> &weights, int width, int height);
+
+  /// Point distributed in proportion to the weights, from u in [0, 1)^2, and its density
+  Eigen::Vector2f sample(const Eigen::Vector2f &u, float &pdf) const;
+
+  /// Density of sample() picking p
+  float pdf(const Eigen::Vector2f &p) const;
+
+  int width = 0, height = 0;
+
+private:
+  // Cumulative weights within each row (width + 1 per row, starting at 0) and over the
+  // rows' totals (height + 1)
+  std::vector<float> conditional, marginal;
+
+  // Index of the interval of cdf[0..n] containing u * cdf[n], and u remapped to [0, 1)
+  // within it
+  static int invert(const float *cdf, int n, float &u);
+};
@@ -0,0 +1,28 @@
+#pragma once
+
+// Chooses the block size for preview frames while the camera moves, so that frames
+// stay near a target time.  Render cost is roughly proportional to the number of rays,
+// i.e. to 1 / scale^2, so the scale doubles when a frame runs over the target and
+// halves only when the next finer level is predicted to fit comfortably.  The gap
+// between the two thresholds keeps the scale from flickering between levels.
+struct DynamicResolution
+{
+  bool enabled = true;
+  double targetMs = 33;
+  // Current preview block size in pixels: 1, 2 or 4
+  int scale = 1;
+  int maxScale = 4;
+
+  // How long after the last camera change the view still counts as moving; this
+  // bridges the gaps between mouse events during a drag
+  static constexpr double HoldMs = 150;
+
+  /// Feed the time of the last preview frame, rendered at the current scale
+  void update(double frameMs)
+  {
+    if (frameMs > 1.25 * targetMs && scale < maxScale)
+      scale *= 2;
+    else if (4 * frameMs < 0.8 * targetMs && scale > 1)
+      scale /= 2;
+  }
+};
@@ -0,0 +1,153 @@
+#include <film.h>
+#include <algorithm>
+#include <math.h>
+#include <stdlib.h>
+
+bool Filter::parse(const std::string &spec, Filter &filter)
+{
+  std::string name = spec.substr(0, spec.find(':'));
+  if (name == "box")
+    filter = Filter(FilterType::Box, 0.5f);
+  else if (name == "tent")
+    filter = Filter(FilterType::Tent, 1.f);
+  else if (name == "blackman-harris")
+    filter = Filter(FilterType::BlackmanHarris, 2.f);
+  else
+    return false;
+
+  if (spec.find(':') != std::string::npos)
+    filter.radius = std::max(float(atof(spec.c_str() + spec.find(':') + 1)), 0.5f);
+  return true;
+}
+
+float Filter::evaluate1D(float d) const
+{
+  d = fabsf(d);
+  if (d > radius)
+    return 0;
+
+  switch (type)
+  {
+  case FilterType::Tent:
+    return radius - d;
+  case FilterType::BlackmanHarris:
+  {
+    // Four-term Blackman-Harris window stretched over [-radius, radius]
+    float t = 2 * M_PI * (0.5f + 0.5f * d / radius);
+    return 0.35875f - 0.48829f * cosf(t) + 0.14128f * cosf(2 * t) - 0.01168f * cosf(3 * t);
+  }
+  default:
+    return 1;
+  }
+}
+
+void FilmTile::reset(const Tile &tile, const Filter &filter, int imageWidth, int imageHeight)
+{
+  int margin = int(ceilf(filter.radius - 0.5f));
+  x0 = std::max(tile.x0 - margin, 0);
+  y0 = std::max(tile.y0 - margin, 0);
+  x1 = std::min(tile.x1 + margin, imageWidth);
+  y1 = std::min(tile.y1 + margin, imageHeight);
+  rgbw.assign(4 * (x1 - x0) * (y1 - y0), 0.f);
+  this->tile = tile;
+  this->margin = margin;
+}
+
+void FilmTile::splat(float px, float py, const Eigen::Vector3f &color, const Filter &filter)
+{
+  // Pixels whose centers (x + 0.5, y + 0.5) lie within the filter radius
+  int sx0 = std::max(int(ceilf(px - 0.5f - filter.radius)), x0);
+  int sx1 = std::min(int(floorf(px - 0.5f + filter.radius)), x1 - 1);
+  int sy0 = std::max(int(ceilf(py - 0.5f - filter.radius)), y0);
+  int sy1 = std::min(int(floorf(py - 0.5f + filter.radius)), y1 - 1);
+
+  for (int y = sy0; y <= sy1; y++)
+  {
+    float wy = filter.evaluate1D(y + 0.5f - py);
+    for (int x = sx0; x <= sx1; x++)
+    {
+      float w = wy * filter.evaluate1D(x + 0.5f - px);
+      float *p = &rgbw[4 * ((y - y0) * (x1 - x0) + (x - x0))];
+      p[0] += w * color.x();
+      p[1] += w * color.y();
+      p[2] += w * color.z();
+      p[3] += w;
+    }
+  }
+}
+
+Film::Film(int width, int height, const Filter &filter, int bandHeight)
+    : width(width), height(height), filt(filter), bandHeight(bandHeight),
+      bandLocks(new std::mutex[(height + bandHeight - 1) / bandHeight])
+{
+  reallocate();
+  clear();
+}
+
+void Film::clear()
+{
+  clearRows(0, height);
+}
+
+void Film::clearRows(int y0, int y1)
+{
+  std::fill(rgbw.get() + 4 * size_t(y0) * width, rgbw.get() + 4 * size_t(y1) * width, 0.f);
+}
+
+void Film::reallocate()
+{
+  rgbw.reset(new float[4 * size_t(width) * height]);
+}
+
+void Film::setFilter(const Filter &filter)
+{
+  filt = filter;
+  clear();
+}
+
+void Film::merge(const FilmTile &tile)
+{
+  // Neighbouring tiles only reach the pixels within the filter margin of the tile's
+  // edges, so the rest of the tile is added without locking.  The shared pixels are
+  // added under the lock of their band of rows, taken once per band.
+  int ix0 = std::min(tile.tile.x0 + tile.margin, tile.x1), ix1 = std::max(tile.tile.x1 - tile.margin, ix0);
+  int iy0 = std::min(tile.tile.y0 + tile.margin, tile.y1), iy1 = std::max(tile.tile.y1 - tile.margin, iy0);
+  for (int y = iy0; y < iy1; y++)
+    addRow(tile, y, ix0, ix1);
+
+  for (int band = tile.y0 / bandHeight; band * bandHeight < tile.y1; band++)
+  {
+    std::lock_guard<std::mutex> lock(bandLocks[band]);
+    int y1 = std::min((band + 1) * bandHeight, tile.y1);
+    for (int y = std::max(band * bandHeight, tile.y0); y < y1; y++)
+    {
+      if (y >= iy0 && y < iy1)
+      {
+        addRow(tile, y, tile.x0, ix0);
+        addRow(tile, y, ix1, tile.x1);
+      }
+      else
+        addRow(tile, y, tile.x0, tile.x1);
+    }
+  }
+}
+
+void Film::addRow(const FilmTile &tile, int y, int x0, int x1)
+{
+  const float *src = &tile.rgbw[4 * ((y - tile.y0) * (tile.x1 - tile.x0) + (x0 - tile.x0))];
+  float *dst = &rgbw[4 * (size_t(y) * width + x0)];
+  for (int i = 0; i < 4 * (x1 - x0); i++)
+    dst[i] += src[i];
+}
+
+void Film::resolve(float *rgb, int y0, int y1) const
+{
+  for (size_t k = size_t(y0) * width, i = 0; k < size_t(y1) * width; k++, i++)
+  {
+    const float *p = &rgbw[4 * k];
+    float inv = p[3] > 0 ? 1 / p[3] : 0;
+    rgb[3 * i] = p[0] * inv;
+    rgb[3 * i + 1] = p[1] * inv;
+    rgb[3 * i + 2] = p[2] * inv;
+  }
+}
@@ -0,0 +1,127 @@
+#pragma once
+
+#include <Eigen/Core>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// A rectangular block of pixels [x0, x1) x [y0, y1) rendered as one unit of work
+struct Tile
+{
+  int x0, y0, x1, y1;
+};
+
+enum class FilterType
+{
+  Box,
+  Tent,
+  BlackmanHarris
+};
+
+// A separable pixel reconstruction filter
+struct Filter
+{
+  FilterType type = FilterType::Box;
+  // Half-width of the filter's support, in pixels
+  float radius = 0.5f;
+
+  Filter() {}
+  Filter(FilterType type, float radius) : type(type), radius(radius) {}
+
+  /// Parse "box", "tent" or "blackman-harris", optionally followed by ":radius".
+  /// Default radii are 0.5, 1 and 2 pixels.  Returns false for an unknown name.
+  static bool parse(const std::string &spec, Filter &filter);
+
+  /// Weight of a sample at offset (dx, dy) from a pixel center
+  float evaluate(float dx, float dy) const { return evaluate1D(dx) * evaluate1D(dy); }
+
+  float evaluate1D(float d) const;
+};
+
+// Splat buffer for the samples of one tile.  It covers the tile plus the filter's
+// reach into neighbouring pixels, so a thread can splat without synchronizing and
+// merge the whole tile into the Film once.
+class FilmTile
+{
+public:
+  /// Cover tile (plus filter margin, clipped to the image) and clear the weights
+  void reset(const Tile &tile, const Filter &filter, int imageWidth, int imageHeight);
+
+  /// Add a sample at raster position (px, py) to every pixel the filter reaches
+  void splat(float px, float py, const Eigen::Vector3f &color, const Filter &filter);
+
+private:
+  friend class Film;
+
+  // Pixels covered, [x0, x1) x [y0, y1)
+  int x0, y0, x1, y1;
+  // The tile's own pixels, and how far the filter reaches past them
+  Tile tile;
+  int margin;
+  // Weighted RGB sum and total weight per pixel
+  std::vector<float> rgbw;
+};
+
+// Accumulates filtered samples over any number of passes and resolves them into an
+// image.  The filtered value of a pixel is sum(w * L) / sum(w) over every sample
+// within the filter radius of its center.
+class Film
+{
+public:
+  /// @param bandHeight Rows that share a lock in merge(), best the tiles' height
+  Film(int width, int height, const Filter &filter = Filter(), int bandHeight = 32);
+
+  void clear();
+
+  /// Clear rows [y0, y1) only
+  void clearRows(int y0, int y1);
+
+  /// Replace the pixels with fresh storage that is left untouched, so that each page
+  /// is placed on the NUMA node of the thread that first writes it.  The film must be
+  /// cleared (e.g. by clearRows() from the threads that will splat into each band)
+  /// before it is used again.
+  void reallocate();
+
+  /// Change the filter and clear the film
+  void setFilter(const Filter &filter);
+
+  /// Add a tile's splats to the film.  Safe to call from several threads, as long as
+  /// their tiles do not overlap.
+  void merge(const FilmTile &tile);
+
+  /// Write the filtered image as a flat row-major RGB array, rows [y0, y1) only
+  void resolve(std::vector<float> &rgb, int y0, int y1) const { resolve(&rgb[3 * size_t(y0) * width], y0, y1); }
+
+  /// The same into a buffer that holds only rows [y0, y1), from rgb[0] on
+  void resolve(float *rgb, int y0, int y1) const;
+
+  /// Total filter weight of the samples in pixel (x, y)
+  float weight(int x, int y) const { return rgbw[4 * (size_t(y) * width + x) + 3]; }
+
+  /// Overwrite pixel (x, y) as if samples of total weight w and filtered value rgb had
+  /// been splatted into it
+  void setPixel(int x, int y, const Eigen::Vector3f &rgb, float w)
+  {
+    float *p = &rgbw[4 * (size_t(y) * width + x)];
+    p[0] = rgb.x() * w;
+    p[1] = rgb.y() * w;
+    p[2] = rgb.z() * w;
+    p[3] = w;
+  }
+
+  const Filter &filter() const { return filt; }
+
+  int width, height;
+
+private:
+  Filter filt;
+  // Allocated without initialization (unlike a vector), for reallocate()
+  std::unique_ptr<float[]> rgbw;
+  // One lock per band of bandHeight rows, for the pixels that neighbouring tiles share
+  int bandHeight;
+  std::unique_ptr<std::mutex[]> bandLocks;
+
+  // Add columns [x0, x1) of the tile's row y
+  void addRow(const FilmTile &tile, int y, int x0, int x1);
+};
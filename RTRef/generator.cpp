@@ -1,4 +1,5 @@
 #include <generator.h>
+#include <timer.h>
 using namespace std;
 
 string resourcePath = "../resources/scenes/";
@@ -11,37 +12,96 @@ void Generator::initializeScene(shared_ptr<SceneAndCam> sc, const aiScene *data)
     RTCScene scene = rtcNewScene(sc->device);
     sc->scene = scene;
 
-    // Add all ambient lights
+    // A dynamic scene gets a two-level BVH that can be refit per geometry
+    if (sc->options.dynamic)
+    {
+        rtcSetSceneFlags(scene, RTC_SCENE_FLAG_DYNAMIC);
+        rtcSetSceneBuildQuality(scene, RTC_BUILD_QUALITY_LOW);
+    }
+    else if (sc->options.compact)
+    {
+        rtcSetSceneFlags(scene, RTC_SCENE_FLAG_COMPACT);
+    }
+
+    // Add all ambient and environment lights
     for (int i = 0; i < sc->info.lights.size(); i++)
     {
         std::shared_ptr<RTUtil::LightInfo> l = sc->info.lights[i];
 
         if (l->type == RTUtil::Ambient)
         {
-            shared_ptr<AmbientLight> light = make_shared<AmbientLight>(l);
+            if (sc->options.ambientCache)
+                l->cache = true;
+            shared_ptr<AmbientLight> light = make_shared<AmbientLight>(l, scene);
             sc->lights.push_back(light);
             std::cout << "Added an ambient light \n";
         }
+        else if (l->type == RTUtil::Environment)
+        {
+            shared_ptr<EnvironmentLight> light = make_shared<EnvironmentLight>(l);
+            sc->lights.push_back(light);
+            if (!sc->environment)
+                sc->environment = light;
+        }
     }
 
     aiNode *node = data->mRootNode;
     Eigen::Affine3f transform = RTUtil::a2e(node->mTransformation);
 
+    // A streamed scene frees each mesh's Assimp data once its last instance is cached
+    vector<int> meshUses(data->mNumMeshes, 0);
+    countMeshUses(node, meshUses);
+
     initializeSceneHelper(
         sc,
         data,
         node,
-        Eigen::Affine3f::Identity());
+        Eigen::Affine3f::Identity(),
+        -1,
+        meshUses);
+
+    if (sc->cache)
+        sc->cache->finalize();
 
+    double transformMs = 0, commitMs = 0;
+    for (const LoadReport::GeometryStats &g : sc->report.geometries)
+    {
+        transformMs += g.transformMs;
+        commitMs += g.commitMs;
+    }
+    sc->report.addPhase("vertexTransform", transformMs);
+    sc->report.addPhase("geometryCommit", commitMs);
+
+    // Building the BVH happens here; whatever it leaves allocated is the BVH
+    long long before = sc->report.deviceBytes();
+    sc->report.resetPeak();
+    Timer timer;
     rtcCommitScene(scene);
+    sc->report.addPhase("bvhBuild", timer.elapsedMs());
+    sc->report.bvhBytes = sc->report.deviceBytes() - before;
+    sc->report.bvhPeakBytes = sc->report.peakBytes() - before;
 }
 
-void Generator::initializeSceneHelper(shared_ptr<SceneAndCam> sc, const aiScene *data, aiNode *node, Eigen::Affine3f prevTransform)
+void Generator::initializeSceneHelper(shared_ptr<SceneAndCam> sc, const aiScene *data, aiNode *node, Eigen::Affine3f prevTransform, int parent, vector<int> &meshUses)
 {
 
     // Matrix that takes from object to world
     Eigen::Affine3f transform = prevTransform * RTUtil::a2e(node->mTransformation);
 
+    // Record the node so that its transform can be changed later
+    int nodeIndex = sc->nodes.size();
+    SceneNode sceneNode;
+    sceneNode.name = node->mName.C_Str();
+    sceneNode.parent = parent;
+    sceneNode.local = RTUtil::a2e(node->mTransformation);
+    sceneNode.world = transform;
+    sceneNode.visibility = parent >= 0 ? sc->nodes[parent].visibility : unsigned(AllRays);
+    map<string, RTUtil::VisibilityInfo>::const_iterator vis = sc->info.nodeVisibility.find(sceneNode.name);
+    if (vis != sc->info.nodeVisibility.end())
+        sceneNode.visibility = (vis->second.camera ? CameraRays : 0) | (vis->second.shadows ? ShadowRays : 0) | (vis->second.ambient ? AmbientRays : 0);
+    sc->nodes.push_back(sceneNode);
+    sc->nodeIndex.insert(make_pair(sceneNode.name, nodeIndex));
+
     // Gather and add all of the meshes
     for (int m = 0; m < node->mNumMeshes; m++)
     {
@@ -52,48 +112,64 @@ void Generator::initializeSceneHelper(shared_ptr<SceneAndCam> sc, const aiScene
         int nVerts = mesh->mNumVertices;
         int nFaces = mesh->mNumFaces;
 
-        RTCGeometry geom = rtcNewGeometry(sc->device, RTC_GEOMETRY_TYPE_TRIANGLE);
-
-        float *vertices = (float *)rtcSetNewGeometryBuffer(
-            geom,
-            RTC_BUFFER_TYPE_VERTEX,
-            0,
-            RTC_FORMAT_FLOAT3,
-            3 * sizeof(float),
-            nVerts);
-
-        unsigned *indices = (unsigned *)rtcSetNewGeometryBuffer(
-            geom,
-            RTC_BUFFER_TYPE_INDEX,
-            0,
-            RTC_FORMAT_UINT3,
-            3 * sizeof(unsigned),
-            nFaces);
+        LoadReport::GeometryStats stats;
+        stats.node = node->mName.C_Str();
+        stats.mesh = mesh->mName.C_Str();
+        stats.vertices = nVerts;
+        stats.faces = nFaces;
+        long long deviceBefore = sc->report.deviceBytes();
+
+        SceneMesh sceneMesh;
+        sceneMesh.node = nodeIndex;
+
+        // Emissive materials make the mesh a light.  Its triangles are gathered now, as a
+        // streamed mesh's data is freed once it is cached.
+        aiColor3D emissive;
+        vector<Eigen::Vector3f> emitterPositions, emitterNormals;
+        vector<unsigned> emitterIndices;
+        if (data->mMaterials[mesh->mMaterialIndex]->Get(AI_MATKEY_COLOR_EMISSIVE, emissive) == aiReturn_SUCCESS && !emissive.IsBlack())
+            worldSpaceMesh(mesh, transform, false, emitterPositions, emitterNormals, emitterIndices);
+
+        RTCGeometry geom;
+        if (sc->cache)
+            geom = initializeStreamedMesh(sc, mesh, --meshUses[meshNum] == 0, transform, sceneMesh, stats);
+        else if (sc->options.compact)
+            geom = initializeCompactMesh(sc, mesh, transform, sceneMesh, stats);
+        else
+            geom = initializeTriangleMesh(sc, mesh, transform, sceneMesh, stats);
+
+        // Emitters stay visible to the rays their lights look for them with
+        unsigned mask = sc->nodes[nodeIndex].visibility;
+        if (!emitterIndices.empty())
+            mask |= EmitterRays;
+        rtcSetGeometryMask(geom, mask);
+
+        // Moving geometry only needs its BVH refit, not rebuilt
+        if (sc->options.dynamic)
+            rtcSetGeometryBuildQuality(geom, RTC_BUILD_QUALITY_REFIT);
+
+        Timer timer;
+        rtcCommitGeometry(geom);
+        // Shading looks meshes up by geomID, so pin the ID to the mesh's index rather
+        // than rely on Embree handing out IDs in order
+        stats.geomID = unsigned(sc->meshes.size());
+        rtcAttachGeometryByID(sc->scene, geom, stats.geomID);
+        rtcReleaseGeometry(geom);
+        stats.commitMs = timer.elapsedMs();
+        stats.deviceBytes = sc->report.deviceBytes() - deviceBefore;
+        sc->report.geometries.push_back(stats);
 
-        if (vertices && indices)
+        if (!emitterIndices.empty())
         {
-            for (int i = 0; i < nVerts; i++)
-            {
-
-                Eigen::Vector3f vert = RTUtil::a2e(mesh->mVertices[i]);
-                vert = transform * vert;
-
-                vertices[3 * i] = vert.x();
-                vertices[3 * i + 1] = vert.y();
-                vertices[3 * i + 2] = vert.z();
-            }
-
-            for (int i = 0; i < nFaces; i++)
-            {
-                indices[3 * i] = mesh->mFaces[i].mIndices[0];
-                indices[3 * i + 1] = mesh->mFaces[i].mIndices[1];
-                indices[3 * i + 2] = mesh->mFaces[i].mIndices[2];
-            }
+            shared_ptr<MeshLight> light = make_shared<MeshLight>(Eigen::Vector3f(emissive.r, emissive.g, emissive.b), emitterPositions,
+                                                                 emitterIndices, sc->scene, stats.geomID);
+            sceneMesh.light = int(sc->lights.size());
+            sc->lights.push_back(light);
+            std::cout << "Added an emissive mesh light of area " << light->area() << " \n";
         }
 
-        rtcCommitGeometry(geom);
-        rtcAttachGeometry(sc->scene, geom);
-        rtcReleaseGeometry(geom);
+        sc->meshes.push_back(sceneMesh);
+        sc->nodes[nodeIndex].geomIDs.push_back(stats.geomID);
 
         // Add the material for the geometry
         // If the mesh has a material and there is a BSDF in the scene info with a "name" field matching the material name, use it.
@@ -133,12 +209,14 @@ void Generator::initializeSceneHelper(shared_ptr<SceneAndCam> sc, const aiScene
             if (l->type == RTUtil::Point)
             {
                 shared_ptr<PointLight> light = make_shared<PointLight>(l, transform);
+                sc->nodes[nodeIndex].lights.push_back(make_pair(int(sc->lights.size()), l));
                 sc->lights.push_back(light);
                 std::cout << "Added a point light \n";
             }
             else if (l->type == RTUtil::Area)
             {
                 shared_ptr<AreaLight> light = make_shared<AreaLight>(l, transform);
+                sc->nodes[nodeIndex].lights.push_back(make_pair(int(sc->lights.size()), l));
                 sc->lights.push_back(light);
                 std::cout << "Added an area light \n";
             }
@@ -152,13 +230,188 @@ void Generator::initializeSceneHelper(shared_ptr<SceneAndCam> sc, const aiScene
             sc,
             data,
             node->mChildren[c],
-            transform);
+            transform,
+            nodeIndex,
+            meshUses);
     }
 
     return;
 }
 
-void Generator::traverseScene(const aiScene *data)
+// Store a mesh in full precision as an Embree triangle geometry
+RTCGeometry Generator::initializeTriangleMesh(shared_ptr<SceneAndCam> sc, aiMesh *mesh, const Eigen::Affine3f &transform, SceneMesh &sceneMesh, LoadReport::GeometryStats &stats)
+{
+    int nVerts = mesh->mNumVertices;
+    int nFaces = mesh->mNumFaces;
+
+    stats.bufferBytes = nVerts * 3 * sizeof(float) + nFaces * 3 * sizeof(unsigned);
+
+    RTCGeometry geom = rtcNewGeometry(sc->device, RTC_GEOMETRY_TYPE_TRIANGLE);
+
+    float *vertices = (float *)rtcSetNewGeometryBuffer(
+        geom,
+        RTC_BUFFER_TYPE_VERTEX,
+        0,
+        RTC_FORMAT_FLOAT3,
+        3 * sizeof(float),
+        nVerts);
+
+    unsigned *indices = (unsigned *)rtcSetNewGeometryBuffer(
+        geom,
+        RTC_BUFFER_TYPE_INDEX,
+        0,
+        RTC_FORMAT_UINT3,
+        3 * sizeof(unsigned),
+        nFaces);
+
+    sceneMesh.geometry = geom;
+    sceneMesh.vertices = vertices;
+
+    // Vertex normals go in attribute slot 0 so they can be interpolated with rtcInterpolate
+    if (sc->options.smoothNormals && mesh->HasNormals())
+    {
+        rtcSetGeometryVertexAttributeCount(geom, 1);
+        sceneMesh.normals = (float *)rtcSetNewGeometryBuffer(
+            geom,
+            RTC_BUFFER_TYPE_VERTEX_ATTRIBUTE,
+            0,
+            RTC_FORMAT_FLOAT3,
+            3 * sizeof(float),
+            nVerts);
+        stats.bufferBytes += nVerts * 3 * sizeof(float);
+    }
+    Eigen::Matrix3f normalMatrix = transform.linear().inverse().transpose();
+
+    Timer timer;
+    if (vertices && indices)
+    {
+        // Dynamic scenes keep the untransformed positions to re-transform later
+        if (sc->options.dynamic)
+            sceneMesh.positions.resize(nVerts);
+
+        for (int i = 0; i < nVerts; i++)
+        {
+
+            Eigen::Vector3f vert = RTUtil::a2e(mesh->mVertices[i]);
+            if (sc->options.dynamic)
+                sceneMesh.positions[i] = vert;
+            vert = transform * vert;
+
+            vertices[3 * i] = vert.x();
+            vertices[3 * i + 1] = vert.y();
+            vertices[3 * i + 2] = vert.z();
+
+            if (sceneMesh.normals)
+            {
+                Eigen::Vector3f nor = RTUtil::a2e(mesh->mNormals[i]);
+                if (sc->options.dynamic)
+                    sceneMesh.objectNormals.push_back(nor);
+                nor = (normalMatrix * nor).normalized();
+
+                sceneMesh.normals[3 * i] = nor.x();
+                sceneMesh.normals[3 * i + 1] = nor.y();
+                sceneMesh.normals[3 * i + 2] = nor.z();
+            }
+        }
+
+        for (int i = 0; i < nFaces; i++)
+        {
+            indices[3 * i] = mesh->mFaces[i].mIndices[0];
+            indices[3 * i + 1] = mesh->mFaces[i].mIndices[1];
+            indices[3 * i + 2] = mesh->mFaces[i].mIndices[2];
+        }
+    }
+
+    stats.transformMs = timer.elapsedMs();
+    return geom;
+}
+
+// Store a mesh with quantized positions and compact indices and normals, traced as a
+// user geometry that decodes them on the fly
+RTCGeometry Generator::initializeCompactMesh(shared_ptr<SceneAndCam> sc, aiMesh *mesh, const Eigen::Affine3f &transform, SceneMesh &sceneMesh, LoadReport::GeometryStats &stats)
+{
+    Timer timer;
+    vector<Eigen::Vector3f> positions, normals;
+    vector<unsigned> indices;
+    worldSpaceMesh(mesh, transform, sc->options.smoothNormals && mesh->HasNormals(), positions, normals, indices);
+
+    sceneMesh.compact = make_shared<CompactMesh>(positions, normals, indices);
+    sceneMesh.vertices = nullptr;
+    stats.bufferBytes = sceneMesh.compact->bytes();
+    stats.transformMs = timer.elapsedMs();
+
+    sceneMesh.geometry = sceneMesh.compact->createGeometry(sc->device);
+    return sceneMesh.geometry;
+}
+
+// Write a mesh to the geometry cache and return the proxy that pages it in on demand.
+// When this is the mesh's last instance, Assimp's copy of it is freed, so the import
+// never holds more than the meshes still waiting to be cached.
+RTCGeometry Generator::initializeStreamedMesh(shared_ptr<SceneAndCam> sc, aiMesh *mesh, bool lastUse, const Eigen::Affine3f &transform, SceneMesh &sceneMesh, LoadReport::GeometryStats &stats)
+{
+    Timer timer;
+    vector<Eigen::Vector3f> positions, normals;
+    vector<unsigned> indices;
+    worldSpaceMesh(mesh, transform, sc->options.smoothNormals && mesh->HasNormals(), positions, normals, indices);
+
+    sceneMesh.cacheIndex = sc->cache->addMesh(positions, normals, indices);
+    sceneMesh.vertices = nullptr;
+    stats.bufferBytes = 0;
+    sc->report.cacheBytes += sc->cache->meshBytes(sceneMesh.cacheIndex);
+    stats.transformMs = timer.elapsedMs();
+
+    if (lastUse)
+    {
+        delete[] mesh->mVertices;
+        delete[] mesh->mNormals;
+        delete[] mesh->mTangents;
+        delete[] mesh->mBitangents;
+        delete[] mesh->mFaces;
+        mesh->mVertices = mesh->mNormals = mesh->mTangents = mesh->mBitangents = nullptr;
+        mesh->mFaces = nullptr;
+    }
+
+    sceneMesh.geometry = sc->cache->createProxy(sceneMesh.cacheIndex);
+    return sceneMesh.geometry;
+}
+
+// Transform a mesh's vertices (and optionally normals) to world space and gather its
+// triangle indices
+void Generator::worldSpaceMesh(aiMesh *mesh, const Eigen::Affine3f &transform, bool withNormals,
+                               vector<Eigen::Vector3f> &positions, vector<Eigen::Vector3f> &normals, vector<unsigned> &indices)
+{
+    int nVerts = mesh->mNumVertices;
+    int nFaces = mesh->mNumFaces;
+    Eigen::Matrix3f normalMatrix = transform.linear().inverse().transpose();
+
+    positions.resize(nVerts);
+    normals.resize(withNormals ? nVerts : 0);
+    for (int i = 0; i < nVerts; i++)
+    {
+        positions[i] = transform * RTUtil::a2e(mesh->mVertices[i]);
+        if (withNormals)
+            normals[i] = (normalMatrix * RTUtil::a2e(mesh->mNormals[i])).normalized();
+    }
+
+    indices.resize(3 * nFaces);
+    for (int i = 0; i < nFaces; i++)
+    {
+        indices[3 * i] = mesh->mFaces[i].mIndices[0];
+        indices[3 * i + 1] = mesh->mFaces[i].mIndices[1];
+        indices[3 * i + 2] = mesh->mFaces[i].mIndices[2];
+    }
+}
+
+// Count how many nodes reference each mesh
+void Generator::countMeshUses(aiNode *node, vector<int> &uses)
+{
+    for (int m = 0; m < node->mNumMeshes; m++)
+        uses[node->mMeshes[m]]++;
+    for (int c = 0; c < node->mNumChildren; c++)
+        countMeshUses(node->mChildren[c], uses);
+}
+
+void Generator::traverseScene(const aiScene *data, LoadReport &report)
 {
 
     printf("This scene has %u meshes! \n", data->mNumMeshes);
@@ -169,6 +422,9 @@ void Generator::traverseScene(const aiScene *data)
         unsigned int nFaces = data->mMeshes[m]->mNumFaces;
 
         printf("Mesh %i has %u vertices and %u faces!\n", m, nVerts, nFaces);
+
+        report.totalVertices += nVerts;
+        report.totalFaces += nFaces;
     }
 }
 /* Camera initializing ---------------------------------------------------------------------------------*/
@@ -227,20 +483,46 @@ void Generator::initializeDevice(shared_ptr<SceneAndCam> sc)
         printf("error %d: cannot create device\n", rtcGetDeviceError(NULL));
 
     rtcSetDeviceErrorFunction(device, errorFunction, NULL);
+    sc->report.attach(device);
 
     sc->device = device;
 }
 
 /* ---------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------- */
-shared_ptr<SceneAndCam> Generator::generateScene(const string &filename)
+shared_ptr<SceneAndCam> Generator::generateScene(const string &filename, const LoadOptions &options)
 {
     string base = filename.substr(0, filename.find('.'));
     cout << base << '\n';
 
+    Timer total;
     shared_ptr<SceneAndCam> sceneCam = make_shared<SceneAndCam>();
+    sceneCam->report.scene = base;
+    sceneCam->options = options;
+    if (options.compact && options.dynamic)
+    {
+        printf("warning: compact scenes cannot be dynamic; loading as static\n");
+        sceneCam->options.dynamic = false;
+    }
+    if (options.streamed && (options.compact || options.dynamic))
+    {
+        printf("warning: streamed scenes cannot be compact or dynamic; loading as static\n");
+        sceneCam->options.compact = sceneCam->options.dynamic = false;
+    }
+    sceneCam->report.compact = sceneCam->options.compact;
+    sceneCam->report.streamed = options.streamed;
 
     RTUtil::SceneInfo info;
     std::cout << RTUtil::readSceneInfo(resourcePath + base + infoFile, info);
+    if (!options.environment.empty())
+    {
+        shared_ptr<RTUtil::LightInfo> l = make_shared<RTUtil::LightInfo>();
+        l->type = RTUtil::Environment;
+        l->radiance = Eigen::Vector3f::Ones();
+        l->samples = 1;
+        l->cache = false;
+        l->file = options.environment;
+        info.lights.push_back(l);
+    }
     sceneCam->info = info;
 
     sceneCam->defaultMat = info.defaultMaterial;
@@ -248,14 +530,33 @@ shared_ptr<SceneAndCam> Generator::generateScene(const string &filename)
     // Create the device
     initializeDevice(sceneCam);
 
-    // Import the scene files
+    if (options.streamed)
+    {
+        string cachePath = options.cachePath.empty() ? "output/cache_" + base + ".bin" : options.cachePath;
+        sceneCam->cache = make_shared<GeometryCache>(sceneCam->device, cachePath, options.residentBudget);
+    }
+
+    // Import the scene files.  The postprocess steps are applied one at a time, in the
+    // order Assimp itself would run them, so that each one can be timed separately.
     Assimp::Importer importer;
-    const aiScene *data = importer.ReadFile(
-        resourcePath + filename,
-        aiProcess_CalcTangentSpace |
-            aiProcess_Triangulate |
-            aiProcess_JoinIdenticalVertices |
-            aiProcess_SortByPType);
+    Timer timer;
+    const aiScene *data = importer.ReadFile(resourcePath + filename, 0);
+    sceneCam->report.addPhase("import", timer.elapsedMs());
+
+    const pair<unsigned, const char *> steps[] = {
+        {aiProcess_Triangulate, "postprocess:triangulate"},
+        {aiProcess_SortByPType, "postprocess:sortByPType"},
+        {aiProcess_GenSmoothNormals, "postprocess:genSmoothNormals"},
+        {aiProcess_CalcTangentSpace, "postprocess:calcTangentSpace"},
+        {aiProcess_JoinIdenticalVertices, "postprocess:joinIdenticalVertices"}};
+    for (const pair<unsigned, const char *> &step : steps)
+    {
+        if (!data)
+            break;
+        timer.reset();
+        data = importer.ApplyPostProcessing(step.first);
+        sceneCam->report.addPhase(step.second, timer.elapsedMs());
+    }
 
     if (!data)
     {
@@ -266,11 +567,172 @@ shared_ptr<SceneAndCam> Generator::generateScene(const string &filename)
         printf("Scene imported successfully\n");
     }
 
-    traverseScene(data);
+    traverseScene(data, sceneCam->report);
 
     initializeCamera(sceneCam, data);
     initializeScene(sceneCam, data);
 
     importer.FreeScene();
+    sceneCam->report.totalMs = total.elapsedMs();
     return sceneCam;
 }
+
+
+/* Dynamic updates ------------------------------------------------------------------------------------*/
+bool SceneAndCam::setNodeTransform(const string &nodeName, const Eigen::Affine3f &local)
+{
+    if (!options.dynamic)
+    {
+        printf("error: nodes can only be moved in a scene loaded as dynamic\n");
+        return false;
+    }
+
+    map<string, int>::iterator it = nodeIndex.find(nodeName);
+    if (it == nodeIndex.end())
+    {
+        printf("error: no node named %s\n", nodeName.c_str());
+        return false;
+    }
+
+    nodes[it->second].local = local;
+    nodes[it->second].dirty = true;
+    return true;
+}
+
+bool SceneAndCam::setVertices(unsigned geomID, const vector<Eigen::Vector3f> &positions, const vector<Eigen::Vector3f> &normals)
+{
+    if (!options.dynamic)
+    {
+        printf("error: vertices can only be updated in a scene loaded as dynamic\n");
+        return false;
+    }
+    if (geomID >= meshes.size() || meshes[geomID].positions.size() != positions.size())
+    {
+        printf("error: geometry %u does not have %zu vertices\n", geomID, positions.size());
+        return false;
+    }
+
+    if (!normals.empty() && normals.size() != meshes[geomID].objectNormals.size())
+    {
+        printf("error: geometry %u does not have %zu vertex normals\n", geomID, normals.size());
+        return false;
+    }
+
+    meshes[geomID].positions = positions;
+    if (!normals.empty())
+        meshes[geomID].objectNormals = normals;
+    meshes[geomID].dirty = true;
+    return true;
+}
+
+double SceneAndCam::commitUpdates()
+{
+    if (!options.dynamic)
+    {
+        printf("error: updates can only be committed in a scene loaded as dynamic\n");
+        return 0;
+    }
+
+    Timer timer;
+
+    // Nodes are stored parents-first, so one pass propagates the new world transforms
+    vector<bool> moved(nodes.size(), false);
+    for (int n = 0; n < nodes.size(); n++)
+    {
+        SceneNode &node = nodes[n];
+        moved[n] = node.dirty || (node.parent >= 0 && moved[node.parent]);
+        node.dirty = false;
+        if (!moved[n])
+            continue;
+
+        node.world = node.parent >= 0 ? nodes[node.parent].world * node.local : node.local;
+
+        for (unsigned geomID : node.geomIDs)
+            meshes[geomID].dirty = true;
+
+        for (const pair<int, shared_ptr<RTUtil::LightInfo>> &l : node.lights)
+        {
+            if (l.second->type == RTUtil::Point)
+                lights[l.first] = make_shared<PointLight>(l.second, node.world);
+            else
+                lights[l.first] = make_shared<AreaLight>(l.second, node.world);
+        }
+    }
+
+    for (unsigned geomID = 0; geomID < meshes.size(); geomID++)
+    {
+        SceneMesh &mesh = meshes[geomID];
+        if (!mesh.dirty)
+            continue;
+        mesh.dirty = false;
+
+        const Eigen::Affine3f &transform = nodes[mesh.node].world;
+        for (int i = 0; i < mesh.positions.size(); i++)
+        {
+            Eigen::Vector3f vert = transform * mesh.positions[i];
+            mesh.vertices[3 * i] = vert.x();
+            mesh.vertices[3 * i + 1] = vert.y();
+            mesh.vertices[3 * i + 2] = vert.z();
+        }
+
+        rtcUpdateGeometryBuffer(mesh.geometry, RTC_BUFFER_TYPE_VERTEX, 0);
+
+        if (mesh.light >= 0)
+        {
+            vector<Eigen::Vector3f> world(mesh.positions.size());
+            for (int i = 0; i < mesh.positions.size(); i++)
+                world[i] = transform * mesh.positions[i];
+            static_pointer_cast<MeshLight>(lights[mesh.light])->setPositions(world);
+        }
+
+        if (mesh.normals)
+        {
+            Eigen::Matrix3f normalMatrix = transform.linear().inverse().transpose();
+            for (int i = 0; i < mesh.objectNormals.size(); i++)
+            {
+                Eigen::Vector3f nor = (normalMatrix * mesh.objectNormals[i]).normalized();
+                mesh.normals[3 * i] = nor.x();
+                mesh.normals[3 * i + 1] = nor.y();
+                mesh.normals[3 * i + 2] = nor.z();
+            }
+            rtcUpdateGeometryBuffer(mesh.geometry, RTC_BUFFER_TYPE_VERTEX_ATTRIBUTE, 0);
+        }
+
+        rtcCommitGeometry(mesh.geometry);
+    }
+
+    rtcCommitScene(scene);
+
+    // Cached occlusion no longer matches the moved geometry
+    for (const shared_ptr<BaseLight> &light : lights)
+    {
+        shared_ptr<AmbientLight> ambient = dynamic_pointer_cast<AmbientLight>(light);
+        if (ambient && ambient->cache)
+            ambient->cache->clear();
+    }
+    return timer.elapsedMs();
+}
+
+Eigen::Vector3f SceneAndCam::emitted(const RTCHit &hit, const Eigen::Vector3f &dir) const
+{
+    int light = meshes[hit.geomID].light;
+    if (light < 0)
+        return Eigen::Vector3f::Zero();
+    return static_pointer_cast<MeshLight>(lights[light])->emitted(hit.primID, dir);
+}
+
+Eigen::Vector3f SceneAndCam::shadingNormal(const RTCHit &hit) const
+{
+    const SceneMesh &mesh = meshes[hit.geomID];
+    if (mesh.cacheIndex >= 0)
+        return cache->hasNormals(mesh.cacheIndex) ? cache->normal(mesh.cacheIndex, hit.primID, hit.u, hit.v)
+                                                  : Eigen::Vector3f(hit.Ng_x, hit.Ng_y, hit.Ng_z);
+    if (mesh.compact && mesh.compact->hasNormals())
+        return mesh.compact->normal(hit.primID, hit.u, hit.v);
+    if (!mesh.normals)
+        return Eigen::Vector3f(hit.Ng_x, hit.Ng_y, hit.Ng_z);
+
+    Eigen::Vector3f nor;
+    rtcInterpolate0(mesh.geometry, hit.primID, hit.u, hit.v, RTC_BUFFER_TYPE_VERTEX_ATTRIBUTE, 0, nor.data(), 3);
+    return nor;
+}
@@ -1,3 +1,5 @@
+#pragma once
+
 #include <ext/embree/include/embree3/rtcore.h>
 #include <iostream>
 #include <stdio.h>
@@ -7,6 +9,7 @@
 #include <RayCamera.h>
 #include <Eigen/Core>
 #include <Eigen/Geometry>
+#include <Eigen/StdVector>
 #include <RTUtil/conversions.hpp>
 
 #include <ext/assimp/include/assimp/Importer.hpp>  // Plain-C interface
@@ -14,8 +17,87 @@
 #include <ext/assimp/include/assimp/postprocess.h> // Post processing flags
 
 #include <lights.h>
+#include <loadreport.h>
+#include <compactmesh.h>
+#include <geometrycache.h>
 using namespace std;
 
+// Options that control how Generator builds the scene
+struct LoadOptions
+{
+  // Build the scene so that node transforms and vertex positions can be changed
+  // between frames and recommitted with a BVH refit instead of a full rebuild
+  bool dynamic = false;
+
+  // Store vertex normals with each mesh and interpolate them for shading; when off,
+  // (or for meshes without normals) shading uses the geometric normal
+  bool smoothNormals = true;
+
+  // Store meshes in compact form (quantized positions, 16-bit indices where they fit,
+  // octahedral normals) and ask Embree for a compact BVH, trading trace speed for
+  // memory.  Cannot be combined with dynamic.
+  bool compact = false;
+
+  // Keep geometry out of core: meshes are written to a memory-mapped cache file and
+  // only paged in (up to residentBudget bytes at a time) when rays reach their bounds.
+  // Cannot be combined with dynamic or compact.
+  bool streamed = false;
+  size_t residentBudget = size_t(256) << 20;
+  // Where to write the cache; output/cache_<scene>.bin if empty
+  string cachePath;
+
+  // Give every ambient light an irradiance cache, as if its info set "cache": true
+  bool ambientCache = false;
+
+  // Light the scene with this latitude-longitude HDR map, in addition to the lights in
+  // its info
+  string environment;
+};
+
+// A node of the imported hierarchy, kept so its transform can be changed after loading
+struct SceneNode
+{
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+  string name;
+  // Index of the parent in SceneAndCam::nodes, or -1 for the root
+  int parent;
+  // Transform relative to the parent, and from this node to world
+  Eigen::Affine3f local;
+  Eigen::Affine3f world;
+  // Geometries attached directly to this node
+  vector<unsigned> geomIDs;
+  // Lights attached to this node, as (index into SceneAndCam::lights, light info)
+  vector<pair<int, shared_ptr<RTUtil::LightInfo>>> lights;
+  // Set when the local transform has changed since the last commit
+  bool dirty = false;
+  // RayVisibility bits of the rays that see this node's geometry
+  unsigned visibility = AllRays;
+};
+
+// The per-geometry data needed to move or deform a mesh after loading
+struct SceneMesh
+{
+  // Index of the owning node in SceneAndCam::nodes
+  int node;
+  RTCGeometry geometry;
+  // Vertex positions and normals in the node's coordinates (only kept for dynamic scenes)
+  vector<Eigen::Vector3f> positions;
+  vector<Eigen::Vector3f> objectNormals;
+  // The Embree vertex buffer, holding world-space positions
+  float *vertices;
+  // World-space vertex normals in vertex attribute slot 0, or null if the mesh has none
+  float *normals = nullptr;
+  // The compact representation, when the scene was loaded with LoadOptions::compact
+  shared_ptr<CompactMesh> compact;
+  // Index of the mesh in SceneAndCam::cache when the scene is streamed, otherwise -1
+  int cacheIndex = -1;
+  // Set when the positions have changed since the last commit
+  bool dirty = false;
+  // Index in SceneAndCam::lights of the MeshLight made from an emissive material, or -1
+  int light = -1;
+};
+
 class SceneAndCam
 {
 public:
@@ -24,9 +106,53 @@ public:
   RayCamera cam;
   RTUtil::SceneInfo info;
   vector<shared_ptr<BaseLight>> lights;
+  // The first environment light, which rays that miss the scene also see
+  shared_ptr<EnvironmentLight> environment;
   int numMeshes = 0;
   map<int, shared_ptr<nori::BSDF>> materials;
   shared_ptr<nori::BSDF> defaultMat;
+
+  // Timings and memory usage gathered while the scene was generated
+  LoadReport report;
+
+  LoadOptions options;
+
+  // The node hierarchy in depth-first order (parents come before their children),
+  // and the geometries indexed by geomID
+  vector<SceneNode, Eigen::aligned_allocator<SceneNode>> nodes;
+  vector<SceneMesh> meshes;
+  map<string, int> nodeIndex;
+
+  // Backing store for the meshes of a streamed scene (LoadOptions::streamed)
+  shared_ptr<GeometryCache> cache;
+
+  /* Dynamic updates ------------------------------------------------------------
+   * Only available when the scene was loaded with LoadOptions::dynamic.  Changes are
+   * staged by the setters and pushed to Embree by commitUpdates(), which refits the
+   * BVH rather than rebuilding it.
+   */
+
+  /// Replace the transform of the named node relative to its parent.  Geometry and
+  /// lights below the node follow it.  Returns false if there is no such node.
+  bool setNodeTransform(const string &nodeName, const Eigen::Affine3f &local);
+
+  /// Replace the vertex positions of a geometry, given in its node's coordinates, and
+  /// optionally its vertex normals.  Returns false if the geometry does not exist or
+  /// the vertex count differs.
+  bool setVertices(unsigned geomID, const vector<Eigen::Vector3f> &positions,
+                   const vector<Eigen::Vector3f> &normals = vector<Eigen::Vector3f>());
+
+  /// Push all staged changes to Embree and recommit the scene.
+  /// @return The time taken, in milliseconds.
+  double commitUpdates();
+
+  /// The normal to shade with at a hit: the interpolated vertex normal when the
+  /// geometry has normals, otherwise the geometric normal.  Not normalized.
+  Eigen::Vector3f shadingNormal(const RTCHit &hit) const;
+
+  /// Radiance emitted toward a ray travelling along dir that hit an emissive mesh;
+  /// zero for other geometry
+  Eigen::Vector3f emitted(const RTCHit &hit, const Eigen::Vector3f &dir) const;
 };
 
 class Generator
@@ -36,11 +162,17 @@ class Generator
 
   static void initializeScene(shared_ptr<SceneAndCam> sc, const aiScene *data);
 
-  static void initializeSceneHelper(shared_ptr<SceneAndCam> sc, const aiScene *data, aiNode *node, Eigen::Affine3f prevTransform);
-  static void traverseScene(const aiScene *data);
+  static void initializeSceneHelper(shared_ptr<SceneAndCam> sc, const aiScene *data, aiNode *node, Eigen::Affine3f prevTransform, int parent, vector<int> &meshUses);
+  static RTCGeometry initializeTriangleMesh(shared_ptr<SceneAndCam> sc, aiMesh *mesh, const Eigen::Affine3f &transform, SceneMesh &sceneMesh, LoadReport::GeometryStats &stats);
+  static RTCGeometry initializeCompactMesh(shared_ptr<SceneAndCam> sc, aiMesh *mesh, const Eigen::Affine3f &transform, SceneMesh &sceneMesh, LoadReport::GeometryStats &stats);
+  static RTCGeometry initializeStreamedMesh(shared_ptr<SceneAndCam> sc, aiMesh *mesh, bool lastUse, const Eigen::Affine3f &transform, SceneMesh &sceneMesh, LoadReport::GeometryStats &stats);
+  static void worldSpaceMesh(aiMesh *mesh, const Eigen::Affine3f &transform, bool withNormals,
+                             vector<Eigen::Vector3f> &positions, vector<Eigen::Vector3f> &normals, vector<unsigned> &indices);
+  static void countMeshUses(aiNode *node, vector<int> &uses);
+  static void traverseScene(const aiScene *data, LoadReport &report);
 
   static void initializeDevice(shared_ptr<SceneAndCam> sc);
 
 public:
-  static shared_ptr<SceneAndCam> generateScene(const string &filename);
+  static shared_ptr<SceneAndCam> generateScene(const string &filename, const LoadOptions &options = LoadOptions());
 };
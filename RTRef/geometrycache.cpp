@@ -0,0 +1,358 @@
+#include <geometrycache.h>
+#include <limits>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+GeometryCache::GeometryCache(RTCDevice device, const std::string &path, size_t budgetBytes)
+    : device(device), path(path), budget(budgetBytes), useClock(0), pageIns(0), evictions(0)
+{
+    file = fopen(path.c_str(), "wb");
+    if (!file)
+        printf("error: unable to create geometry cache %s\n", path.c_str());
+}
+
+GeometryCache::~GeometryCache()
+{
+    // Release the resident scenes before unmapping the buffers they share
+    entries.clear();
+
+    if (file)
+        fclose(file);
+#ifdef _WIN32
+    if (mapped)
+        UnmapViewOfFile(mapped);
+#else
+    if (mapped)
+        munmap((void *)mapped, mappedSize);
+#endif
+    remove(path.c_str());
+}
+
+bool GeometryCache::write(const void *data, size_t bytes)
+{
+    if (!file || fwrite(data, 1, bytes, file) != bytes)
+        return false;
+    fileSize += bytes;
+    return true;
+}
+
+// Embree reads shared vertex buffers with 16-byte loads, so each array is followed by
+// at least 16 bytes and starts on a 16-byte boundary
+bool GeometryCache::pad()
+{
+    static const char zeros[32] = {0};
+    return write(zeros, 16 + (16 - fileSize % 16) % 16);
+}
+
+int GeometryCache::addMesh(const std::vector<Eigen::Vector3f> &positions, const std::vector<Eigen::Vector3f> &normals,
+                           const std::vector<unsigned> &indices)
+{
+    std::unique_ptr<Entry> e(new Entry());
+    e->cache = this;
+    e->index = entries.size();
+    e->numVertices = positions.size();
+    e->numTriangles = indices.size() / 3;
+    e->hasNormals = !normals.empty();
+    e->lastUse = 0;
+
+    e->lower = Eigen::Vector3f::Constant(std::numeric_limits<float>::infinity());
+    e->upper = -e->lower;
+    for (const Eigen::Vector3f &p : positions)
+    {
+        e->lower = e->lower.cwiseMin(p);
+        e->upper = e->upper.cwiseMax(p);
+    }
+
+    bool ok = true;
+    e->positionOffset = fileSize;
+    for (const Eigen::Vector3f &p : positions)
+        ok = ok && write(p.data(), 3 * sizeof(float));
+    ok = ok && pad();
+
+    e->indexOffset = fileSize;
+    ok = ok && write(indices.data(), indices.size() * sizeof(unsigned)) && pad();
+
+    e->normalOffset = fileSize;
+    for (const Eigen::Vector3f &n : normals)
+        ok = ok && write(n.data(), 3 * sizeof(float));
+    ok = ok && pad();
+    e->endOffset = fileSize;
+
+    if (!ok)
+        printf("error: unable to write mesh %d to geometry cache %s\n", e->index, path.c_str());
+
+    entries.push_back(std::move(e));
+    return entries.size() - 1;
+}
+
+bool GeometryCache::finalize()
+{
+    if (!file)
+        return false;
+    bool ok = fclose(file) == 0;
+    file = nullptr;
+    if (!ok)
+    {
+        printf("error: unable to write geometry cache %s\n", path.c_str());
+        return false;
+    }
+
+    mappedSize = fileSize;
+    if (mappedSize == 0)
+        return true;
+
+#ifdef _WIN32
+    HANDLE f = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    HANDLE m = f == INVALID_HANDLE_VALUE ? NULL : CreateFileMappingA(f, NULL, PAGE_READONLY, 0, 0, NULL);
+    mapped = m ? (const char *)MapViewOfFile(m, FILE_MAP_READ, 0, 0, 0) : nullptr;
+    if (m)
+        CloseHandle(m);
+    if (f != INVALID_HANDLE_VALUE)
+        CloseHandle(f);
+#else
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd >= 0)
+    {
+        void *p = mmap(NULL, mappedSize, PROT_READ, MAP_SHARED, fd, 0);
+        mapped = p == MAP_FAILED ? nullptr : (const char *)p;
+        close(fd);
+    }
+#endif
+
+    if (!mapped)
+    {
+        printf("error: unable to map geometry cache %s\n", path.c_str());
+        return false;
+    }
+    return true;
+}
+
+size_t GeometryCache::meshBytes(int mesh) const
+{
+    return entries[mesh]->endOffset - entries[mesh]->positionOffset;
+}
+
+size_t GeometryCache::residentCost(const Entry &e) const
+{
+    return e.endOffset - e.positionOffset + e.numTriangles * BVHBytesPerTriangle;
+}
+
+GeometryCache::Stats GeometryCache::stats() const
+{
+    Stats s;
+    s.pageIns = pageIns.load();
+    s.evictions = evictions.load();
+    std::lock_guard<std::mutex> lock(mutex);
+    s.residentBytes = residentBytes;
+    s.peakResidentBytes = peakResidentBytes;
+    return s;
+}
+
+GeometryCache::Resident::~Resident()
+{
+    if (scene)
+        rtcReleaseScene(scene);
+
+#ifndef _WIN32
+    // Let the OS drop the mesh's pages now rather than when memory runs short.  Only
+    // whole pages inside the mesh are released; neighbours are left alone.
+    size_t pageSize = sysconf(_SC_PAGESIZE);
+    size_t begin = ((size_t)data + pageSize - 1) / pageSize * pageSize;
+    size_t end = ((size_t)data + size) / pageSize * pageSize;
+    if (end > begin)
+        madvise((void *)begin, end - begin, MADV_DONTNEED);
+#endif
+}
+
+std::shared_ptr<GeometryCache::Resident> GeometryCache::acquire(Entry &e)
+{
+    std::shared_ptr<Resident> r = std::atomic_load(&e.resident);
+    if (!r)
+        r = pageIn(e);
+    e.lastUse = ++useClock;
+
+    // The first rays to arrive build the BVH together; later ones find it done
+    if (r && !r->built.load())
+    {
+        rtcJoinCommitScene(r->scene);
+        r->built = true;
+    }
+    return r;
+}
+
+std::shared_ptr<GeometryCache::Resident> GeometryCache::pageIn(Entry &e)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    // Another thread may have paged the mesh in while this one waited
+    std::shared_ptr<Resident> r = std::atomic_load(&e.resident);
+    if (r || !mapped)
+        return r;
+
+    r = std::make_shared<Resident>();
+    r->data = mapped + e.positionOffset;
+    r->size = e.endOffset - e.positionOffset;
+
+    RTCGeometry geom = rtcNewGeometry(device, RTC_GEOMETRY_TYPE_TRIANGLE);
+    rtcSetSharedGeometryBuffer(geom, RTC_BUFFER_TYPE_VERTEX, 0, RTC_FORMAT_FLOAT3,
+                               mapped, e.positionOffset, 3 * sizeof(float), e.numVertices);
+    rtcSetSharedGeometryBuffer(geom, RTC_BUFFER_TYPE_INDEX, 0, RTC_FORMAT_UINT3,
+                               mapped, e.indexOffset, 3 * sizeof(unsigned), e.numTriangles);
+    rtcCommitGeometry(geom);
+
+    r->scene = rtcNewScene(device);
+    rtcSetSceneBuildQuality(r->scene, RTC_BUILD_QUALITY_LOW);
+    rtcAttachGeometry(r->scene, geom);
+    rtcReleaseGeometry(geom);
+
+    std::atomic_store(&e.resident, r);
+    pageIns++;
+    residentBytes += residentCost(e);
+    peakResidentBytes = std::max(peakResidentBytes, residentBytes);
+
+    // Evict the least recently traced meshes until the new one fits.  The mesh being
+    // paged in is never evicted, so a single mesh larger than the budget still renders.
+    while (residentBytes > budget)
+    {
+        Entry *victim = nullptr;
+        for (const std::unique_ptr<Entry> &other : entries)
+        {
+            if (other.get() == &e || !std::atomic_load(&other->resident))
+                continue;
+            if (!victim || other->lastUse < victim->lastUse)
+                victim = other.get();
+        }
+        if (!victim)
+            break;
+        evict(*victim);
+    }
+
+    return r;
+}
+
+void GeometryCache::evict(Entry &e)
+{
+    std::atomic_store(&e.resident, std::shared_ptr<Resident>());
+    residentBytes -= residentCost(e);
+    evictions++;
+}
+
+Eigen::Vector3f GeometryCache::normal(int mesh, unsigned primID, float u, float v) const
+{
+    const Entry &e = *entries[mesh];
+    const unsigned *tri = (const unsigned *)(mapped + e.indexOffset) + 3 * primID;
+    const float *normals = (const float *)(mapped + e.normalOffset);
+    Eigen::Map<const Eigen::Vector3f> n0(normals + 3 * tri[0]), n1(normals + 3 * tri[1]), n2(normals + 3 * tri[2]);
+    return (1 - u - v) * n0 + u * n1 + v * n2;
+}
+
+RTCGeometry GeometryCache::createProxy(int mesh)
+{
+    RTCGeometry geom = rtcNewGeometry(device, RTC_GEOMETRY_TYPE_USER);
+    rtcSetGeometryUserPrimitiveCount(geom, 1);
+    rtcSetGeometryUserData(geom, entries[mesh].get());
+    rtcSetGeometryBoundsFunction(geom, boundsFunction, nullptr);
+    rtcSetGeometryIntersectFunction(geom, intersectFunction);
+    rtcSetGeometryOccludedFunction(geom, occludedFunction);
+    return geom;
+}
+
+void GeometryCache::boundsFunction(const RTCBoundsFunctionArguments *args)
+{
+    const Entry *e = (const Entry *)args->geometryUserPtr;
+    RTCBounds *bounds = args->bounds_o;
+    bounds->lower_x = e->lower.x();
+    bounds->lower_y = e->lower.y();
+    bounds->lower_z = e->lower.z();
+    bounds->upper_x = e->upper.x();
+    bounds->upper_y = e->upper.y();
+    bounds->upper_z = e->upper.z();
+}
+
+// Copy ray i of a packet into a single ray
+static RTCRay extractRay(RTCRayN *ray, unsigned N, unsigned i)
+{
+    RTCRay r;
+    r.org_x = RTCRayN_org_x(ray, N, i);
+    r.org_y = RTCRayN_org_y(ray, N, i);
+    r.org_z = RTCRayN_org_z(ray, N, i);
+    r.tnear = RTCRayN_tnear(ray, N, i);
+    r.dir_x = RTCRayN_dir_x(ray, N, i);
+    r.dir_y = RTCRayN_dir_y(ray, N, i);
+    r.dir_z = RTCRayN_dir_z(ray, N, i);
+    r.time = RTCRayN_time(ray, N, i);
+    r.tfar = RTCRayN_tfar(ray, N, i);
+    r.mask = RTCRayN_mask(ray, N, i);
+    r.id = RTCRayN_id(ray, N, i);
+    r.flags = RTCRayN_flags(ray, N, i);
+    return r;
+}
+
+void GeometryCache::intersectFunction(const RTCIntersectFunctionNArguments *args)
+{
+    Entry *e = (Entry *)args->geometryUserPtr;
+    std::shared_ptr<Resident> r = e->cache->acquire(*e);
+    if (!r)
+        return;
+
+    RTCIntersectContext context;
+    rtcInitIntersectContext(&context);
+
+    unsigned N = args->N;
+    RTCRayN *ray = RTCRayHitN_RayN(args->rayhit, N);
+    RTCHitN *hit = RTCRayHitN_HitN(args->rayhit, N);
+    for (unsigned i = 0; i < N; i++)
+    {
+        if (args->valid[i] != -1)
+            continue;
+
+        RTCRayHit rayhit;
+        rayhit.ray = extractRay(ray, N, i);
+        rayhit.hit.geomID = RTC_INVALID_GEOMETRY_ID;
+        rayhit.hit.instID[0] = RTC_INVALID_GEOMETRY_ID;
+        rtcIntersect1(r->scene, &context, &rayhit);
+        if (rayhit.hit.geomID == RTC_INVALID_GEOMETRY_ID)
+            continue;
+
+        // Report the hit against the proxy so materials and normals are found by its geomID
+        RTCRayN_tfar(ray, N, i) = rayhit.ray.tfar;
+        RTCHitN_Ng_x(hit, N, i) = rayhit.hit.Ng_x;
+        RTCHitN_Ng_y(hit, N, i) = rayhit.hit.Ng_y;
+        RTCHitN_Ng_z(hit, N, i) = rayhit.hit.Ng_z;
+        RTCHitN_u(hit, N, i) = rayhit.hit.u;
+        RTCHitN_v(hit, N, i) = rayhit.hit.v;
+        RTCHitN_primID(hit, N, i) = rayhit.hit.primID;
+        RTCHitN_geomID(hit, N, i) = args->geomID;
+        RTCHitN_instID(hit, N, i, 0) = args->context->instID[0];
+    }
+}
+
+void GeometryCache::occludedFunction(const RTCOccludedFunctionNArguments *args)
+{
+    Entry *e = (Entry *)args->geometryUserPtr;
+    std::shared_ptr<Resident> r = e->cache->acquire(*e);
+    if (!r)
+        return;
+
+    RTCIntersectContext context;
+    rtcInitIntersectContext(&context);
+
+    unsigned N = args->N;
+    for (unsigned i = 0; i < N; i++)
+    {
+        if (args->valid[i] != -1)
+            continue;
+
+        RTCRay shadowRay = extractRay(args->ray, N, i);
+        rtcOccluded1(r->scene, &context, &shadowRay);
+        if (shadowRay.tfar == -std::numeric_limits<float>::infinity())
+            RTCRayN_tfar(args->ray, N, i) = shadowRay.tfar;
+    }
+}
@@ -0,0 +1,130 @@
+#pragma once
+
+#include <ext/embree/include/embree3/rtcore.h>
+#include <Eigen/Core>
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+// Out-of-core storage for triangle meshes.  While a scene loads, each mesh is written
+// in world space to a cache file, which is then memory-mapped.  Embree only sees a
+// proxy per mesh: a one-primitive user geometry covering the mesh bounds.  The first
+// ray to reach a proxy pages the mesh in by building a small scene over the mapped
+// buffers, and rays are traced into it from the proxy's callbacks.  Paged-in meshes
+// are evicted least recently used first once their resident bytes exceed the budget.
+class GeometryCache
+{
+public:
+    // Counters for the life of the cache
+    struct Stats
+    {
+        unsigned long long pageIns;
+        unsigned long long evictions;
+        size_t residentBytes;
+        size_t peakResidentBytes;
+    };
+
+    /// @param path The cache file to create; any existing file is overwritten.
+    /// @param budgetBytes How many bytes of paged-in meshes to keep resident.
+    GeometryCache(RTCDevice device, const std::string &path, size_t budgetBytes);
+    ~GeometryCache();
+
+    /// Append a mesh to the cache file.  Positions and normals are in world space;
+    /// normals may be empty.  Must be called before finalize().
+    /// @return The index of the mesh in the cache.
+    int addMesh(const std::vector<Eigen::Vector3f> &positions, const std::vector<Eigen::Vector3f> &normals,
+                const std::vector<unsigned> &indices);
+
+    /// Close the cache file and map it.  Returns false (after printing the reason) on error.
+    bool finalize();
+
+    /// Create (but do not commit) the proxy geometry for a mesh
+    RTCGeometry createProxy(int mesh);
+
+    bool hasNormals(int mesh) const { return entries[mesh]->hasNormals; }
+
+    /// The vertex normal interpolated at barycentric (u, v), read straight from the
+    /// mapped file whether or not the mesh is paged in
+    Eigen::Vector3f normal(int mesh, unsigned primID, float u, float v) const;
+
+    Stats stats() const;
+
+    /// Bytes of one mesh's cached data
+    size_t meshBytes(int mesh) const;
+
+private:
+    // A paged-in mesh.  Rays hold a reference while tracing it, so an eviction only
+    // frees the scene once the last of them has finished.
+    struct Resident
+    {
+        RTCScene scene;
+        std::atomic<bool> built;
+        const char *data;
+        size_t size;
+
+        Resident() : scene(nullptr), built(false) {}
+        ~Resident();
+    };
+
+    struct Entry
+    {
+        GeometryCache *cache;
+        int index;
+
+        // Byte offsets of the positions, indices and normals in the cache file
+        size_t positionOffset;
+        size_t indexOffset;
+        size_t normalOffset;
+        size_t endOffset;
+        unsigned numVertices;
+        unsigned numTriangles;
+        bool hasNormals;
+
+        Eigen::Vector3f lower, upper;
+
+        std::shared_ptr<Resident> resident;
+        // Value of the cache's use clock when the mesh was last traced
+        std::atomic<unsigned long long> lastUse;
+    };
+
+    RTCDevice device;
+    std::string path;
+    size_t budget;
+
+    FILE *file = nullptr;
+    size_t fileSize = 0;
+    const char *mapped = nullptr;
+    size_t mappedSize = 0;
+
+    std::vector<std::unique_ptr<Entry>> entries;
+
+    // Guards paging in and eviction; tracing a resident mesh takes no lock
+    mutable std::mutex mutex;
+    std::atomic<unsigned long long> useClock;
+    std::atomic<unsigned long long> pageIns;
+    std::atomic<unsigned long long> evictions;
+    size_t residentBytes = 0;
+    size_t peakResidentBytes = 0;
+
+    // Embree does not report the size of each small BVH, so residency is charged
+    // the cached bytes plus this estimate per triangle
+    static const size_t BVHBytesPerTriangle = 64;
+
+    size_t residentCost(const Entry &e) const;
+
+    // Return the mesh's resident scene, paging it in if needed, and mark it used
+    std::shared_ptr<Resident> acquire(Entry &e);
+    std::shared_ptr<Resident> pageIn(Entry &e);
+    void evict(Entry &e);
+
+    bool write(const void *data, size_t bytes);
+    bool pad();
+
+    static void boundsFunction(const RTCBoundsFunctionArguments *args);
+    static void intersectFunction(const RTCIntersectFunctionNArguments *args);
+    static void occludedFunction(const RTCOccludedFunctionNArguments *args);
+};
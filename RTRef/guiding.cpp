@@ -0,0 +1,285 @@
+#include <guiding.h>
+#include <algorithm>
+#include <cmath>
+#include <math.h>
+
+static void atomicAdd(std::atomic<float> &a, float value)
+{
+  float old = a.load(std::memory_order_relaxed);
+  while (!a.compare_exchange_weak(old, old + value, std::memory_order_relaxed))
+    ;
+}
+
+// Cylindrical coordinates of a unit direction, in [0, 1]^2
+static Eigen::Vector2f toCanonical(const Eigen::Vector3f &dir)
+{
+  float cosTheta = std::min(std::max(dir.z(), -1.f), 1.f);
+  float phi = atan2f(dir.y(), dir.x());
+  if (phi < 0)
+    phi += 2 * M_PI;
+  return Eigen::Vector2f(std::min((cosTheta + 1) / 2, 0.99999994f), std::min(phi / float(2 * M_PI), 0.99999994f));
+}
+
+static Eigen::Vector3f fromCanonical(const Eigen::Vector2f &p)
+{
+  float cosTheta = 2 * p.x() - 1;
+  float sinTheta = sqrtf(std::max(1 - cosTheta * cosTheta, 0.f));
+  float phi = 2 * M_PI * p.y();
+  return Eigen::Vector3f(sinTheta * cosf(phi), sinTheta * sinf(phi), cosTheta);
+}
+
+DTree::Node::Node()
+{
+  for (int c = 0; c < 4; c++)
+  {
+    sums[c].store(0.f, std::memory_order_relaxed);
+    children[c] = 0;
+  }
+}
+
+DTree::Node::Node(const Node &other)
+{
+  *this = other;
+}
+
+DTree::Node &DTree::Node::operator=(const Node &other)
+{
+  for (int c = 0; c < 4; c++)
+  {
+    sums[c].store(other.sums[c].load(std::memory_order_relaxed), std::memory_order_relaxed);
+    children[c] = other.children[c];
+  }
+  return *this;
+}
+
+float DTree::Node::total() const
+{
+  float t = 0;
+  for (int c = 0; c < 4; c++)
+    t += sums[c].load(std::memory_order_relaxed);
+  return t;
+}
+
+float DTree::total() const
+{
+  return nodes[0].total();
+}
+
+void DTree::record(const Eigen::Vector3f &dir, float value)
+{
+  if (!(value > 0) || !std::isfinite(value))
+    return;
+
+  Eigen::Vector2f p = toCanonical(dir);
+  int n = 0;
+  while (true)
+  {
+    int c = (p.x() >= 0.5f) | (p.y() >= 0.5f) << 1;
+    atomicAdd(nodes[n].sums[c], value);
+    if (!nodes[n].children[c])
+      return;
+    p = 2 * p - Eigen::Vector2f(c & 1, c >> 1);
+    n = nodes[n].children[c];
+  }
+}
+
+Eigen::Vector3f DTree::sample(Eigen::Vector2f u) const
+{
+  Eigen::Vector2f origin(0, 0);
+  float scale = 1;
+  int n = 0;
+  while (true)
+  {
+    const Node &node = nodes[n];
+    float s[4];
+    for (int c = 0; c < 4; c++)
+      s[c] = node.sums[c].load(std::memory_order_relaxed);
+    float total = s[0] + s[1] + s[2] + s[3];
+    if (total <= 0)
+      return fromCanonical(origin + scale * u);
+
+    // Pick the column (x), then the row within it (y), reusing u for the choice
+    int c = 0;
+    float left = (s[0] + s[2]) / total;
+    if (u.x() < left)
+    {
+      u.x() /= left;
+    }
+    else
+    {
+      c |= 1;
+      u.x() = (u.x() - left) / (1 - left);
+    }
+    float column = s[c] + s[c | 2];
+    float bottom = column > 0 ? s[c] / column : 0.5f;
+    if (u.y() < bottom)
+    {
+      u.y() /= bottom;
+    }
+    else
+    {
+      c |= 2;
+      u.y() = (u.y() - bottom) / (1 - bottom);
+    }
+    u = u.cwiseMin(Eigen::Vector2f::Constant(0.99999994f));
+
+    scale /= 2;
+    origin += scale * Eigen::Vector2f(c & 1, c >> 1);
+    if (!node.children[c])
+      return fromCanonical(origin + scale * u);
+    n = node.children[c];
+  }
+}
+
+float DTree::pdf(const Eigen::Vector3f &dir) const
+{
+  Eigen::Vector2f p = toCanonical(dir);
+  float density = 1;
+  int n = 0;
+  while (true)
+  {
+    const Node &node = nodes[n];
+    float total = node.total();
+    if (total <= 0)
+      break;
+    int c = (p.x() >= 0.5f) | (p.y() >= 0.5f) << 1;
+    density *= 4 * node.sums[c].load(std::memory_order_relaxed) / total;
+    if (!node.children[c])
+      break;
+    p = 2 * p - Eigen::Vector2f(c & 1, c >> 1);
+    n = node.children[c];
+  }
+  // The canonical square maps onto the sphere's 4 pi steradians with constant Jacobian
+  return density / float(4 * M_PI);
+}
+
+void DTree::refine(float threshold, int maxDepth)
+{
+  std::vector<Node> old;
+  old.swap(nodes);
+  nodes.assign(1, Node());
+  float total = old[0].total();
+  if (total <= 0)
+    return;
+
+  // Walk the new structure depth first alongside the old one; where the old tree had a
+  // leaf, its energy is assumed spread evenly over the quadrants
+  struct Item
+  {
+    int oldNode, newNode, depth;
+    float energy;
+  };
+  std::vector<Item> stack;
+  Item root = {0, 0, 1, total};
+  stack.push_back(root);
+  while (!stack.empty())
+  {
+    Item item = stack.back();
+    stack.pop_back();
+    for (int c = 0; c < 4; c++)
+    {
+      float energy = item.oldNode >= 0 ? old[item.oldNode].sums[c].load(std::memory_order_relaxed) : item.energy / 4;
+      if (energy / total <= threshold || item.depth >= maxDepth)
+        continue;
+
+      int child = int(nodes.size());
+      nodes.push_back(Node());
+      nodes[item.newNode].children[c] = child;
+      int oldChild = item.oldNode >= 0 && old[item.oldNode].children[c] ? old[item.oldNode].children[c] : -1;
+      Item next = {oldChild, child, item.depth + 1, energy};
+      stack.push_back(next);
+    }
+  }
+}
+
+void SDTree::setBounds(const Eigen::Vector3f &boundsLo, const Eigen::Vector3f &boundsHi)
+{
+  lo = boundsLo;
+  size = (boundsHi - boundsLo).cwiseMax(Eigen::Vector3f::Constant(1e-6f));
+  leaves.clear();
+  leaves.push_back(std::unique_ptr<Leaf>(new Leaf));
+  SpatialNode root = {0, {-1, -1}, 0};
+  spatial.assign(1, root);
+  iteration = 0;
+  passes = 0;
+}
+
+SDTree::Leaf &SDTree::leafAt(const Eigen::Vector3f &position) const
+{
+  Eigen::Vector3f p = (position - lo).cwiseQuotient(size).cwiseMax(Eigen::Vector3f::Zero()).cwiseMin(Eigen::Vector3f::Ones());
+  int n = 0;
+  while (spatial[n].leaf < 0)
+  {
+    const SpatialNode &node = spatial[n];
+    float &x = p[node.axis];
+    int c = x >= 0.5f;
+    x = 2 * x - c;
+    n = node.children[c];
+  }
+  return *leaves[spatial[n].leaf];
+}
+
+void SDTree::record(const Eigen::Vector3f &position, const Eigen::Vector3f &dir, float value)
+{
+  Leaf &leaf = leafAt(position);
+  leaf.records++;
+  leaf.building.record(dir, value);
+}
+
+void SDTree::endPass()
+{
+  if (leaves.empty())
+    return;
+  passes++;
+  if (passes >= 1 << iteration)
+    endIteration();
+}
+
+void SDTree::split(int n, unsigned threshold)
+{
+  int l = spatial[n].leaf;
+  unsigned records = leaves[l]->records;
+  if (records <= threshold)
+    return;
+
+  // The lower half keeps the leaf; both halves start from its recorded distribution
+  // and are assumed to have received half the vertices each
+  int axis = spatial[n].axis;
+  int other = int(leaves.size());
+  leaves.push_back(std::unique_ptr<Leaf>(new Leaf));
+  leaves[other]->building = leaves[l]->building;
+  leaves[l]->records = records / 2;
+  leaves[other]->records = records / 2;
+
+  int lower = int(spatial.size());
+  SpatialNode lowerNode = {(axis + 1) % 3, {-1, -1}, l};
+  SpatialNode upperNode = {(axis + 1) % 3, {-1, -1}, other};
+  spatial.push_back(lowerNode);
+  spatial.push_back(upperNode);
+  spatial[n].leaf = -1;
+  spatial[n].children[0] = lower;
+  spatial[n].children[1] = lower + 1;
+
+  split(lower, threshold);
+  split(lower + 1, threshold);
+}
+
+void SDTree::endIteration()
+{
+  unsigned threshold = unsigned(splitThreshold * sqrtf(float(passes)));
+  int count = int(spatial.size());
+  for (int n = 0; n < count; n++)
+    if (spatial[n].leaf >= 0)
+      split(n, threshold);
+
+  for (size_t l = 0; l < leaves.size(); l++)
+  {
+    Leaf &leaf = *leaves[l];
+    leaf.sampling = leaf.building;
+    leaf.building.refine(directionalThreshold, maxDirectionalDepth);
+    leaf.records = 0;
+  }
+
+  iteration++;
+  passes = 0;
+}
@@ -0,0 +1,121 @@
+#pragma once
+
+#include <Eigen/Core>
+#include <atomic>
+#include <memory>
+#include <vector>
+
+// Distribution over the sphere of directions, as a quadtree over the cylindrical
+// coordinates (cos theta, phi) mapped to [0, 1]^2, which preserve area: a node's share of
+// the energy is its share of the density over its patch of solid angle.  Energy is
+// splatted into the leaves' parents with atomic adds, so render threads can record into
+// the same tree without locks.
+class DTree
+{
+public:
+  DTree() : nodes(1) {}
+
+  /// Add value to the energy of the leaf containing dir; safe to call concurrently
+  void record(const Eigen::Vector3f &dir, float value);
+
+  /// Direction distributed in proportion to the energy, from u in [0, 1)^2; uniform
+  /// over the sphere while the tree is empty
+  Eigen::Vector3f sample(Eigen::Vector2f u) const;
+
+  /// Density of sample() picking dir, per steradian
+  float pdf(const Eigen::Vector3f &dir) const;
+
+  /// Replace the structure with one that subdivides where more than threshold of the
+  /// energy recorded so far lies (down to maxDepth levels) and merges elsewhere, with
+  /// the energy cleared
+  void refine(float threshold, int maxDepth);
+
+  float total() const;
+  int nodeCount() const { return int(nodes.size()); }
+
+private:
+  struct Node
+  {
+    // Energy of each quadrant; quadrant c covers x >= 0.5 if c & 1, y >= 0.5 if c & 2
+    std::atomic<float> sums[4];
+    // Index of each quadrant's node, or 0 for a leaf (the root is never a child)
+    int children[4];
+
+    Node();
+    Node(const Node &other);
+    Node &operator=(const Node &other);
+    float total() const;
+  };
+  std::vector<Node> nodes;
+};
+
+// SD-tree for path guiding (Mueller et al., "Practical Path Guiding for Efficient
+// Light-Transport Simulation", 2017): a binary tree over the scene's bounds, splitting
+// the axes in turn, whose leaves each hold a DTree of the radiance arriving there.
+// Each leaf keeps the tree built from the previous training iteration for sampling and
+// records into a second one.  Training runs in iterations that double in length; at the
+// end of each, leaves that received enough path vertices are split, every leaf's
+// recorded tree becomes its sampling tree, and a refined empty tree replaces it.
+//
+// The structure only changes in endPass(), between render passes, so lookups need no
+// locks; recording only does atomic adds.
+class SDTree
+{
+public:
+  // Leaves split once an iteration records more than splitThreshold * sqrt(passes)
+  // vertices into them
+  float splitThreshold = 4000;
+  // Energy fraction above which a directional node is subdivided
+  float directionalThreshold = 0.01f;
+  int maxDirectionalDepth = 20;
+
+  /// Reset to a single leaf covering the box from lo to hi
+  void setBounds(const Eigen::Vector3f &lo, const Eigen::Vector3f &hi);
+
+  /// Whether a training iteration has finished, so that sampling() is worth using
+  bool trained() const { return iteration > 0; }
+
+  /// The sampling distribution of the leaf containing position
+  const DTree &sampling(const Eigen::Vector3f &position) const { return leafAt(position).sampling; }
+
+  /// Record value (incident radiance along dir over the density dir was sampled with)
+  /// at position; safe to call concurrently
+  void record(const Eigen::Vector3f &position, const Eigen::Vector3f &dir, float value);
+
+  /// Count a finished render pass, and end the training iteration when it is complete
+  void endPass();
+
+  int iterations() const { return iteration; }
+  int leafCount() const { return int(leaves.size()); }
+
+private:
+  struct Leaf
+  {
+    DTree sampling, building;
+    std::atomic<unsigned> records;
+    Leaf() : records(0) {}
+  };
+
+  struct SpatialNode
+  {
+    int axis;
+    // Child nodes for the lower and upper half, or -1 in a leaf
+    int children[2];
+    // Index into leaves in a leaf node, else -1
+    int leaf;
+  };
+
+  Eigen::Vector3f lo = Eigen::Vector3f::Zero(), size = Eigen::Vector3f::Ones();
+  std::vector<SpatialNode> spatial;
+  // Held by pointer since their atomics cannot move
+  std::vector<std::unique_ptr<Leaf>> leaves;
+
+  int iteration = 0;
+  int passes = 0;
+
+  Leaf &leafAt(const Eigen::Vector3f &position) const;
+  void endIteration();
+  // Split the leaf in spatial node n (recursively) until each part's share of the
+  // records is below threshold
+  void split(int n, unsigned threshold);
+};
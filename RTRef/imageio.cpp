@@ -0,0 +1,84 @@
+#include <imageio.h>
+#include <math.h>
+#include <stdio.h>
+#include <vector>
+
+#define STB_IMAGE_IMPLEMENTATION
+#define STBI_MSC_SECURE_CRT
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include <ext/stb/stb_image.h>
+#include <ext/stb/stb_image_write.h>
+
+float toSRGB(float c)
+{
+  float a = 0.055;
+  if (c <= 0)
+    return 0;
+  else if (c < 0.0031308)
+  {
+    return 12.92 * c;
+  }
+  else
+  {
+    if (c >= 1.0)
+      return 1.0;
+    else
+      return (1.0 + a) * pow(c, 1.0 / 2.4) - a;
+  }
+}
+
+bool writePNG(const std::string &path, int width, int height, const float *rgb)
+{
+  std::vector<unsigned char> pixels(width * height * 3);
+
+  // PNG rows run top to bottom, so flip vertically
+  for (int i = 0; i < height; i++)
+  {
+    for (int j = 0; j < width; j++)
+    {
+      for (int k = 0; k < 3; k++)
+      {
+        pixels[3 * (width * (height - i - 1) + j) + k] = int(toSRGB(rgb[3 * (width * i + j) + k]) * 255.0);
+      }
+    }
+  }
+
+  if (!stbi_write_png(path.c_str(), width, height, 3, pixels.data(), width * 3))
+  {
+    printf("error: could not write %s\n", path.c_str());
+    return false;
+  }
+  return true;
+}
+
+bool writePFM(const std::string &path, int width, int height, int channels, const float *data)
+{
+  FILE *file = fopen(path.c_str(), "wb");
+  if (!file)
+  {
+    printf("error: could not write %s\n", path.c_str());
+    return false;
+  }
+
+  // A negative scale marks the data as little-endian
+  fprintf(file, "%s\n%d %d\n-1.0\n", channels == 3 ? "PF" : "Pf", width, height);
+  bool ok = fwrite(data, sizeof(float) * channels, size_t(width) * height, file) == size_t(width) * height;
+  fclose(file);
+  if (!ok)
+    printf("error: could not write %s\n", path.c_str());
+  return ok;
+}
+
+bool readHDR(const std::string &path, int &width, int &height, std::vector<float> &rgb)
+{
+  int channels;
+  float *data = stbi_loadf(path.c_str(), &width, &height, &channels, 3);
+  if (!data)
+  {
+    printf("error: could not read %s: %s\n", path.c_str(), stbi_failure_reason());
+    return false;
+  }
+  rgb.assign(data, data + size_t(width) * height * 3);
+  stbi_image_free(data);
+  return true;
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+// Convert a linear channel value to sRGB, clamped to [0, 1]
+float toSRGB(float c);
+
+// Write a linear RGB image to an 8-bit sRGB PNG.  The image is stored as a flat
+// row-major array with row 0 at the bottom, as in ImgGUI::img_data.
+bool writePNG(const std::string &path, int width, int height, const float *rgb);
+
+// Write a float image with 1 (greyscale) or 3 (RGB) channels to a PFM file, unclamped.
+// Row 0 is at the bottom, which is also the order PFM stores rows in.
+bool writePFM(const std::string &path, int width, int height, int channels, const float *data);
+
+// Read a float RGB image (Radiance .hdr, or any format stb_image reads, converted to
+// linear) into a flat row-major array with row 0 at the top, as stored in the file.
+bool readHDR(const std::string &path, int &width, int &height, std::vector<float> &rgb);
@@ -0,0 +1,266 @@
+#include <irradiancecache.h>
+#include <RTUtil/frame.hpp>
+#include <visibility.h>
+#include <algorithm>
+#include <limits>
+#include <math.h>
+
+IrradianceCache::IrradianceCache(RTCScene scene, float range)
+    : scene(scene), range(range), lookups(0), records(0), rays(0)
+{
+}
+
+void IrradianceCache::initialize()
+{
+    RTCBounds bounds;
+    rtcGetSceneBounds(scene, &bounds);
+    Eigen::Vector3f lo(bounds.lower_x, bounds.lower_y, bounds.lower_z);
+    Eigen::Vector3f hi(bounds.upper_x, bounds.upper_y, bounds.upper_z);
+    float diagonal = (hi - lo).norm();
+
+    // A cube, slightly larger than the scene so that records on its surface fit
+    Eigen::Vector3f center = (lo + hi) / 2;
+    float half = 0.51f * (hi - lo).maxCoeff() + 1e-4f;
+    rootMin = center - Eigen::Vector3f::Constant(half);
+    rootMax = center + Eigen::Vector3f::Constant(half);
+    root.reset(new Node);
+
+    // Occlusion varies over about the light's range, so records need not be spaced any
+    // wider than that
+    maxSpacing = std::min(range, 0.1f * diagonal);
+    minSpacing = maxSpacing / 32;
+}
+
+float IrradianceCache::visibility(const Eigen::Vector3f &position, const Eigen::Vector3f &normal, PCG32 &random)
+{
+    std::call_once(initialized, &IrradianceCache::initialize, this);
+    lookups++;
+
+    {
+        tbb::spin_rw_mutex::scoped_lock lock(mutex, false);
+        float value;
+        if (interpolate(position, normal, value))
+            return value;
+    }
+
+    // Another thread may add a record nearby at the same time; both are kept
+    Record record = sample(position, normal, random);
+    insert(record);
+    return record.value;
+}
+
+bool IrradianceCache::interpolate(const Eigen::Vector3f &position, const Eigen::Vector3f &normal, float &value) const
+{
+    float sum = 0, sumWeights = 0;
+
+    // Records are stored in every node their reach overlaps, so the nodes on the path
+    // down to the point hold all that can apply
+    const Node *node = root.get();
+    Eigen::Vector3f lo = rootMin, hi = rootMax;
+    while (node)
+    {
+        for (const Record &r : node->records)
+        {
+            Eigen::Vector3f d = position - r.position;
+            float cosine = std::min(normal.dot(r.normal), 1.f);
+            if (cosine <= 0)
+                continue;
+
+            // Ward's error estimate; the weight falls to zero where it reaches accuracy
+            float error = d.norm() / r.radius + sqrtf(1 - cosine);
+            if (error >= accuracy)
+                continue;
+
+            // A point in front of the record sees occluders the record did not
+            if (0.5f * d.dot(normal + r.normal) < -0.05f * r.radius)
+                continue;
+
+            float weight = 1 / std::max(error, 1e-6f) - 1 / accuracy;
+            float estimate = r.value + r.rotationGradient.dot(r.normal.cross(normal)) + r.translationGradient.dot(d);
+            sum += weight * estimate;
+            sumWeights += weight;
+        }
+
+        Eigen::Vector3f mid = (lo + hi) / 2;
+        int child = 0;
+        for (int axis = 0; axis < 3; axis++)
+        {
+            if (position[axis] > mid[axis])
+            {
+                child |= 1 << axis;
+                lo[axis] = mid[axis];
+            }
+            else
+            {
+                hi[axis] = mid[axis];
+            }
+        }
+        node = node->children[child].get();
+    }
+
+    if (sumWeights <= 0)
+        return false;
+    value = std::min(std::max(sum / sumWeights, 0.f), 1.f);
+    return true;
+}
+
+IrradianceCache::Record IrradianceCache::sample(const Eigen::Vector3f &position, const Eigen::Vector3f &normal, PCG32 &random)
+{
+    const int M = ThetaStrata, N = PhiStrata;
+    nori::Frame frame(normal);
+
+    // Cosine-weighted strata: equal steps in sin^2(theta) and in phi
+    // The stratum counts are fixed, so the rays fit on the stack
+    RTCRayHit hits[M * N];
+    float theta[M * N];
+    for (int j = 0; j < M; j++)
+    {
+        for (int k = 0; k < N; k++)
+        {
+            int i = j * N + k;
+            theta[i] = asinf(sqrtf((j + random.nextFloat()) / M));
+            float phi = 2 * M_PI * (k + random.nextFloat()) / N;
+            Eigen::Vector3f dir = frame.toWorld(Eigen::Vector3f(sinf(theta[i]) * cosf(phi), sinf(theta[i]) * sinf(phi), cosf(theta[i])));
+
+            RTCRayHit &h = hits[i];
+            h.ray.org_x = position.x();
+            h.ray.org_y = position.y();
+            h.ray.org_z = position.z();
+            h.ray.dir_x = dir.x();
+            h.ray.dir_y = dir.y();
+            h.ray.dir_z = dir.z();
+            h.ray.tnear = .01f;
+            h.ray.tfar = range;
+            h.ray.time = 0;
+            h.ray.mask = AmbientRays;
+            h.ray.id = i;
+            h.ray.flags = 0;
+            h.hit.geomID = RTC_INVALID_GEOMETRY_ID;
+            h.hit.instID[0] = RTC_INVALID_GEOMETRY_ID;
+        }
+    }
+
+    RTCIntersectContext context;
+    rtcInitIntersectContext(&context);
+    rtcIntersect1M(scene, &context, hits, M * N, sizeof(RTCRayHit));
+    rays += M * N;
+
+    // Visibility (1 for a ray that escaped within range) and occluder distance per stratum
+    float L[M * N], R[M * N];
+    float visible = 0, inverseDistances = 0;
+    for (int i = 0; i < M * N; i++)
+    {
+        bool occluded = hits[i].hit.geomID != RTC_INVALID_GEOMETRY_ID;
+        L[i] = occluded ? 0.f : 1.f;
+        R[i] = occluded ? hits[i].ray.tfar : std::numeric_limits<float>::infinity();
+        visible += L[i];
+        if (occluded)
+            inverseDistances += 1 / std::max(R[i], 1e-4f);
+    }
+
+    // Gradients after Ward and Heckbert, in the record's local frame, divided by pi to
+    // turn irradiance into visible fraction
+    Eigen::Vector3f rotation(0, 0, 0), translation(0, 0, 0);
+    for (int k = 0; k < N; k++)
+    {
+        float phi = 2 * M_PI * (k + 0.5f) / N;
+        float phiEdge = 2 * M_PI * k / N;
+        Eigen::Vector3f u(cosf(phi), sinf(phi), 0);
+        Eigen::Vector3f v(-sinf(phi), cosf(phi), 0);
+        Eigen::Vector3f vEdge(-sinf(phiEdge), cosf(phiEdge), 0);
+        int previous = (k + N - 1) % N;
+
+        float rotationSum = 0, thetaSum = 0, phiSum = 0;
+        for (int j = 0; j < M; j++)
+        {
+            int i = j * N + k;
+            rotationSum -= tanf(theta[i]) * L[i];
+
+            // Change across the boundary with the previous theta stratum
+            float sinLow = sqrtf(float(j) / M), cosLow = sqrtf(1 - float(j) / M);
+            if (j > 0)
+            {
+                int below = (j - 1) * N + k;
+                thetaSum += sinLow * cosLow * cosLow / std::min(R[i], R[below]) * (L[i] - L[below]);
+            }
+
+            // Change across the boundary with the previous phi stratum
+            float cosHigh = sqrtf(1 - float(j + 1) / M);
+            int beside = j * N + previous;
+            phiSum += (cosLow - cosHigh) / (std::max(sinf(theta[i]), 1e-3f) * std::min(R[i], R[beside])) * (L[i] - L[beside]);
+        }
+        rotation += v * rotationSum;
+        translation += u * (2 * M_PI / N) * thetaSum + vEdge * phiSum;
+    }
+    rotation /= float(M * N);
+    translation /= float(M_PI);
+
+    Record record;
+    record.position = position;
+    record.normal = normal;
+    record.value = visible / (M * N);
+    record.rotationGradient = frame.toWorld(rotation);
+    record.translationGradient = frame.toWorld(translation);
+
+    // Spacing follows the harmonic mean distance, shortened where the gradient is steep
+    // so that extrapolating along it stays small
+    float radius = inverseDistances > 0 ? (M * N) / inverseDistances : std::numeric_limits<float>::infinity();
+    float slope = record.translationGradient.norm();
+    if (slope > 0)
+        radius = std::min(radius, 1 / slope);
+    record.radius = std::min(std::max(radius, minSpacing), maxSpacing);
+    return record;
+}
+
+void IrradianceCache::insert(const Record &record)
+{
+    Eigen::Vector3f reach = Eigen::Vector3f::Constant(accuracy * record.radius);
+    tbb::spin_rw_mutex::scoped_lock lock(mutex, true);
+    insert(root.get(), rootMin, rootMax, record, record.position - reach, record.position + reach, 0);
+    records++;
+}
+
+void IrradianceCache::insert(Node *node, const Eigen::Vector3f &lo, const Eigen::Vector3f &hi, const Record &record,
+                             const Eigen::Vector3f &recordLo, const Eigen::Vector3f &recordHi, int depth)
+{
+    // Stop at nodes no larger than the record's reach across
+    if (depth == MaxDepth || hi.x() - lo.x() <= 2 * (recordHi.x() - recordLo.x()))
+    {
+        node->records.push_back(record);
+        return;
+    }
+
+    Eigen::Vector3f mid = (lo + hi) / 2;
+    for (int child = 0; child < 8; child++)
+    {
+        Eigen::Vector3f childLo, childHi;
+        for (int axis = 0; axis < 3; axis++)
+        {
+            bool upper = (child >> axis) & 1;
+            childLo[axis] = upper ? mid[axis] : lo[axis];
+            childHi[axis] = upper ? hi[axis] : mid[axis];
+        }
+        if ((recordLo.array() > childHi.array()).any() || (recordHi.array() < childLo.array()).any())
+            continue;
+
+        if (!node->children[child])
+            node->children[child].reset(new Node);
+        insert(node->children[child].get(), childLo, childHi, record, recordLo, recordHi, depth + 1);
+    }
+}
+
+void IrradianceCache::clear()
+{
+    tbb::spin_rw_mutex::scoped_lock lock(mutex, true);
+    if (root)
+        root.reset(new Node);
+}
+
+IrradianceCache::Stats IrradianceCache::stats() const
+{
+    Stats s;
+    s.lookups = lookups;
+    s.records = records;
+    s.rays = rays;
+    return s;
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <Eigen/Core>
+#include <../ext/embree/include/embree3/rtcore.h>
+#include <sampler.h>
+#include <tbb/spin_rw_mutex.h>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// Ward-style irradiance cache for ambient occlusion (Ward et al. 1988, with the
+// gradients of Ward and Heckbert 1992).  A record stores the visible fraction of the
+// cosine-weighted hemisphere at one point, the harmonic mean distance to the occluders
+// seen from it, and how the value changes as the point moves and the normal turns.
+// Other shading points close enough (relative to that distance) reuse records by
+// gradient-corrected weighted interpolation instead of tracing rays.  Records are
+// created lazily when a lookup finds none that apply, and live in an octree.  Lookups
+// take a shared lock and inserts an exclusive one, so render threads can do both
+// concurrently.
+class IrradianceCache
+{
+public:
+    /// @param scene The scene occlusion is traced against; must be committed before
+    /// the first lookup.
+    /// @param range Occluders farther than this are ignored, as for AmbientLight.
+    IrradianceCache(RTCScene scene, float range);
+
+    /// Visible fraction of the hemisphere around normal at position, interpolated from
+    /// the cache or computed (and cached) if no record applies, with its strata jittered
+    /// by random
+    float visibility(const Eigen::Vector3f &position, const Eigen::Vector3f &normal, PCG32 &random);
+
+    /// Discard every record, e.g. after the geometry moved
+    void clear();
+
+    struct Stats
+    {
+        unsigned long long lookups, records, rays;
+    };
+    Stats stats() const;
+
+    // Largest allowed interpolation error: a record is used up to accuracy times its
+    // harmonic mean distance away
+    float accuracy = 0.2f;
+
+    // Hemisphere strata per record, in theta and phi
+    static const int ThetaStrata = 8;
+    static const int PhiStrata = 24;
+
+private:
+    struct Record
+    {
+        Eigen::Vector3f position, normal;
+        float value;
+        // Harmonic mean distance to the occluders, clamped to [minSpacing, maxSpacing]
+        float radius;
+        Eigen::Vector3f translationGradient, rotationGradient;
+    };
+
+    struct Node
+    {
+        std::vector<Record> records;
+        std::unique_ptr<Node> children[8];
+    };
+
+    RTCScene scene;
+    float range;
+    float minSpacing = 0, maxSpacing = 0;
+
+    // A cube around the scene's bounds, set up on the first lookup
+    std::unique_ptr<Node> root;
+    Eigen::Vector3f rootMin, rootMax;
+    std::once_flag initialized;
+    static const int MaxDepth = 16;
+
+    tbb::spin_rw_mutex mutex;
+    std::atomic<unsigned long long> lookups, records, rays;
+
+    // Size the octree and record spacing from the (by now committed) scene's bounds
+    void initialize();
+
+    // Weighted sum of the records that apply at (position, normal); false if none do
+    bool interpolate(const Eigen::Vector3f &position, const Eigen::Vector3f &normal, float &value) const;
+
+    // Trace a stratified hemisphere at (position, normal) into a new record
+    Record sample(const Eigen::Vector3f &position, const Eigen::Vector3f &normal, PCG32 &random);
+
+    void insert(const Record &record);
+    void insert(Node *node, const Eigen::Vector3f &lo, const Eigen::Vector3f &hi, const Record &record,
+                const Eigen::Vector3f &recordLo, const Eigen::Vector3f &recordHi, int depth);
+};
@@ -1,9 +1,11 @@
 #include <lights.h>
+#include <imageio.h>
+#include <algorithm>
 #include <math.h>
 
 BaseLight::BaseLight(std::shared_ptr<RTUtil::LightInfo> l) : type(l->type){};
 
-AmbientLight::AmbientLight(std::shared_ptr<RTUtil::LightInfo> l) : BaseLight(l)
+AmbientLight::AmbientLight(std::shared_ptr<RTUtil::LightInfo> l, RTCScene scene) : BaseLight(l), scene(scene)
 {
     powerOrRad = l->radiance;
     radiance = l->radiance;
@@ -16,32 +18,96 @@ AmbientLight::AmbientLight(std::shared_ptr<RTUtil::LightInfo> l) : BaseLight(l)
         range = std::numeric_limits<float>::infinity();
         // range = 0;
     }
+    samples = std::max(l->samples, 1);
+    if (l->cache)
+        cache = std::make_shared<IrradianceCache>(scene, range);
 };
 
+bool SceneShadowTest::operator()(const Eigen::Vector3f &position, float range) const
+{
+    Eigen::Vector3f toPosition = position - origin;
+    if (range == std::numeric_limits<float>::infinity())
+        range = toPosition.norm();
+    Eigen::Vector3f dir = toPosition.normalized();
+
+    RTCRay ray;
+    ray.org_x = origin.x();
+    ray.org_y = origin.y();
+    ray.org_z = origin.z();
+    ray.dir_x = dir.x();
+    ray.dir_y = dir.y();
+    ray.dir_z = dir.z();
+    ray.tnear = .01f;
+    ray.tfar = range - .02f;
+    ray.time = 0;
+    ray.mask = ShadowRays;
+    ray.id = 0;
+    ray.flags = 0;
+
+    RTCIntersectContext context;
+    rtcInitIntersectContext(&context);
+    rtcOccluded1(scene, &context, &ray);
+    return ray.tfar >= 0;
+}
+
 Eigen::Vector3f AmbientLight::getContribution(Eigen::Vector3f incomingDir, Eigen::Vector3f intersection, Eigen::Vector3f normal, std::shared_ptr<nori::BSDF> material,
-                                              std::function<bool(Eigen::Vector3f, float)> doShadowTest)
+                                              const ShadowTest &doShadowTest, PCG32 &random)
 {
-    // randomly sample a point on the unit s
-    float x = (float)rand() / (float)RAND_MAX;
-    float y = (float)rand() / (float)RAND_MAX;
+    // Cosine-weighted directions make the visible fraction the Monte Carlo estimate of
+    // the diffuse response to uniform radiance
+    return visibility(intersection, normal, random) * radiance.cwiseProduct(material->diffuseReflectance());
+}
 
-    RTUtil::Point2 sample(x, y);
+float AmbientLight::visibility(const Eigen::Vector3f &position, const Eigen::Vector3f &normal, PCG32 &random) const
+{
+    if (cache)
+        return cache->visibility(position, normal, random);
 
-    Eigen::Vector3f sampledOSpace = RTUtil::squareToCosineHemisphere(sample);
     nori::Frame frame(normal);
-    Eigen::Vector3f sampledWSpace = frame.toWorld(sampledOSpace);
 
-    if (doShadowTest(intersection + 4 * sampledWSpace, range))
-    {
-        return radiance.cwiseProduct(material->diffuseReflectance());
-    }
-    else
+    // Latin hypercube samples: one per stratum of each coordinate, with the y strata
+    // shuffled, so any sample count is stratified in both dimensions
+    int strata[BatchSize];
+    RTCRay rays[BatchSize];
+    RTCIntersectContext context;
+    rtcInitIntersectContext(&context);
+
+    int visible = 0;
+    for (int first = 0; first < samples; first += BatchSize)
     {
-        return Eigen::Vector3f(0, 0, 0);
+        int count = std::min(samples - first, BatchSize);
+        for (int i = 0; i < count; i++)
+            strata[i] = i;
+        for (int i = count - 1; i > 0; i--)
+            std::swap(strata[i], strata[random.nextUInt() % (i + 1)]);
+
+        for (int i = 0; i < count; i++)
+        {
+            float x = (i + random.nextFloat()) / count;
+            float y = (strata[i] + random.nextFloat()) / count;
+            Eigen::Vector3f dir = frame.toWorld(RTUtil::squareToCosineHemisphere(RTUtil::Point2(x, y)));
+
+            RTCRay &ray = rays[i];
+            ray.org_x = position.x();
+            ray.org_y = position.y();
+            ray.org_z = position.z();
+            ray.dir_x = dir.x();
+            ray.dir_y = dir.y();
+            ray.dir_z = dir.z();
+            ray.tnear = .01f;
+            ray.tfar = range;
+            ray.time = 0;
+            ray.mask = AmbientRays;
+            ray.id = i;
+            ray.flags = 0;
+        }
+
+        // Occluded rays come back with tfar = -inf
+        rtcOccluded1M(scene, &context, rays, count, sizeof(RTCRay));
+        for (int i = 0; i < count; i++)
+            visible += rays[i].tfar >= 0;
     }
-    // Check for occlusion
-
-    // Return MonteCarlo Estimate
+    return float(visible) / samples;
 }
 
 PointLight::PointLight(std::shared_ptr<RTUtil::LightInfo> l, Eigen::Affine3f transform) : BaseLight(l)
@@ -52,36 +118,54 @@ PointLight::PointLight(std::shared_ptr<RTUtil::LightInfo> l, Eigen::Affine3f tra
 };
 
 Eigen::Vector3f PointLight::getContribution(Eigen::Vector3f incomingDir, Eigen::Vector3f intersection, Eigen::Vector3f normal, std::shared_ptr<nori::BSDF> material,
-                                            std::function<bool(Eigen::Vector3f, float)> doShadowTest)
+                                            const ShadowTest &doShadowTest, PCG32 &random)
 {
     if (doShadowTest(this->position, std::numeric_limits<float>::infinity()))
     {
-        // std::cout << "no shadow\n";
+        return evalPoint(this->position, incomingDir, intersection, normal, *material);
+    }
+    else
+    {
+        return Eigen::Vector3f(0, 0, 0);
+    }
+}
 
-        Eigen::Vector3f outGoing = this->position - intersection;
+bool PointLight::samplePoint(const Eigen::Vector2f &u, Eigen::Vector3f &point) const
+{
+    point = position;
+    return true;
+}
 
-        float dist = outGoing.norm();
-        Eigen::Vector3f lightDir = outGoing.normalized();
+Eigen::Vector3f PointLight::evalPoint(const Eigen::Vector3f &point, const Eigen::Vector3f &incomingDir, const Eigen::Vector3f &intersection,
+                                      const Eigen::Vector3f &normal, const nori::BSDF &material) const
+{
+    Eigen::Vector3f outGoing = point - intersection;
 
-        // Create a frame
-        nori::Frame frame(normal);
+    float dist = outGoing.norm();
+    Eigen::Vector3f lightDir = outGoing.normalized();
 
-        // Craft a BSDF query
-        nori::BSDFQueryRecord query(-frame.toLocal(incomingDir), frame.toLocal(lightDir));
+    // Create a frame
+    nori::Frame frame(normal);
 
-        // v dot w
-        float x = lightDir.dot(normal) / (dist * dist);
+    // Craft a BSDF query
+    nori::BSDFQueryRecord query(-frame.toLocal(incomingDir), frame.toLocal(lightDir));
 
-        nori::Color3f color = material->eval(query);
+    // v dot w
+    float x = lightDir.dot(normal) / (dist * dist);
 
-        // std::cout << color << "\n";
+    nori::Color3f color = material.eval(query);
 
-        return x * color.cwiseProduct(power) / (4 * M_PI);
-    }
-    else
-    {
-        return Eigen::Vector3f(0, 0, 0);
-    }
+    return x * color.cwiseProduct(power) / (4 * M_PI);
+}
+
+bool PointLight::samplePhoton(const Eigen::Vector2f &u, const Eigen::Vector2f &v, Eigen::Vector3f &origin, Eigen::Vector3f &dir) const
+{
+    float z = 1 - 2 * v.x();
+    float r = sqrtf(std::max(1 - z * z, 0.f));
+    float phi = 2 * M_PI * v.y();
+    origin = position;
+    dir = Eigen::Vector3f(r * cosf(phi), r * sinf(phi), z);
+    return true;
 }
 
 AreaLight::AreaLight(std::shared_ptr<RTUtil::LightInfo> l, Eigen::Affine3f transform) : BaseLight(l)
@@ -116,41 +200,319 @@ AreaLight::AreaLight(std::shared_ptr<RTUtil::LightInfo> l, Eigen::Affine3f trans
 };
 
 Eigen::Vector3f AreaLight::getContribution(Eigen::Vector3f incomingDir, Eigen::Vector3f intersection, Eigen::Vector3f normal, std::shared_ptr<nori::BSDF> material,
-                                           std::function<bool(Eigen::Vector3f, float)> doShadowTest)
+                                           const ShadowTest &doShadowTest, PCG32 &random)
 {
-    float prx = (float)rand() / (float)RAND_MAX;
-    float rx = prx * this->width;
+    float prx = random.nextFloat();
+    float pry = random.nextFloat();
 
-    float pry = (float)rand() / (float)RAND_MAX;
-    float ry = pry * this->height;
+    Eigen::Vector3f randPoint;
+    samplePoint(Eigen::Vector2f(prx, pry), randPoint);
 
-    Eigen::Vector3f randPoint = this->botLeft + (this->upDir * ry) + (this->rightDir * rx);
-    Eigen::Vector3f outGoing = randPoint - intersection;
-
-    if (doShadowTest(randPoint, std::numeric_limits<float>::infinity()) & (this->nor.dot(outGoing) < 0))
+    // Only trace the shadow ray toward the lit side of the light
+    Eigen::Vector3f contribution = evalPoint(randPoint, incomingDir, intersection, normal, *material);
+    if (!contribution.isZero() && doShadowTest(randPoint, std::numeric_limits<float>::infinity()))
     {
+        return contribution;
+    }
+    else
+    {
+        return Eigen::Vector3f(0, 0, 0);
+    }
+}
 
-        float dist = outGoing.norm();
-        Eigen::Vector3f lightDir = outGoing.normalized();
+bool AreaLight::samplePoint(const Eigen::Vector2f &u, Eigen::Vector3f &point) const
+{
+    point = this->botLeft + (this->upDir * u.y() * this->height) + (this->rightDir * u.x() * this->width);
+    return true;
+}
 
-        // Create a frame
-        nori::Frame frame(normal);
+Eigen::Vector3f AreaLight::evalPoint(const Eigen::Vector3f &point, const Eigen::Vector3f &incomingDir, const Eigen::Vector3f &intersection,
+                                     const Eigen::Vector3f &normal, const nori::BSDF &material) const
+{
+    Eigen::Vector3f outGoing = point - intersection;
+    if (this->nor.dot(outGoing) >= 0)
+        return Eigen::Vector3f(0, 0, 0);
 
-        // Craft a BSDF query
-        nori::BSDFQueryRecord query(frame.toLocal(-incomingDir).normalized(), frame.toLocal(lightDir).normalized());
-        nori::Color3f bsdf = material->eval(query);
+    float dist = outGoing.norm();
+    Eigen::Vector3f lightDir = outGoing.normalized();
 
-        Eigen::Vector3f L = power / (2 * M_PI * width * height);
+    // Create a frame
+    nori::Frame frame(normal);
+
+    // Craft a BSDF query
+    nori::BSDFQueryRecord query(frame.toLocal(-incomingDir).normalized(), frame.toLocal(lightDir).normalized());
+    nori::Color3f bsdf = material.eval(query);
 
-        float rest = height * width * lightDir.dot(normal) * lightDir.dot(this->nor) / (dist * dist);
-        rest = abs(rest);
+    Eigen::Vector3f L = power / (2 * M_PI * width * height);
 
-        // std::cout << bsdf << '\n';
+    // Uniform points over the rectangle have density 1 / (width * height)
+    float rest = height * width * lightDir.dot(normal) * lightDir.dot(this->nor) / (dist * dist);
+    rest = fabsf(rest);
+
+    return rest * bsdf.cwiseProduct(L);
+}
+
+bool AreaLight::samplePhoton(const Eigen::Vector2f &u, const Eigen::Vector2f &v, Eigen::Vector3f &origin, Eigen::Vector3f &dir) const
+{
+    samplePoint(u, origin);
+    nori::Frame frame(this->nor);
+    dir = frame.toWorld(RTUtil::squareToCosineHemisphere(RTUtil::Point2(v.x(), v.y())));
+    return true;
+}
 
-        return rest * bsdf.cwiseProduct(L);
+EnvironmentLight::EnvironmentLight(std::shared_ptr<RTUtil::LightInfo> l) : BaseLight(l)
+{
+    powerOrRad = l->radiance;
+    samples = std::max(l->samples, 1);
+
+    std::vector<float> rgb;
+    if (l->file.empty() || !readHDR(l->file, width, height, rgb))
+    {
+        width = height = 1;
+        rgb.assign(3, 1.f);
     }
     else
     {
-        return Eigen::Vector3f(0, 0, 0);
+        std::cout << "Loaded a " << width << "x" << height << " environment map from " << l->file << '\n';
+    }
+
+    texels.resize(size_t(width) * height);
+    std::vector<float> weights(texels.size());
+    for (int y = 0; y < height; y++)
+    {
+        // Rows near the poles cover less solid angle
+        float sinTheta = sinf(M_PI * (y + 0.5f) / height);
+        for (int x = 0; x < width; x++)
+        {
+            size_t i = size_t(width) * y + x;
+            texels[i] = Eigen::Vector3f(rgb[3 * i], rgb[3 * i + 1], rgb[3 * i + 2]).cwiseMax(Eigen::Vector3f::Zero()).cwiseProduct(l->radiance);
+            weights[i] = (0.2126f * texels[i].x() + 0.7152f * texels[i].y() + 0.0722f * texels[i].z()) * sinTheta;
+        }
+    }
+    distribution = Distribution2D(weights, width, height);
+}
+
+Eigen::Vector2f EnvironmentLight::toMap(const Eigen::Vector3f &dir)
+{
+    float theta = acosf(std::min(std::max(dir.y(), -1.f), 1.f));
+    float phi = atan2f(dir.z(), dir.x());
+    if (phi < 0)
+        phi += 2 * M_PI;
+    return Eigen::Vector2f(std::min(phi / float(2 * M_PI), 0.99999994f), std::min(theta / float(M_PI), 0.99999994f));
+}
+
+Eigen::Vector3f EnvironmentLight::fromMap(const Eigen::Vector2f &p)
+{
+    float theta = M_PI * p.y(), phi = 2 * M_PI * p.x();
+    float sinTheta = sinf(theta);
+    return Eigen::Vector3f(sinTheta * cosf(phi), cosf(theta), sinTheta * sinf(phi));
+}
+
+Eigen::Vector3f EnvironmentLight::radiance(const Eigen::Vector3f &dir) const
+{
+    Eigen::Vector2f p = toMap(dir.normalized());
+    int x = std::min(int(p.x() * width), width - 1);
+    int y = std::min(int(p.y() * height), height - 1);
+    return texels[size_t(width) * y + x];
+}
+
+Eigen::Vector3f EnvironmentLight::sampleDirection(const Eigen::Vector2f &u, float &pdf) const
+{
+    float mapPdf;
+    Eigen::Vector2f p = distribution.sample(u, mapPdf);
+    Eigen::Vector3f dir = fromMap(p);
+
+    // The map covers 2 pi x pi radians, stretched by 1 / sin theta at each latitude
+    float sinTheta = sinf(M_PI * p.y());
+    pdf = sinTheta > 0 ? mapPdf / (2 * M_PI * M_PI * sinTheta) : 0;
+    return dir;
+}
+
+float EnvironmentLight::pdf(const Eigen::Vector3f &dir) const
+{
+    Eigen::Vector2f p = toMap(dir);
+    float sinTheta = sinf(M_PI * p.y());
+    return sinTheta > 0 ? distribution.pdf(p) / (2 * M_PI * M_PI * sinTheta) : 0;
+}
+
+Eigen::Vector3f EnvironmentLight::getContribution(Eigen::Vector3f incomingDir, Eigen::Vector3f intersection, Eigen::Vector3f normal, std::shared_ptr<nori::BSDF> material,
+                                                  const ShadowTest &doShadowTest, PCG32 &random)
+{
+    nori::Frame frame(normal);
+    Eigen::Vector3f wi = frame.toLocal(-incomingDir).normalized();
+    Eigen::Vector3f result(0, 0, 0);
+
+    // Shadow rays reach past any geometry; the test aims at position and stops at range
+    const float Far = 1e30f;
+
+    for (int s = 0; s < samples; s++)
+    {
+        // From the light
+        Eigen::Vector2f u(random.nextFloat(), random.nextFloat());
+        float lightPdf;
+        Eigen::Vector3f dir = sampleDirection(u, lightPdf);
+        nori::BSDFQueryRecord query(wi, frame.toLocal(dir));
+        float cosine = nori::Frame::cosTheta(query.wo);
+        if (lightPdf > 0 && cosine > 0)
+        {
+            Eigen::Vector3f f = material->eval(query) * cosine;
+            float bsdfPdf = material->pdf(query);
+            float weight = lightPdf * lightPdf / (lightPdf * lightPdf + bsdfPdf * bsdfPdf);
+            if (!f.isZero() && doShadowTest(intersection + dir, Far))
+                result += f.cwiseProduct(radiance(dir)) * (weight / lightPdf);
+        }
+
+        // From the BSDF
+        nori::BSDFQueryRecord sampled(wi);
+        Eigen::Vector2f v(random.nextFloat(), random.nextFloat());
+        Eigen::Vector3f value = material->sample(sampled, v);
+        if (value.isZero() || nori::Frame::cosTheta(sampled.wo) <= 0)
+            continue;
+        float bsdfPdf = material->pdf(sampled);
+        dir = frame.toWorld(sampled.wo);
+        lightPdf = pdf(dir);
+        float weight = bsdfPdf * bsdfPdf / (lightPdf * lightPdf + bsdfPdf * bsdfPdf);
+        Eigen::Vector3f f = material->eval(sampled) * nori::Frame::cosTheta(sampled.wo);
+        if (bsdfPdf > 0 && doShadowTest(intersection + dir, Far))
+            result += f.cwiseProduct(radiance(dir)) * (weight / bsdfPdf);
     }
+    return result / samples;
+}
+
+MeshLight::MeshLight(const Eigen::Vector3f &radiance, const std::vector<Eigen::Vector3f> &positions, const std::vector<unsigned> &indices,
+                     RTCScene scene, unsigned geomID)
+    : BaseLight(RTUtil::Emissive), indices(indices), scene(scene), radiance(radiance), geomID(geomID)
+{
+    powerOrRad = radiance;
+    setPositions(positions);
+}
+
+void MeshLight::setPositions(const std::vector<Eigen::Vector3f> &positions)
+{
+    int count = int(indices.size() / 3);
+    triangles.resize(count);
+    cdf.resize(count);
+    float total = 0;
+    for (int t = 0; t < count; t++)
+    {
+        Triangle &tri = triangles[t];
+        tri.p0 = positions[indices[3 * t]];
+        tri.e1 = positions[indices[3 * t + 1]] - tri.p0;
+        tri.e2 = positions[indices[3 * t + 2]] - tri.p0;
+        Eigen::Vector3f cross = tri.e1.cross(tri.e2);
+        float norm = cross.norm();
+        tri.normal = norm > 0 ? Eigen::Vector3f(cross / norm) : Eigen::Vector3f::Zero();
+        total += norm / 2;
+        cdf[t] = total;
+    }
+}
+
+bool MeshLight::sample(Eigen::Vector2f u, Eigen::Vector3f &point, Eigen::Vector3f &normal) const
+{
+    if (area() <= 0)
+        return false;
+
+    // Choose the triangle with u.x and reuse what is left of it within the triangle
+    float target = u.x() * area();
+    int t = std::min(int(std::upper_bound(cdf.begin(), cdf.end(), target) - cdf.begin()), int(cdf.size()) - 1);
+    float start = t > 0 ? cdf[t - 1] : 0;
+    u.x() = std::min((target - start) / std::max(cdf[t] - start, 1e-20f), 0.99999994f);
+
+    // Uniform barycentrics
+    float s = sqrtf(u.x());
+    float b1 = 1 - s, b2 = u.y() * s;
+    const Triangle &tri = triangles[t];
+    point = tri.p0 + b1 * tri.e1 + b2 * tri.e2;
+    normal = tri.normal;
+    return true;
+}
+
+float MeshLight::solidAnglePdf(const Eigen::Vector3f &dir, float distance, const Eigen::Vector3f &normal) const
+{
+    float cosine = -dir.dot(normal);
+    return cosine > 0 ? distance * distance / (cosine * area()) : 0;
+}
+
+Eigen::Vector3f MeshLight::emitted(unsigned primID, const Eigen::Vector3f &dir) const
+{
+    if (primID >= triangles.size() || triangles[primID].normal.dot(dir) >= 0)
+        return Eigen::Vector3f::Zero();
+    return radiance;
+}
+
+Eigen::Vector3f MeshLight::getContribution(Eigen::Vector3f incomingDir, Eigen::Vector3f intersection, Eigen::Vector3f normal, std::shared_ptr<nori::BSDF> material,
+                                           const ShadowTest &doShadowTest, PCG32 &random)
+{
+    nori::Frame frame(normal);
+    Eigen::Vector3f wi = frame.toLocal(-incomingDir).normalized();
+    Eigen::Vector3f result(0, 0, 0);
+
+    // From the light
+    Eigen::Vector2f u(random.nextFloat(), random.nextFloat());
+    Eigen::Vector3f point, lightNormal;
+    if (sample(u, point, lightNormal))
+    {
+        Eigen::Vector3f outGoing = point - intersection;
+        float dist = outGoing.norm();
+        Eigen::Vector3f dir = outGoing / dist;
+        float lightPdf = solidAnglePdf(dir, dist, lightNormal);
+        nori::BSDFQueryRecord query(wi, frame.toLocal(dir));
+        float cosine = nori::Frame::cosTheta(query.wo);
+        if (lightPdf > 0 && cosine > 0)
+        {
+            Eigen::Vector3f f = material->eval(query) * cosine;
+            float bsdfPdf = material->pdf(query);
+            float weight = lightPdf * lightPdf / (lightPdf * lightPdf + bsdfPdf * bsdfPdf);
+            if (!f.isZero() && doShadowTest(point, std::numeric_limits<float>::infinity()))
+                result += f.cwiseProduct(radiance) * (weight / lightPdf);
+        }
+    }
+
+    // From the BSDF, counted if the first thing it hits is a front face of this mesh
+    nori::BSDFQueryRecord sampled(wi);
+    Eigen::Vector2f v(random.nextFloat(), random.nextFloat());
+    if (material->sample(sampled, v).isZero() || nori::Frame::cosTheta(sampled.wo) <= 0)
+        return result;
+    float bsdfPdf = material->pdf(sampled);
+    if (!(bsdfPdf > 0))
+        return result;
+    Eigen::Vector3f dir = frame.toWorld(sampled.wo);
+
+    RTCRayHit rayhit;
+    rayhit.ray.org_x = intersection.x();
+    rayhit.ray.org_y = intersection.y();
+    rayhit.ray.org_z = intersection.z();
+    rayhit.ray.dir_x = dir.x();
+    rayhit.ray.dir_y = dir.y();
+    rayhit.ray.dir_z = dir.z();
+    rayhit.ray.tnear = .01f;
+    rayhit.ray.tfar = std::numeric_limits<float>::infinity();
+    rayhit.ray.time = 0;
+    rayhit.ray.mask = ShadowRays | EmitterRays;
+    rayhit.ray.id = 0;
+    rayhit.ray.flags = 0;
+    rayhit.hit.geomID = RTC_INVALID_GEOMETRY_ID;
+    rayhit.hit.instID[0] = RTC_INVALID_GEOMETRY_ID;
+    RTCIntersectContext context;
+    rtcInitIntersectContext(&context);
+    rtcIntersect1(scene, &context, &rayhit);
+    if (rayhit.hit.geomID != geomID || rayhit.hit.primID >= triangles.size())
+        return result;
+
+    float lightPdf = solidAnglePdf(dir, rayhit.ray.tfar, triangles[rayhit.hit.primID].normal);
+    if (lightPdf <= 0)
+        return result;
+    float weight = bsdfPdf * bsdfPdf / (lightPdf * lightPdf + bsdfPdf * bsdfPdf);
+    Eigen::Vector3f f = material->eval(sampled) * nori::Frame::cosTheta(sampled.wo);
+    return result + f.cwiseProduct(radiance) * (weight / bsdfPdf);
+}
+
+bool MeshLight::samplePhoton(const Eigen::Vector2f &u, const Eigen::Vector2f &v, Eigen::Vector3f &origin, Eigen::Vector3f &dir) const
+{
+    Eigen::Vector3f normal;
+    if (!sample(u, origin, normal))
+        return false;
+    nori::Frame frame(normal);
+    dir = frame.toWorld(RTUtil::squareToCosineHemisphere(RTUtil::Point2(v.x(), v.y())));
+    return true;
 }
@@ -1,8 +1,39 @@
+#pragma once
+
 #include <RTUtil/sceneinfo.hpp>
 #include <Eigen/Geometry>
 #include <RTUtil/microfacet.hpp>
 #include <RTUtil/frame.hpp>
 #include <../ext/embree/include/embree3/rtcore.h>
+#include <irradiancecache.h>
+#include <distribution.h>
+#include <visibility.h>
+#include <sampler.h>
+
+// Shadow test a light asks of whoever shades with it: true if nothing blocks the way
+// from the shading point toward position, up to range (infinity: all the way to
+// position).  A plain interface rather than a std::function, so that handing it to
+// the lights costs neither a copy nor, for larger captures, an allocation per call.
+class ShadowTest
+{
+public:
+    virtual bool operator()(const Eigen::Vector3f &position, float range) const = 0;
+};
+
+// Shadow test by one occlusion ray against the scene, started just off the shading
+// point and stopped just short of the target, through geometry visible to ShadowRays
+class SceneShadowTest : public ShadowTest
+{
+public:
+    SceneShadowTest(RTCScene scene, const Eigen::Vector3f &origin) : scene(scene), origin(origin) {}
+
+    bool operator()(const Eigen::Vector3f &position, float range) const override;
+
+private:
+    RTCScene scene;
+    const Eigen::Vector3f &origin;
+};
+
 // Class to represent geometry-less ambient lighting
 
 class BaseLight
@@ -12,19 +43,59 @@ public:
     RTUtil::LightType type;
     Eigen::Vector3f powerOrRad;
     virtual Eigen::Vector3f getContribution(Eigen::Vector3f incomingDir, Eigen::Vector3f intersection, Eigen::Vector3f normal, std::shared_ptr<nori::BSDF> material,
-                                            std::function<bool(Eigen::Vector3f, float)> doShadowTest) = 0;
+                                            const ShadowTest &doShadowTest, PCG32 &random) = 0;
     BaseLight(std::shared_ptr<RTUtil::LightInfo> l);
+    BaseLight(RTUtil::LightType type) : type(type) {}
+
+    /// Pick a point on the light from u in [0, 1)^2, for estimators that choose their own
+    /// light samples.  Returns false for lights without points to sample (ambient).
+    virtual bool samplePoint(const Eigen::Vector2f &u, Eigen::Vector3f &point) const { return false; }
+
+    /// Unshadowed contribution of a point from samplePoint() to the radiance leaving the
+    /// intersection along -incomingDir, divided by the density samplePoint() picks it with
+    virtual Eigen::Vector3f evalPoint(const Eigen::Vector3f &point, const Eigen::Vector3f &incomingDir, const Eigen::Vector3f &intersection,
+                                      const Eigen::Vector3f &normal, const nori::BSDF &material) const
+    {
+        return Eigen::Vector3f::Zero();
+    }
+
+    /// Total power leaving the light, consistent with the light getContribution() sees
+    virtual Eigen::Vector3f emittedPower() const { return Eigen::Vector3f::Zero(); }
+
+    /// Start a photon from u and v in [0, 1)^2: a point on the light and a direction
+    /// leaving it, distributed like the emitted power.  Returns false for lights that do
+    /// not emit photons (ambient).
+    virtual bool samplePhoton(const Eigen::Vector2f &u, const Eigen::Vector2f &v, Eigen::Vector3f &origin, Eigen::Vector3f &dir) const { return false; }
 };
 
+// Ambient occlusion: each shading point traces a batch of stratified cosine-weighted
+// directions as one stream of occlusion rays reaching out to the light's range, and the
+// visible fraction scales the ambient radiance.  With a cache, the visible fraction is
+// instead interpolated from an IrradianceCache shared by all threads.  The shadow test
+// is not used.
 class AmbientLight : public BaseLight
 {
     Eigen::Vector3f radiance;
     float range;
+    int samples;
+    RTCScene scene;
+
+    // Rays per rtcOccluded1M call; larger batches are traced in chunks
+    static const int BatchSize = 64;
 
 public:
-    AmbientLight(std::shared_ptr<RTUtil::LightInfo> l);
+    // Set when the light's info asks for a cache
+    std::shared_ptr<IrradianceCache> cache;
+
+    /// @param scene The scene occlusion rays are traced against.
+    AmbientLight(std::shared_ptr<RTUtil::LightInfo> l, RTCScene scene);
     Eigen::Vector3f getContribution(Eigen::Vector3f incomingDir, Eigen::Vector3f intersection, Eigen::Vector3f normal, std::shared_ptr<nori::BSDF> material,
-                                    std::function<bool(Eigen::Vector3f, float)> doShadowTest);
+                                    const ShadowTest &doShadowTest, PCG32 &random);
+
+    /// Fraction of samples cosine-weighted directions around normal that are not blocked
+    /// within the light's range, or the cache's estimate of it.  The directions are
+    /// jittered with random.
+    float visibility(const Eigen::Vector3f &position, const Eigen::Vector3f &normal, PCG32 &random) const;
 };
 
 // Class to represent a point light
@@ -35,7 +106,13 @@ public:
     Eigen::Vector3f position;
     PointLight(std::shared_ptr<RTUtil::LightInfo> l, Eigen::Affine3f transform);
     Eigen::Vector3f getContribution(Eigen::Vector3f incomingDir, Eigen::Vector3f intersection, Eigen::Vector3f normal, std::shared_ptr<nori::BSDF> material,
-                                    std::function<bool(Eigen::Vector3f, float)> doShadowTest);
+                                    const ShadowTest &doShadowTest, PCG32 &random);
+    bool samplePoint(const Eigen::Vector2f &u, Eigen::Vector3f &point) const;
+    Eigen::Vector3f evalPoint(const Eigen::Vector3f &point, const Eigen::Vector3f &incomingDir, const Eigen::Vector3f &intersection,
+                              const Eigen::Vector3f &normal, const nori::BSDF &material) const;
+    Eigen::Vector3f emittedPower() const { return power; }
+    // Uniform over the sphere of directions
+    bool samplePhoton(const Eigen::Vector2f &u, const Eigen::Vector2f &v, Eigen::Vector3f &origin, Eigen::Vector3f &dir) const;
 };
 
 // Class to represent an area light
@@ -54,5 +131,105 @@ public:
 
     AreaLight(std::shared_ptr<RTUtil::LightInfo> l, Eigen::Affine3f transform);
     Eigen::Vector3f getContribution(Eigen::Vector3f incomingDir, Eigen::Vector3f intersection, Eigen::Vector3f normal, std::shared_ptr<nori::BSDF> material,
-                                    std::function<bool(Eigen::Vector3f, float)> doShadowTest);
-};
\ No newline at end of file
+                                    const ShadowTest &doShadowTest, PCG32 &random);
+    // Uniform over the rectangle
+    bool samplePoint(const Eigen::Vector2f &u, Eigen::Vector3f &point) const;
+    Eigen::Vector3f evalPoint(const Eigen::Vector3f &point, const Eigen::Vector3f &incomingDir, const Eigen::Vector3f &intersection,
+                              const Eigen::Vector3f &normal, const nori::BSDF &material) const;
+    // The rectangle's radiance is power / (2 pi width height) on its lit side, so half
+    // the nominal power leaves it
+    Eigen::Vector3f emittedPower() const { return power / 2; }
+    // Uniform over the rectangle, cosine-weighted about its normal
+    bool samplePhoton(const Eigen::Vector2f &u, const Eigen::Vector2f &v, Eigen::Vector3f &origin, Eigen::Vector3f &dir) const;
+};
+// Image-based lighting from a latitude-longitude HDR map surrounding the scene, with +y
+// up: the map's top row is the zenith and its columns run through phi = atan2(z, x).
+// Directions are importance sampled from a Distribution2D over the texels weighted by
+// their luminance and by sin theta (the solid angle their rows cover), and each shading
+// point combines samples light samples with as many BSDF samples by multiple importance
+// sampling (power heuristic), each with a shadow ray.
+class EnvironmentLight : public BaseLight
+{
+    int width, height;
+    // Radiance of each texel, row by row from the top, scaled by the light's radiance
+    std::vector<Eigen::Vector3f> texels;
+    Distribution2D distribution;
+    int samples;
+
+    // Map coordinates in [0, 1)^2 of a unit direction, and back
+    static Eigen::Vector2f toMap(const Eigen::Vector3f &dir);
+    static Eigen::Vector3f fromMap(const Eigen::Vector2f &p);
+
+public:
+    /// Reads the map from l->file; an unreadable map is replaced by l->radiance
+    /// everywhere.
+    EnvironmentLight(std::shared_ptr<RTUtil::LightInfo> l);
+    Eigen::Vector3f getContribution(Eigen::Vector3f incomingDir, Eigen::Vector3f intersection, Eigen::Vector3f normal, std::shared_ptr<nori::BSDF> material,
+                                    const ShadowTest &doShadowTest, PCG32 &random);
+
+    /// Radiance arriving from the unit direction -dir, i.e. seen by a ray travelling along dir
+    Eigen::Vector3f radiance(const Eigen::Vector3f &dir) const;
+
+    /// Unit direction toward the environment distributed like its radiance, from u in
+    /// [0, 1)^2, and its density per steradian
+    Eigen::Vector3f sampleDirection(const Eigen::Vector2f &u, float &pdf) const;
+
+    /// Density of sampleDirection() picking dir, per steradian
+    float pdf(const Eigen::Vector3f &dir) const;
+};
+
+// Light from the triangles of an emissive mesh, each a one-sided Lambertian emitter of
+// the material's emissive radiance along its face normal (by the winding order).
+// Points are sampled uniformly over the mesh's area, picking a triangle from a CDF of
+// the areas.  Each shading point combines a point sample with a BSDF sample that
+// counts if it reaches the mesh, weighted by multiple importance sampling (power
+// heuristic), so glossy surfaces see sharp reflections of large emitters.
+class MeshLight : public BaseLight
+{
+    struct Triangle
+    {
+        Eigen::Vector3f p0, e1, e2;
+        // Unit face normal
+        Eigen::Vector3f normal;
+    };
+    std::vector<Triangle> triangles;
+    // Cumulative area of the triangles
+    std::vector<float> cdf;
+    std::vector<unsigned> indices;
+    RTCScene scene;
+
+    // Density per steradian of sampling the point at distance along dir from a shading
+    // point, on a triangle facing back along dir with the given normal
+    float solidAnglePdf(const Eigen::Vector3f &dir, float distance, const Eigen::Vector3f &normal) const;
+
+public:
+    Eigen::Vector3f radiance;
+    unsigned geomID;
+
+    /// @param radiance The emitted radiance.
+    /// @param positions, indices The mesh's world-space vertex positions and triangles.
+    /// @param scene, geomID The scene the mesh is part of, and its geometry.
+    MeshLight(const Eigen::Vector3f &radiance, const std::vector<Eigen::Vector3f> &positions, const std::vector<unsigned> &indices,
+              RTCScene scene, unsigned geomID);
+
+    /// Replace the vertex positions after the mesh moved; the triangles are unchanged
+    void setPositions(const std::vector<Eigen::Vector3f> &positions);
+
+    Eigen::Vector3f getContribution(Eigen::Vector3f incomingDir, Eigen::Vector3f intersection, Eigen::Vector3f normal, std::shared_ptr<nori::BSDF> material,
+                                    const ShadowTest &doShadowTest, PCG32 &random);
+    // No samplePoint(): a point alone does not say which triangle, and so which way, it
+    // faces, so mesh lights are left to getContribution() rather than the resampler
+
+    Eigen::Vector3f emittedPower() const { return float(M_PI) * area() * radiance; }
+    // Uniform over the mesh's area, cosine-weighted about the face normal
+    bool samplePhoton(const Eigen::Vector2f &u, const Eigen::Vector2f &v, Eigen::Vector3f &origin, Eigen::Vector3f &dir) const;
+
+    /// Radiance seen along dir from a hit on triangle primID
+    Eigen::Vector3f emitted(unsigned primID, const Eigen::Vector3f &dir) const;
+
+    float area() const { return cdf.empty() ? 0 : cdf.back(); }
+
+private:
+    // Pick a triangle and a point on it
+    bool sample(Eigen::Vector2f u, Eigen::Vector3f &point, Eigen::Vector3f &normal) const;
+};
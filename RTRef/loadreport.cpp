@@ -0,0 +1,90 @@
+#include <loadreport.h>
+#include <RTUtil/json.hpp>
+#include <fstream>
+#include <iostream>
+
+using json = nlohmann::json;
+
+LoadReport::LoadReport() : current(0), peak(0) {}
+
+void LoadReport::attach(RTCDevice device)
+{
+    rtcSetDeviceMemoryMonitorFunction(device, memoryMonitor, this);
+}
+
+void LoadReport::addPhase(const std::string &name, double ms)
+{
+    phases.push_back(Phase{name, ms});
+}
+
+// Called by Embree (possibly from several build threads at once) for every
+// allocation and free; bytes is negative for frees.
+bool LoadReport::memoryMonitor(void *userPtr, ssize_t bytes, bool post)
+{
+    LoadReport *report = (LoadReport *)userPtr;
+
+    long long now = report->current.fetch_add(bytes) + bytes;
+    long long prev = report->peak.load();
+    while (now > prev && !report->peak.compare_exchange_weak(prev, now))
+        ;
+
+    // Never refuse an allocation; we only observe
+    return true;
+}
+
+double LoadReport::bytesPerTriangle() const
+{
+    size_t bytes = bvhBytes;
+    for (const GeometryStats &g : geometries)
+        bytes += g.bufferBytes;
+    return totalFaces > 0 ? double(bytes) / totalFaces : 0;
+}
+
+bool LoadReport::write(const std::string &path) const
+{
+    json j;
+    j["scene"] = scene;
+    j["totalMs"] = totalMs;
+
+    json phaseList = json::array();
+    for (const Phase &p : phases)
+        phaseList.push_back({{"name", p.name}, {"ms", p.ms}});
+    j["phases"] = phaseList;
+
+    json geomList = json::array();
+    for (const GeometryStats &g : geometries)
+    {
+        geomList.push_back({{"geomID", g.geomID},
+                            {"node", g.node},
+                            {"mesh", g.mesh},
+                            {"vertices", g.vertices},
+                            {"faces", g.faces},
+                            {"bufferBytes", g.bufferBytes},
+                            {"deviceBytes", g.deviceBytes},
+                            {"transformMs", g.transformMs},
+                            {"commitMs", g.commitMs}});
+    }
+    j["geometries"] = geomList;
+
+    j["memory"] = {{"bvhBytes", bvhBytes},
+                   {"bvhPeakBytes", bvhPeakBytes},
+                   {"deviceBytes", deviceBytes()},
+                   {"peakBytes", peakBytes()},
+                   {"cacheBytes", cacheBytes}};
+
+    j["totals"] = {{"geometries", geometries.size()},
+                   {"vertices", totalVertices},
+                   {"faces", totalFaces},
+                   {"compact", compact},
+                   {"streamed", streamed},
+                   {"bytesPerTriangle", bytesPerTriangle()}};
+
+    std::ofstream out(path);
+    if (out.fail())
+    {
+        std::cerr << "Unable to write load report " << path << std::endl;
+        return false;
+    }
+    out << j.dump(4) << std::endl;
+    return true;
+}
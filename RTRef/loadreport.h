@@ -0,0 +1,86 @@
+#pragma once
+
+#include <ext/embree/include/embree3/rtcore.h>
+#include <atomic>
+#include <string>
+#include <vector>
+
+// Structured record of what it cost to load a scene: time spent in each stage of
+// Generator::generateScene and the Embree memory it allocated.  Written out as JSON
+// so that load-time regressions can be tracked per scene.
+class LoadReport
+{
+public:
+    // A named, timed stage of the load (import, one postprocess step, BVH build...)
+    struct Phase
+    {
+        std::string name;
+        double ms;
+    };
+
+    // Cost of one Embree geometry
+    struct GeometryStats
+    {
+        unsigned geomID;
+        std::string node;
+        std::string mesh;
+        unsigned vertices;
+        unsigned faces;
+        // Bytes requested for the vertex and index buffers
+        size_t bufferBytes;
+        // Device memory that was allocated while creating and committing the geometry
+        long long deviceBytes;
+        // Time spent transforming vertices into the buffers, and in rtcCommitGeometry
+        double transformMs;
+        double commitMs;
+    };
+
+    std::string scene;
+    std::vector<Phase> phases;
+    std::vector<GeometryStats> geometries;
+
+    unsigned totalVertices = 0;
+    unsigned totalFaces = 0;
+
+    // Device memory retained by rtcCommitScene, i.e. the BVH itself
+    long long bvhBytes = 0;
+    // Highest device memory usage seen while the BVH was building
+    long long bvhPeakBytes = 0;
+
+    double totalMs = 0;
+
+    // Whether meshes were stored in compact form (LoadOptions::compact)
+    bool compact = false;
+
+    // Whether meshes were streamed from a geometry cache (LoadOptions::streamed), and
+    // the size of that cache on disk
+    bool streamed = false;
+    size_t cacheBytes = 0;
+
+    // Geometry buffer plus BVH bytes per triangle
+    double bytesPerTriangle() const;
+
+    LoadReport();
+
+    // Install the memory monitor on the device.  Must be called before any geometry
+    // is created, and the report must outlive the device.
+    void attach(RTCDevice device);
+
+    void addPhase(const std::string &name, double ms);
+
+    // Current and peak device memory in bytes, as seen by the memory monitor
+    long long deviceBytes() const { return current.load(); }
+    long long peakBytes() const { return peak.load(); }
+
+    // Reset the peak to the current usage so a single stage can be measured
+    void resetPeak() { peak.store(current.load()); }
+
+    // Write the report as JSON.  Returns false if the file could not be written.
+    bool write(const std::string &path) const;
+
+private:
+    std::atomic<long long> current;
+    std::atomic<long long> peak;
+
+    static bool memoryMonitor(void *userPtr, ssize_t bytes, bool post);
+};
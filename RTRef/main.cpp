@@ -20,6 +20,8 @@
 #include <limits>
 #include <typeinfo>
 #include <app.h>
+#include <sequence.h>
+#include <bench.h>
 #include <nanogui/screen.h>
 #include <nanogui/window.h>
 #include <nanogui/glcanvas.h>
@@ -37,21 +39,276 @@ RTC_NAMESPACE_OPEN
 
 /* -------------------------------------------------------------------------- */
 
+// Report how much paging a streamed scene needed, and how much tracing the ambient
+// lights' irradiance caches saved
+static void printCacheStats(shared_ptr<SceneAndCam> sc)
+{
+  if (sc->cache)
+  {
+    GeometryCache::Stats stats = sc->cache->stats();
+    printf("streaming: %llu page-ins, %llu evictions, %.1f MB resident (peak %.1f MB) of %.1f MB cached\n",
+           stats.pageIns, stats.evictions, stats.residentBytes / 1048576.0,
+           stats.peakResidentBytes / 1048576.0, sc->report.cacheBytes / 1048576.0);
+  }
+
+  for (const shared_ptr<BaseLight> &light : sc->lights)
+  {
+    shared_ptr<AmbientLight> ambient = dynamic_pointer_cast<AmbientLight>(light);
+    if (!ambient || !ambient->cache)
+      continue;
+    IrradianceCache::Stats stats = ambient->cache->stats();
+    printf("ambient cache: %llu lookups, %llu records, %llu rays (%.3f per lookup)\n",
+           stats.lookups, stats.records, stats.rays, stats.lookups ? double(stats.rays) / stats.lookups : 0.0);
+  }
+}
+
 int main(int argc, char **argv)
 {
   srand(time(NULL));
   string fileName = argv[1];
   string base = fileName.substr(0, fileName.find('.'));
 
-  shared_ptr<SceneAndCam> sceneWithCam = Generator::generateScene(fileName);
+  LoadOptions options;
+  string sequenceFile;
+  bool benchTrace = false;
+  bool benchDenoise = false;
+  bool resample = false;
+  bool benchGuiding = false;
+  bool wavefront = false;
+  bool benchWavefront = false;
+  TileOrder tileOrder = TileOrder::Hilbert;
+  bool sortRays = false;
+  bool benchLocality = false;
+  bool numa = false, pin = true;
+  bool benchNuma = false;
+  bool benchAlloc = false;
+  int maxDepth = 1;
+  bool guiding = false;
+  int photons = 0, gatherCount = 50;
+  float gatherRadius = 0;
+  unsigned aovs = 0;
+  Filter filter;
+  float aperture = 0, focus = 1;
+  double targetMs = 33;
+  int blades = 0;
+  for (int a = 2; a < argc; a++)
+  {
+    string arg = argv[a];
+    if (arg == "--sequence" && a + 1 < argc)
+      sequenceFile = argv[++a];
+    else if (arg == "--compact")
+      options.compact = true;
+    else if (arg == "--ambient-cache")
+      options.ambientCache = true;
+    else if (arg == "--environment" && a + 1 < argc)
+      options.environment = argv[++a];
+    else if (arg == "--bench-trace")
+      benchTrace = true;
+    else if (arg == "--bench-denoise")
+      benchDenoise = true;
+    else if (arg == "--resample")
+      resample = true;
+    else if (arg == "--bench-guiding")
+      benchGuiding = true;
+    else if (arg == "--depth" && a + 1 < argc)
+      maxDepth = std::max(atoi(argv[++a]), 1);
+    else if (arg == "--guide")
+      guiding = true;
+    else if (arg == "--wavefront")
+      wavefront = true;
+    else if (arg == "--bench-wavefront")
+      benchWavefront = true;
+    else if (arg == "--tile-order" && a + 1 < argc)
+    {
+      if (!parseTileOrder(argv[++a], tileOrder))
+      {
+        printf("error: unknown tile order %s (use rows, morton or hilbert)\n", argv[a]);
+        return 1;
+      }
+    }
+    else if (arg == "--sort-rays")
+      sortRays = true;
+    else if (arg == "--bench-locality")
+      benchLocality = true;
+    else if (arg == "--numa")
+      numa = true;
+    else if (arg == "--no-pin")
+      pin = false;
+    else if (arg == "--bench-numa")
+      benchNuma = true;
+    else if (arg == "--bench-alloc")
+      benchAlloc = true;
+    else if (arg == "--caustics" && a + 1 < argc)
+    {
+      // photons[,nearest photons gathered[,largest gather radius]]
+      if (sscanf(argv[++a], "%d,%d,%f", &photons, &gatherCount, &gatherRadius) < 1)
+      {
+        printf("error: --caustics expects photons[,gather count[,radius]]\n");
+        return 1;
+      }
+    }
+    else if (arg == "--filter" && a + 1 < argc)
+    {
+      if (!Filter::parse(argv[++a], filter))
+      {
+        printf("error: unknown filter %s (use box, tent or blackman-harris)\n", argv[a]);
+        return 1;
+      }
+    }
+    else if (arg == "--lens" && a + 1 < argc)
+    {
+      // aperture radius,focus distance[,blades]
+      if (sscanf(argv[++a], "%f,%f,%d", &aperture, &focus, &blades) < 2)
+      {
+        printf("error: --lens expects aperture,focus[,blades]\n");
+        return 1;
+      }
+    }
+    else if (arg == "--aov" && a + 1 < argc)
+    {
+      if (!AOVFilm::parse(argv[++a], aovs))
+        return 1;
+    }
+    else if (arg == "--target-ms" && a + 1 < argc)
+      targetMs = atof(argv[++a]);
+    else if (arg == "--stream" && a + 1 < argc)
+    {
+      // Resident budget for streamed geometry, in megabytes
+      options.streamed = true;
+      options.residentBudget = size_t(atof(argv[++a]) * (1 << 20));
+    }
+  }
+
+  // Longer paths reach the light through glossy surfaces themselves, so the photon map
+  // would count caustics twice
+  if (photons > 0 && maxDepth > 1)
+  {
+    printf("error: --caustics needs --depth 1 (paths of more vertices already carry caustics)\n");
+    return 1;
+  }
+
+  // Sequence mode: render keyframed frames back to back without opening a window
+  if (!sequenceFile.empty())
+  {
+    Sequence seq;
+    if (!Sequence::load(sequenceFile, seq))
+      return 1;
+    seq.aovs |= aovs;
+    seq.resample |= resample;
+    if (maxDepth > 1)
+      seq.maxDepth = maxDepth;
+    seq.guiding |= guiding;
+    if (photons > 0)
+    {
+      seq.photons = photons;
+      seq.gatherCount = gatherCount;
+      seq.gatherRadius = gatherRadius;
+    }
+    if (seq.photons > 0 && seq.maxDepth > 1)
+    {
+      printf("error: caustics need a depth of 1 (paths of more vertices already carry caustics)\n");
+      return 1;
+    }
+
+    options.dynamic = !seq.nodes.empty();
+
+    shared_ptr<SceneAndCam> sceneWithCam = Generator::generateScene(fileName, options);
+    sceneWithCam->report.write("output/load_" + base + ".json");
+
+    SequenceRenderer(sceneWithCam, seq).render("output/sequence_" + base + "_");
+    printCacheStats(sceneWithCam);
+
+    rtcReleaseScene(sceneWithCam->scene);
+    rtcReleaseDevice(sceneWithCam->device);
+    return 0;
+  }
+
+  shared_ptr<SceneAndCam> sceneWithCam = Generator::generateScene(fileName, options);
+  sceneWithCam->report.write("output/load_" + base + ".json");
+  if (aperture > 0)
+    sceneWithCam->cam.setLens(aperture, focus, blades);
   float aspect = sceneWithCam->cam.getAspect();
 
   int NY = 400;
   int NX = int(aspect * NY);
 
+  if (benchTrace)
+  {
+    benchmarkTrace(sceneWithCam, NX, NY, 16, "output/bench_trace_" + base + ".json");
+    printCacheStats(sceneWithCam);
+    rtcReleaseScene(sceneWithCam->scene);
+    rtcReleaseDevice(sceneWithCam->device);
+    return 0;
+  }
+
+  if (benchDenoise)
+  {
+    benchmarkDenoise(sceneWithCam, NX, NY, 64, 1024, "output/bench_denoise_" + base + ".json");
+    printCacheStats(sceneWithCam);
+    rtcReleaseScene(sceneWithCam->scene);
+    rtcReleaseDevice(sceneWithCam->device);
+    return 0;
+  }
+
+  if (benchGuiding)
+  {
+    // Paths of at least a few bounces, so there is indirect light to guide
+    benchmarkGuiding(sceneWithCam, NX, NY, std::max(maxDepth, 5), 10000, 1024, "output/bench_guiding_" + base + ".json");
+    printCacheStats(sceneWithCam);
+    rtcReleaseScene(sceneWithCam->scene);
+    rtcReleaseDevice(sceneWithCam->device);
+    return 0;
+  }
+
+  if (benchWavefront)
+  {
+    benchmarkWavefront(sceneWithCam, NX, NY, std::max(maxDepth, 4), 16, "output/bench_wavefront_" + base + ".json");
+    printCacheStats(sceneWithCam);
+    rtcReleaseScene(sceneWithCam->scene);
+    rtcReleaseDevice(sceneWithCam->device);
+    return 0;
+  }
+
+  if (benchLocality)
+  {
+    benchmarkLocality(sceneWithCam, NX, NY, std::max(maxDepth, 4), 16, "output/bench_locality_" + base + ".json");
+    printCacheStats(sceneWithCam);
+    rtcReleaseScene(sceneWithCam->scene);
+    rtcReleaseDevice(sceneWithCam->device);
+    return 0;
+  }
+
+  if (benchNuma)
+  {
+    benchmarkNuma(sceneWithCam, NX, NY, std::max(maxDepth, 4), 16, "output/bench_numa_" + base + ".json");
+    printCacheStats(sceneWithCam);
+    rtcReleaseScene(sceneWithCam->scene);
+    rtcReleaseDevice(sceneWithCam->device);
+    return 0;
+  }
+
+  if (benchAlloc)
+  {
+    // Fails (exit status 1) if the warmed-up render loop allocates, so it can run as a check
+    long long allocations = benchmarkAllocations(sceneWithCam, NX, NY, std::max(maxDepth, 4), 8, "output/bench_alloc_" + base + ".json");
+    rtcReleaseScene(sceneWithCam->scene);
+    rtcReleaseDevice(sceneWithCam->device);
+    return allocations == 0 ? 0 : 1;
+  }
+
   nanogui::init();
-  nanogui::ref<MyGUI> app = new MyGUI(base, NX, NY, sceneWithCam);
+  nanogui::ref<MyGUI> app = new MyGUI(base, NX, NY, sceneWithCam, filter);
+  app->resolution.targetMs = targetMs;
+  app->aovs = aovs;
+  app->setResampling(resample);
+  app->setPathTracing(maxDepth, guiding);
+  app->setCaustics(photons, gatherCount, gatherRadius);
+  app->setWavefront(wavefront, sortRays);
+  app->setTileOrder(tileOrder);
+  if (numa)
+    app->setNuma(true, pin);
   nanogui::mainloop(16);
+  printCacheStats(sceneWithCam);
 
   rtcReleaseScene(sceneWithCam->scene);
   rtcReleaseDevice(sceneWithCam->device);
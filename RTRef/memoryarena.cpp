@@ -0,0 +1,60 @@
+#include <memoryarena.h>
+#include <algorithm>
+#include <stdint.h>
+
+MemoryArena::MemoryArena(size_t blockSize) : blockSize(blockSize)
+{
+  blocks.reserve(8);
+  addBlock(blockSize);
+}
+
+void MemoryArena::addBlock(size_t size)
+{
+  Block block;
+  block.data.reset(new char[size]);
+  block.size = size;
+  blocks.push_back(std::move(block));
+  allocations++;
+}
+
+void *MemoryArena::allocateBytes(size_t bytes, size_t alignment)
+{
+  while (true)
+  {
+    Block &block = blocks[current];
+    uintptr_t base = reinterpret_cast<uintptr_t>(block.data.get());
+    size_t start = ((base + offset + alignment - 1) & ~uintptr_t(alignment - 1)) - base;
+    if (start + bytes <= block.size)
+    {
+      offset = start + bytes;
+      return block.data.get() + start;
+    }
+
+    // On to the next block, kept from an earlier Scope or new: twice the last, so that
+    // a tile overflows into few blocks
+    current++;
+    offset = 0;
+    if (current == blocks.size())
+      addBlock(std::max(2 * blocks.back().size, bytes + alignment));
+  }
+}
+
+void MemoryArena::reset()
+{
+  if (blocks.size() > 1)
+  {
+    size_t total = capacity();
+    blocks.clear();
+    addBlock(total);
+  }
+  current = 0;
+  offset = 0;
+}
+
+size_t MemoryArena::capacity() const
+{
+  size_t total = 0;
+  for (const Block &block : blocks)
+    total += block.size;
+  return total;
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <memory>
+#include <new>
+#include <stddef.h>
+#include <type_traits>
+#include <vector>
+
+// Bump allocator for memory that lives no longer than a tile: allocating moves an
+// offset through a block, and reset() takes everything back at once.  A Scope takes
+// back what was allocated within it, e.g. per sample, so a tile needs no more than its
+// largest sample.  When a block runs out the next one is taken from the heap; the next
+// reset() replaces them all with one block as large as their total, so after the first
+// few tiles an arena no longer touches the heap.  One per thread; not thread-safe.
+class MemoryArena
+{
+public:
+  explicit MemoryArena(size_t blockSize = 64 * 1024);
+
+  MemoryArena(const MemoryArena &) = delete;
+  MemoryArena &operator=(const MemoryArena &) = delete;
+  MemoryArena(MemoryArena &&) = default;
+  MemoryArena &operator=(MemoryArena &&) = default;
+
+  /// Room for n default-constructed objects of type T, valid until the arena is reset
+  /// or the enclosing Scope ends.  Nothing is destroyed, so T must not need to be.
+  template <typename T>
+  T *allocate(size_t n = 1)
+  {
+    static_assert(std::is_trivially_destructible<T>::value, "arena objects are never destroyed");
+    T *p = static_cast<T *>(allocateBytes(n * sizeof(T), alignof(T)));
+    for (size_t i = 0; i < n; i++)
+      new (p + i) T();
+    return p;
+  }
+
+  void *allocateBytes(size_t bytes, size_t alignment);
+
+  /// Free everything allocated, merging the blocks into one if there are several
+  void reset();
+
+  /// Takes back, when it ends, everything allocated from the arena since it began
+  class Scope
+  {
+  public:
+    explicit Scope(MemoryArena &arena) : arena(arena), block(arena.current), offset(arena.offset) {}
+    ~Scope()
+    {
+      arena.current = block;
+      arena.offset = offset;
+    }
+
+  private:
+    MemoryArena &arena;
+    size_t block, offset;
+  };
+
+  /// Blocks taken from the heap since construction
+  size_t heapAllocations() const { return allocations; }
+  /// Bytes held in blocks
+  size_t capacity() const;
+
+private:
+  struct Block
+  {
+    std::unique_ptr<char[]> data;
+    size_t size;
+  };
+  std::vector<Block> blocks;
+  // Block being allocated from, and the offset of its free space
+  size_t current = 0, offset = 0;
+  size_t blockSize;
+  size_t allocations = 0;
+
+  void addBlock(size_t size);
+};
@@ -0,0 +1,176 @@
+#include <numapool.h>
+#include <tbb/task_group.h>
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <thread>
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+std::vector<int> parseCpuList(const std::string &list)
+{
+  std::vector<int> cpus;
+  std::stringstream ss(list);
+  std::string range;
+  while (std::getline(ss, range, ','))
+  {
+    int first, last;
+    int n = sscanf(range.c_str(), "%d-%d", &first, &last);
+    if (n < 1)
+      continue;
+    if (n < 2)
+      last = first;
+    for (int c = first; c <= last; c++)
+      cpus.push_back(c);
+  }
+  return cpus;
+}
+
+NumaTopology NumaTopology::detect()
+{
+  NumaTopology topology;
+  unsigned count = std::max(std::thread::hardware_concurrency(), 1u);
+
+#ifdef __linux__
+  // Only the CPUs this process is allowed on, e.g. under taskset or a container
+  cpu_set_t allowed;
+  CPU_ZERO(&allowed);
+  bool restricted = sched_getaffinity(0, sizeof(allowed), &allowed) == 0;
+
+  for (int node = 0;; node++)
+  {
+    char path[64];
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+    std::ifstream in(path);
+    if (!in)
+      break;
+    std::string list;
+    std::getline(in, list);
+
+    std::vector<int> cpus;
+    for (int c : parseCpuList(list))
+      if (!restricted || (c < CPU_SETSIZE && CPU_ISSET(c, &allowed)))
+        cpus.push_back(c);
+    if (!cpus.empty())
+      topology.nodeCpus.push_back(cpus);
+  }
+
+  if (topology.nodeCpus.empty())
+  {
+    std::vector<int> cpus;
+    for (int c = 0; c < CPU_SETSIZE && int(cpus.size()) < (restricted ? CPU_COUNT(&allowed) : int(count)); c++)
+      if (!restricted || CPU_ISSET(c, &allowed))
+        cpus.push_back(c);
+    topology.nodeCpus.push_back(cpus);
+  }
+#else
+  std::vector<int> cpus;
+  for (unsigned c = 0; c < count; c++)
+    cpus.push_back(int(c));
+  topology.nodeCpus.push_back(cpus);
+#endif
+  return topology;
+}
+
+int NumaTopology::cpus() const
+{
+  int total = 0;
+  for (const std::vector<int> &cpus : nodeCpus)
+    total += int(cpus.size());
+  return total;
+}
+
+std::string NumaTopology::describe() const
+{
+  std::stringstream ss;
+  ss << nodes() << (nodes() == 1 ? " node: " : " nodes: ");
+  for (int n = 0; n < nodes(); n++)
+  {
+    const std::vector<int> &cpus = nodeCpus[n];
+    ss << (n ? ", " : "");
+    // Runs of consecutive CPUs as ranges
+    for (size_t i = 0; i < cpus.size();)
+    {
+      size_t j = i;
+      while (j + 1 < cpus.size() && cpus[j + 1] == cpus[j] + 1)
+        j++;
+      ss << (i ? "," : "") << cpus[i];
+      if (j > i)
+        ss << "-" << cpus[j];
+      i = j + 1;
+    }
+  }
+  return ss.str();
+}
+
+NumaPool::Pinner::Pinner(tbb::task_arena &arena, const std::vector<int> &cpus)
+    : tbb::task_scheduler_observer(arena), cpus(cpus)
+{
+#ifdef __linux__
+  CPU_ZERO(&processCpus);
+  if (sched_getaffinity(0, sizeof(processCpus), &processCpus) != 0)
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+      CPU_SET(cpu, &processCpus);
+#endif
+  observe(true);
+}
+
+void NumaPool::Pinner::on_scheduler_entry(bool worker)
+{
+  // The thread that called run() only visits the arenas to wait for them
+  if (!worker)
+    return;
+#ifdef __linux__
+  int slot = tbb::this_task_arena::current_thread_index();
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpus[slot % cpus.size()], &set);
+  pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#endif
+}
+
+void NumaPool::Pinner::on_scheduler_exit(bool worker)
+{
+  if (!worker)
+    return;
+#ifdef __linux__
+  pthread_setaffinity_np(pthread_self(), sizeof(processCpus), &processCpus);
+#endif
+}
+
+NumaPool::NumaPool(const NumaTopology &topology, bool pin) : topo(topology)
+{
+  for (const std::vector<int> &cpus : topo.nodeCpus)
+  {
+    // No slot kept for the calling thread: it only waits, and joins one node at a time
+    arenas.push_back(std::unique_ptr<tbb::task_arena>(new tbb::task_arena(int(cpus.size()), 0)));
+    arenas.back()->initialize();
+    if (pin)
+      pinners.push_back(std::unique_ptr<Pinner>(new Pinner(*arenas.back(), cpus)));
+  }
+}
+
+NumaPool::~NumaPool()
+{
+  for (std::unique_ptr<Pinner> &pinner : pinners)
+    pinner->observe(false);
+}
+
+void NumaPool::run(const std::function<void(int)> &body)
+{
+  std::vector<tbb::task_group> groups(arenas.size());
+  for (int n = 0; n < nodes(); n++)
+  {
+    tbb::task_group &group = groups[n];
+    arenas[n]->execute([&group, &body, n]() { group.run([&body, n]() { body(n); }); });
+  }
+  for (int n = 0; n < nodes(); n++)
+  {
+    tbb::task_group &group = groups[n];
+    arenas[n]->execute([&group]() { group.wait(); });
+  }
+}
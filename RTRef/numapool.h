@@ -0,0 +1,70 @@
+#pragma once
+
+#include <tbb/task_arena.h>
+#include <tbb/task_scheduler_observer.h>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+// The machine's NUMA nodes and the CPUs of each this process may run on
+struct NumaTopology
+{
+  std::vector<std::vector<int>> nodeCpus;
+
+  /// Read the nodes from /sys/devices/system/node on Linux.  Elsewhere, or without
+  /// that directory, all CPUs form one node.
+  static NumaTopology detect();
+
+  int nodes() const { return int(nodeCpus.size()); }
+  int cpus() const;
+
+  /// E.g. "2 nodes: 0-15, 16-31"
+  std::string describe() const;
+};
+
+/// Parse a cpulist such as "0-3,8,10-11"
+std::vector<int> parseCpuList(const std::string &list);
+
+// Thread pool split by NUMA node: one task arena per node, sized to its CPUs.  With
+// pinning, each worker is bound to its node's CPUs (to one CPU per arena slot) as it
+// joins the node's arena, so the tiles given to a node are traced by its cores and the
+// memory they first touch is allocated on it.  Workers come from TBB's global pool and
+// may later work in other arenas, so each gets the process's CPUs back as it leaves
+// the node's arena.  Without pinning the arenas are the same
+// but the scheduler may move their threads anywhere.
+class NumaPool
+{
+public:
+  NumaPool(const NumaTopology &topology, bool pin);
+  ~NumaPool();
+
+  int nodes() const { return int(arenas.size()); }
+  const NumaTopology &topology() const { return topo; }
+
+  /// Run body(node) in every node's arena at once and wait for all of them
+  void run(const std::function<void(int)> &body);
+
+private:
+  class Pinner : public tbb::task_scheduler_observer
+  {
+  public:
+    Pinner(tbb::task_arena &arena, const std::vector<int> &cpus);
+    void on_scheduler_entry(bool worker) override;
+    void on_scheduler_exit(bool worker) override;
+
+  private:
+    std::vector<int> cpus;
+#ifdef __linux__
+    // The process's CPUs, restored when a worker leaves
+    cpu_set_t processCpus;
+#endif
+  };
+
+  NumaTopology topo;
+  std::vector<std::unique_ptr<tbb::task_arena>> arenas;
+  std::vector<std::unique_ptr<Pinner>> pinners;
+};
@@ -0,0 +1,143 @@
+#include <perfcounters.h>
+#include <string.h>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#ifdef __linux__
+static int openCounter(PerfCounters::Event event, bool enabled)
+{
+  perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.disabled = !enabled;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  const uint64_t readMiss = PERF_COUNT_HW_CACHE_OP_READ << 8 | PERF_COUNT_HW_CACHE_RESULT_MISS << 16;
+  switch (event)
+  {
+  case PerfCounters::Cycles:
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = PERF_COUNT_HW_CPU_CYCLES;
+    break;
+  case PerfCounters::Instructions:
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+    break;
+  case PerfCounters::L1DMisses:
+    attr.type = PERF_TYPE_HW_CACHE;
+    attr.config = PERF_COUNT_HW_CACHE_L1D | readMiss;
+    break;
+  default:
+    attr.type = PERF_TYPE_HW_CACHE;
+    attr.config = PERF_COUNT_HW_CACHE_LL | readMiss;
+    break;
+  }
+  // This thread, on whichever CPU it runs
+  return int(syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0));
+}
+#endif
+
+PerfCounters::PerfCounters(tbb::task_arena &arena) : tbb::task_scheduler_observer(arena)
+{
+  // The calling thread only joins the arena while it executes something in it
+  openThread();
+  observe(true);
+}
+
+PerfCounters::~PerfCounters()
+{
+  observe(false);
+#ifdef __linux__
+  for (const ThreadCounters &t : threads)
+    for (int e = 0; e < EventCount; e++)
+      if (t.fd[e] >= 0)
+        close(t.fd[e]);
+#endif
+}
+
+void PerfCounters::on_scheduler_entry(bool)
+{
+  openThread();
+}
+
+void PerfCounters::openThread()
+{
+  bool &done = opened.local();
+  if (done)
+    return;
+  done = true;
+
+  std::lock_guard<std::mutex> lock(mutex);
+  ThreadCounters t;
+  for (int e = 0; e < EventCount; e++)
+  {
+#ifdef __linux__
+    t.fd[e] = openCounter(Event(e), counting);
+#else
+    t.fd[e] = -1;
+#endif
+  }
+  threads.push_back(t);
+}
+
+void PerfCounters::start()
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  counting = true;
+#ifdef __linux__
+  for (const ThreadCounters &t : threads)
+    for (int e = 0; e < EventCount; e++)
+      if (t.fd[e] >= 0)
+      {
+        ioctl(t.fd[e], PERF_EVENT_IOC_RESET, 0);
+        ioctl(t.fd[e], PERF_EVENT_IOC_ENABLE, 0);
+      }
+#endif
+}
+
+void PerfCounters::stop()
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  counting = false;
+#ifdef __linux__
+  for (const ThreadCounters &t : threads)
+    for (int e = 0; e < EventCount; e++)
+      if (t.fd[e] >= 0)
+        ioctl(t.fd[e], PERF_EVENT_IOC_DISABLE, 0);
+#endif
+}
+
+long long PerfCounters::count(Event event) const
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  long long total = 0;
+#ifdef __linux__
+  for (const ThreadCounters &t : threads)
+  {
+    long long value;
+    if (t.fd[event] >= 0 && read(t.fd[event], &value, sizeof(value)) == sizeof(value))
+      total += value;
+  }
+#endif
+  return total;
+}
+
+bool PerfCounters::available() const
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  for (const ThreadCounters &t : threads)
+    for (int e = 0; e < EventCount; e++)
+      if (t.fd[e] >= 0)
+        return true;
+  return false;
+}
+
+const char *PerfCounters::eventName(Event event)
+{
+  static const char *names[EventCount] = {"cycles", "instructions", "l1dReadMisses", "lastLevelReadMisses"};
+  return names[event];
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <tbb/enumerable_thread_specific.h>
+#include <tbb/task_arena.h>
+#include <tbb/task_scheduler_observer.h>
+#include <mutex>
+#include <vector>
+
+// Hardware event counts of the threads working in a task arena, read through Linux's
+// perf_event interface.  Each thread opens its own counters the first time it joins
+// the arena, and start() and stop() switch all of them on and off together, so the
+// counts cover the work done between them on every thread, the caller's included.
+// The cache events are the kernel's generic ones (L1 data and last-level read
+// misses): the levels in between have no generic event.  Elsewhere than Linux, or when
+// the kernel refuses the counters (perf_event_paranoid, or a virtual machine without a
+// PMU), available() is false and the counts stay 0.
+class PerfCounters : public tbb::task_scheduler_observer
+{
+public:
+  enum Event
+  {
+    Cycles,
+    Instructions,
+    L1DMisses,
+    LastLevelMisses,
+    EventCount
+  };
+
+  explicit PerfCounters(tbb::task_arena &arena);
+  ~PerfCounters();
+
+  /// Zero the counts and start counting
+  void start();
+  /// Stop counting; the counts are kept until the next start()
+  void stop();
+
+  /// An event's count summed over the threads
+  long long count(Event event) const;
+  bool available() const;
+
+  static const char *eventName(Event event);
+
+  void on_scheduler_entry(bool worker) override;
+
+private:
+  // Counters of the threads seen so far, one file descriptor per event (-1 if it
+  // could not be opened)
+  struct ThreadCounters
+  {
+    int fd[EventCount];
+  };
+  std::vector<ThreadCounters> threads;
+  mutable std::mutex mutex;
+  bool counting = false;
+
+  tbb::enumerable_thread_specific<bool> opened;
+
+  // Open the calling thread's counters, enabled if counting
+  void openThread();
+};
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <ext/embree/include/embree3/rtcore.h>
+#include <vector>
+
+// A batch of rays and their hits in structure-of-arrays layout, as consumed by
+// rtcIntersectNp.  Keeping one per thread and resizing it only when a batch grows
+// avoids allocating per tile.
+struct RayBuffer
+{
+  unsigned count = 0;
+
+  std::vector<float> org_x, org_y, org_z, tnear;
+  std::vector<float> dir_x, dir_y, dir_z, time;
+  std::vector<float> tfar;
+  std::vector<unsigned> mask, id, flags;
+
+  std::vector<float> Ng_x, Ng_y, Ng_z, u, v;
+  std::vector<unsigned> primID, geomID, instID;
+
+  /// Make room for n rays.  Contents are unspecified until filled.
+  void resize(unsigned n)
+  {
+    count = n;
+    if (org_x.size() >= n)
+      return;
+    for (std::vector<float> *a : {&org_x, &org_y, &org_z, &tnear, &dir_x, &dir_y, &dir_z, &time, &tfar,
+                                  &Ng_x, &Ng_y, &Ng_z, &u, &v})
+      a->resize(n);
+    for (std::vector<unsigned> *a : {&mask, &id, &flags, &primID, &geomID, &instID})
+      a->resize(n);
+  }
+
+  /// Pointers to the arrays in the form rtcIntersectNp expects
+  RTCRayHitNp pointers()
+  {
+    RTCRayHitNp p;
+    p.ray.org_x = org_x.data();
+    p.ray.org_y = org_y.data();
+    p.ray.org_z = org_z.data();
+    p.ray.tnear = tnear.data();
+    p.ray.dir_x = dir_x.data();
+    p.ray.dir_y = dir_y.data();
+    p.ray.dir_z = dir_z.data();
+    p.ray.time = time.data();
+    p.ray.tfar = tfar.data();
+    p.ray.mask = mask.data();
+    p.ray.id = id.data();
+    p.ray.flags = flags.data();
+    p.hit.Ng_x = Ng_x.data();
+    p.hit.Ng_y = Ng_y.data();
+    p.hit.Ng_z = Ng_z.data();
+    p.hit.u = u.data();
+    p.hit.v = v.data();
+    p.hit.primID = primID.data();
+    p.hit.geomID = geomID.data();
+    p.hit.instID[0] = instID.data();
+    return p;
+  }
+};
@@ -0,0 +1,789 @@
+#include <renderer.h>
+#include <timer.h>
+#include <tbb/parallel_for.h>
+#include <algorithm>
+#include <chrono>
+
+Renderer::Renderer(shared_ptr<SceneAndCam> s, int width, int height, int threads)
+    : width(width), height(height), sceneCam(s), film(width, height, Filter(), TileSize),
+      arena(threads < 0 ? int(tbb::task_arena::automatic) : threads)
+{
+  missColor = s->info.backgroundRadiance;
+  radiance.assign(width * height * 3, 0.f);
+  aovFilm.configure(0, width, height, int(s->lights.size()));
+  resampler.configure(s, width, height);
+  wavefront.configure(s);
+
+  RTCBounds bounds;
+  rtcGetSceneBounds(s->scene, &bounds);
+  guide.setBounds(Eigen::Vector3f(bounds.lower_x, bounds.lower_y, bounds.lower_z),
+                  Eigen::Vector3f(bounds.upper_x, bounds.upper_y, bounds.upper_z));
+
+  buildTiles();
+
+  arena.initialize();
+}
+
+void Renderer::renderPass()
+{
+  samples++;
+  aovFilm.samples++;
+
+  if (caustics.photons > 0 && !caustics.built())
+    arena.execute([&]() { caustics.build(sceneCam, seed); });
+
+  if (resampler.enabled)
+  {
+    renderResampledPass();
+  }
+  else if (numaPool)
+  {
+    numaPool->run([&](int node) {
+      tbb::parallel_for(nodeTileStart[node], nodeTileStart[node + 1], [&](size_t t) {
+        renderTile(tiles[t]);
+      });
+    });
+    numaPool->run([&](int node) {
+      tbb::parallel_for(nodeRowStart[node], nodeRowStart[node + 1], [&](int y) {
+        film.resolve(&nodeRadiance[node][3 * size_t(y - nodeRowStart[node]) * width], y, y + 1);
+      });
+    });
+    radianceStale = true;
+  }
+  else
+  {
+    arena.execute([&]() {
+      tbb::parallel_for(size_t(0), tiles.size(), [&](size_t t) {
+        renderTile(tiles[t]);
+      });
+      tbb::parallel_for(0, height, [&](int y) {
+        film.resolve(radiance, y, y + 1);
+      });
+    });
+    radianceStale = false;
+  }
+
+  // The guide only changes between passes, so the threads never see it half-built
+  if (guiding && maxDepth > 1)
+    guide.endPass();
+}
+
+void Renderer::renderResampledPass()
+{
+  tileScratch.resize(tiles.size());
+
+  arena.execute([&]() {
+    tbb::parallel_for(size_t(0), tiles.size(), [&](size_t t) {
+      traceTile(tiles[t], tileScratch[t], true);
+      resampler.gather(tiles[t], tileScratch[t].surfaces.data(), samples - 1, seed);
+    });
+    // Every tile's reservoirs are ready before any pixel looks at its neighbours'
+    tbb::parallel_for(size_t(0), tiles.size(), [&](size_t t) {
+      TileScratch &local = tileScratch[t];
+      resampler.shade(tiles[t], local.colors.data(), aovFilm.enabled(AOV::Lights) ? local.lightColors.data() : nullptr, samples - 1, seed);
+      splatTile(tiles[t], local);
+    });
+    tbb::parallel_for(0, height, [&](int y) {
+      film.resolve(radiance, y, y + 1);
+    });
+  });
+  radianceStale = false;
+
+  resampler.endPass();
+}
+
+const std::vector<float> &Renderer::image() const
+{
+  if (radianceStale)
+  {
+    for (int n = 0; n < int(nodeRadiance.size()); n++)
+      std::copy(nodeRadiance[n].get(), nodeRadiance[n].get() + 3 * size_t(nodeRowStart[n + 1] - nodeRowStart[n]) * width,
+                radiance.begin() + 3 * size_t(nodeRowStart[n]) * width);
+    radianceStale = false;
+  }
+  return radiance;
+}
+
+void Renderer::reset()
+{
+  samples = 0;
+  aovFilm.clear();
+  film.clear();
+  historyLength.clear();
+  historySamples = 0;
+  hitsValid = false;
+  resampler.reset();
+}
+
+void Renderer::traceHits(const RayCamera &cam, std::vector<Eigen::Vector3f> &positions, std::vector<unsigned> &geomIDs)
+{
+  positions.resize(width * height);
+  geomIDs.resize(width * height);
+
+  arena.execute([&]() {
+    tbb::parallel_for(size_t(0), tiles.size(), [&](size_t t) {
+      const Tile &tile = tiles[t];
+      RayBuffer &rays = scratch.local().rays;
+      cam.generateRays(tile.x0, tile.y0, tile.x1, tile.y1, width, height, nullptr, nullptr, rays);
+
+      RTCIntersectContext context;
+      rtcInitIntersectContext(&context);
+      context.flags = RTC_INTERSECT_CONTEXT_FLAG_COHERENT;
+      RTCRayHitNp stream = rays.pointers();
+      rtcIntersectNp(sceneCam->scene, &context, &stream, rays.count);
+
+      int tileWidth = tile.x1 - tile.x0;
+      for (int i = tile.y0; i < tile.y1; i++)
+      {
+        for (int j = tile.x0; j < tile.x1; j++)
+        {
+          int k = (i - tile.y0) * tileWidth + (j - tile.x0);
+          geomIDs[width * i + j] = rays.geomID[k];
+          positions[width * i + j] = Eigen::Vector3f(rays.org_x[k], rays.org_y[k], rays.org_z[k]) +
+                                     rays.tfar[k] * Eigen::Vector3f(rays.dir_x[k], rays.dir_y[k], rays.dir_z[k]);
+        }
+      }
+    });
+  });
+}
+
+void Renderer::reproject(const RayCamera &previous)
+{
+  // Reservoirs are kept per pixel and are not worth reprojecting
+  resampler.reset();
+
+  if (samples == 0)
+  {
+    reset();
+    return;
+  }
+
+  // The previous view's hits are normally left over from the last reprojection
+  if (!hitsValid)
+    traceHits(previous, hitPositions, hitGeomIDs);
+
+  std::vector<Eigen::Vector3f> positions;
+  std::vector<unsigned> geomIDs;
+  traceHits(sceneCam->cam, positions, geomIDs);
+
+  // Cap each pixel's history by the samples it holds: those it kept at the last
+  // reprojection plus those rendered since, not the pass count, which already capped
+  // history would be scaled down by again on every frame of a drag
+  std::vector<float> history = image();
+  std::vector<float> weights(width * height), lengths(width * height);
+  for (int y = 0; y < height; y++)
+    for (int x = 0; x < width; x++)
+    {
+      int p = width * y + x;
+      float length = float(samples - historySamples) + (historyLength.empty() ? 0.f : historyLength[p]);
+      lengths[p] = std::min(length, float(MaxHistory));
+      weights[p] = length > 0 ? film.weight(x, y) * lengths[p] / length : 0.f;
+    }
+  film.clear();
+  historyLength.assign(width * height, 0.f);
+  historySamples = samples;
+
+  // The other AOVs describe the old view and start over; sample counts move with the
+  // history they count
+  std::vector<float> counts;
+  if (aovFilm.enabled(AOV::Samples))
+    counts.swap(aovFilm.plane(AOV::Samples));
+  aovFilm.clear();
+  if (!counts.empty())
+    aovFilm.plane(AOV::Samples).assign(width * height, 0.f);
+
+  Eigen::Vector3f eye = sceneCam->cam.getEye();
+  arena.execute([&]() {
+    tbb::parallel_for(0, height, [&](int y) {
+      for (int x = 0; x < width; x++)
+      {
+        // Misses converge in one sample, so only surfaces are worth carrying over
+        unsigned geomID = geomIDs[width * y + x];
+        const Eigen::Vector3f &p = positions[width * y + x];
+        Eigen::Vector2f screen;
+        if (geomID == RTC_INVALID_GEOMETRY_ID || !previous.project(p, screen))
+          continue;
+
+        int px = int(floorf(screen.x() * width));
+        int py = int(floorf(screen.y() * height));
+        if (px < 0 || py < 0 || px >= width || py >= height)
+          continue;
+
+        // Disocclusion test: the previous view must have seen the same surface there
+        int old = width * py + px;
+        float tolerance = 0.02f * (p - eye).norm();
+        if (hitGeomIDs[old] != geomID || (hitPositions[old] - p).norm() > tolerance)
+          continue;
+
+        film.setPixel(x, y, Eigen::Vector3f(history[3 * old], history[3 * old + 1], history[3 * old + 2]), weights[old]);
+        historyLength[width * y + x] = lengths[old];
+        if (!counts.empty())
+          aovFilm.plane(AOV::Samples)[width * y + x] = std::min(counts[old], float(MaxHistory));
+      }
+    });
+    tbb::parallel_for(0, height, [&](int y) {
+      film.resolve(radiance, y, y + 1);
+    });
+  });
+
+  hitPositions.swap(positions);
+  hitGeomIDs.swap(geomIDs);
+  hitsValid = true;
+}
+
+void Renderer::setAOVs(unsigned mask)
+{
+  if (mask != aovFilm.enabledMask())
+    aovFilm.configure(mask, width, height, int(sceneCam->lights.size()));
+}
+
+void Renderer::setFilter(const Filter &filter)
+{
+  film.setFilter(filter);
+  samples = 0;
+  aovFilm.clear();
+  historyLength.clear();
+  historySamples = 0;
+  hitsValid = false;
+  resampler.reset();
+}
+
+void Renderer::setTileOrder(TileOrder newOrder)
+{
+  order = newOrder;
+  buildTiles();
+}
+
+void Renderer::buildTiles()
+{
+  tiles = makeTiles(width, height, TileSize, order);
+  if (!numaPool)
+    return;
+
+  // Bands of whole tile rows, sized by each node's share of the CPUs
+  const NumaTopology &topology = numaPool->topology();
+  int nodes = topology.nodes();
+  int tileRows = (height + TileSize - 1) / TileSize;
+  nodeRowStart.assign(nodes + 1, height);
+  int cpus = 0;
+  for (int n = 0; n < nodes; n++)
+  {
+    nodeRowStart[n] = std::min(int((long long)tileRows * cpus / topology.cpus()) * TileSize, height);
+    cpus += int(topology.nodeCpus[n].size());
+  }
+
+  // Group the tiles by band, keeping their order within each
+  std::vector<std::vector<Tile>> bands(nodes);
+  for (const Tile &tile : tiles)
+  {
+    int n = int(std::upper_bound(nodeRowStart.begin(), nodeRowStart.begin() + nodes, tile.y0) - nodeRowStart.begin()) - 1;
+    bands[n].push_back(tile);
+  }
+  tiles.clear();
+  nodeTileStart.assign(1, 0);
+  for (const std::vector<Tile> &band : bands)
+  {
+    tiles.insert(tiles.end(), band.begin(), band.end());
+    nodeTileStart.push_back(tiles.size());
+  }
+}
+
+void Renderer::setNuma(bool on, bool pin)
+{
+  // Gather the last pass's bands while they still match the tiles
+  image();
+  numaPool.reset(on ? new NumaPool(NumaTopology::detect(), pin) : nullptr);
+  buildTiles();
+  if (numaPool)
+  {
+    printf("numa: %s, threads %s\n", numaPool->topology().describe().c_str(), pin ? "pinned" : "unpinned");
+    film.reallocate();
+    // Each node's band of the resolved image too, left untouched until its threads
+    // clear it
+    nodeRadiance.clear();
+    for (int n = 0; n < numaPool->nodes(); n++)
+      nodeRadiance.emplace_back(new float[3 * size_t(nodeRowStart[n + 1] - nodeRowStart[n]) * width]);
+    numaPool->run([&](int node) {
+      tbb::parallel_for(nodeRowStart[node], nodeRowStart[node + 1], [&](int y) {
+        film.clearRows(y, y + 1);
+        std::fill_n(&nodeRadiance[node][3 * size_t(y - nodeRowStart[node]) * width], 3 * width, 0.f);
+      });
+    });
+  }
+  else
+    nodeRadiance.clear();
+  reset();
+}
+
+void Renderer::renderTile(const Tile &tile)
+{
+  TileScratch &local = scratch.local();
+  traceTile(tile, local, false);
+  splatTile(tile, local);
+}
+
+void Renderer::traceTile(const Tile &tile, TileScratch &local, bool resample)
+{
+  RayBuffer &rays = local.rays;
+  int tileWidth = tile.x1 - tile.x0;
+
+  // Pick this pass's subpixel position, and lens position if there is a lens, in
+  // every pixel of the tile
+  Sampler sampler;
+  bool lens = sceneCam->cam.hasLens();
+  local.offsets.resize(2 * tileWidth * (tile.y1 - tile.y0));
+  local.lensSamples.resize(lens ? local.offsets.size() : 0);
+  for (int i = tile.y0; i < tile.y1; i++)
+  {
+    for (int j = tile.x0; j < tile.x1; j++)
+    {
+      int k = (i - tile.y0) * tileWidth + (j - tile.x0);
+      sampler.start(j, i, samples - 1, seed);
+      Eigen::Vector2f offset = sampler.pixelOffset();
+      local.offsets[2 * k] = offset.x();
+      local.offsets[2 * k + 1] = offset.y();
+      if (lens)
+      {
+        Eigen::Vector2f lensSample = sampler.next2D();
+        local.lensSamples[2 * k] = lensSample.x();
+        local.lensSamples[2 * k + 1] = lensSample.y();
+      }
+    }
+  }
+
+  // Generate the whole tile's primary rays and trace them as one coherent stream
+  Timer timer;
+  sceneCam->cam.generateRays(tile.x0, tile.y0, tile.x1, tile.y1, width, height, local.offsets.data(),
+                             lens ? local.lensSamples.data() : nullptr, rays);
+  if (wavefront.enabled)
+    wavefront.addTime(Wavefront::Generate, timer.elapsedMs());
+  local.random.seed((uint64_t(samples) << 32) | uint64_t(tile.y0 * width + tile.x0), seed);
+  local.arena.reset();
+
+  traceAndShade(local, resample);
+}
+
+void Renderer::splatTile(const Tile &tile, TileScratch &local)
+{
+  int tileWidth = tile.x1 - tile.x0;
+  local.film.reset(tile, film.filter(), width, height);
+  for (int i = tile.y0; i < tile.y1; i++)
+  {
+    for (int j = tile.x0; j < tile.x1; j++)
+    {
+      int k = (i - tile.y0) * tileWidth + (j - tile.x0);
+      local.film.splat(j + local.offsets[2 * k], i + local.offsets[2 * k + 1], local.colors[k], film.filter());
+    }
+  }
+
+  if (aovFilm.enabledMask())
+    recordAOVs(tile, local);
+
+  film.merge(local.film);
+}
+
+void Renderer::recordAOVs(const Tile &tile, const TileScratch &local)
+{
+  // Each tile owns its pixels, so the planes are updated without locking
+  float t = 1.f / aovFilm.samples;
+  int tileWidth = tile.x1 - tile.x0;
+  int lights = aovFilm.lights;
+  for (int i = tile.y0; i < tile.y1; i++)
+  {
+    for (int j = tile.x0; j < tile.x1; j++)
+    {
+      int k = (i - tile.y0) * tileWidth + (j - tile.x0);
+      int p = width * i + j;
+      const Eigen::Vector3f &albedo = local.albedos[k];
+
+      if (aovFilm.enabled(AOV::Depth))
+      {
+        float &depth = aovFilm.plane(AOV::Depth)[p];
+        depth += (local.depths[k] - depth) * t;
+      }
+      if (aovFilm.enabled(AOV::Normal))
+      {
+        float *normal = &aovFilm.plane(AOV::Normal)[3 * p];
+        for (int c = 0; c < 3; c++)
+          normal[c] += (local.normals[k][c] - normal[c]) * t;
+      }
+      if (aovFilm.enabled(AOV::Albedo))
+      {
+        float *plane = &aovFilm.plane(AOV::Albedo)[3 * p];
+        for (int c = 0; c < 3; c++)
+          plane[c] += (albedo[c] - plane[c]) * t;
+      }
+      if (aovFilm.enabled(AOV::ID) && aovFilm.samples == 1)
+        aovFilm.plane(AOV::ID)[p] = local.ids[k];
+      if (aovFilm.enabled(AOV::Lights))
+      {
+        float *plane = &aovFilm.plane(AOV::Lights)[3 * lights * p];
+        for (int l = 0; l < lights; l++)
+          for (int c = 0; c < 3; c++)
+            plane[3 * l + c] += (local.lightColors[k * lights + l][c] - plane[3 * l + c]) * t;
+      }
+      if (aovFilm.enabled(AOV::Samples))
+        aovFilm.plane(AOV::Samples)[p] += 1;
+      if (aovFilm.enabled(AOV::Time))
+      {
+        float &time = aovFilm.plane(AOV::Time)[p];
+        time += (local.times[k] - time) * t;
+      }
+      if (aovFilm.enabled(AOV::Variance))
+      {
+        Eigen::Vector3f illumination = local.colors[k].cwiseQuotient(albedo.cwiseMax(Eigen::Vector3f::Constant(1e-3f)));
+        float l = 0.2126f * illumination.x() + 0.7152f * illumination.y() + 0.0722f * illumination.z();
+        float *moments = &aovFilm.plane(AOV::Variance)[2 * p];
+        moments[0] += (l - moments[0]) * t;
+        moments[1] += (l * l - moments[1]) * t;
+      }
+    }
+  }
+}
+
+void Renderer::renderPreview(int scale)
+{
+  // A preview replaces whatever had accumulated; refinement starts over afterwards
+  reset();
+
+  int coarseWidth = (width + scale - 1) / scale;
+  int coarseHeight = (height + scale - 1) / scale;
+  int tilesX = (coarseWidth + TileSize - 1) / TileSize;
+  int tilesY = (coarseHeight + TileSize - 1) / TileSize;
+
+  arena.execute([&]() {
+    tbb::parallel_for(0, tilesX * tilesY, [&](int t) {
+      int x0 = (t % tilesX) * TileSize, y0 = (t / tilesX) * TileSize;
+      Tile tile = {x0, y0, std::min(x0 + TileSize, coarseWidth), std::min(y0 + TileSize, coarseHeight)};
+      renderPreviewTile(tile, scale, coarseWidth, coarseHeight);
+    });
+  });
+  radianceStale = false;
+}
+
+void Renderer::renderPreviewTile(const Tile &tile, int scale, int coarseWidth, int coarseHeight)
+{
+  // One ray through the center of each scale x scale block, from the center of the lens
+  TileScratch &local = scratch.local();
+  sceneCam->cam.generateRays(tile.x0, tile.y0, tile.x1, tile.y1, coarseWidth, coarseHeight, nullptr, nullptr, local.rays);
+  local.random.seed(uint64_t(tile.y0 * coarseWidth + tile.x0), seed);
+  local.arena.reset();
+  traceAndShade(local);
+
+  int tileWidth = tile.x1 - tile.x0;
+  for (int i = tile.y0; i < tile.y1; i++)
+  {
+    for (int j = tile.x0; j < tile.x1; j++)
+    {
+      const Eigen::Vector3f &color = local.colors[(i - tile.y0) * tileWidth + (j - tile.x0)];
+      for (int y = i * scale; y < std::min((i + 1) * scale, height); y++)
+      {
+        for (int x = j * scale; x < std::min((j + 1) * scale, width); x++)
+        {
+          float *pixel = &radiance[3 * (width * y + x)];
+          pixel[0] = color.x();
+          pixel[1] = color.y();
+          pixel[2] = color.z();
+        }
+      }
+    }
+  }
+}
+
+void Renderer::traceAndShade(TileScratch &local, bool resample)
+{
+  if (wavefront.enabled && !resample && aovFilm.enabledMask() == 0 && !(guiding && maxDepth > 1))
+  {
+    // Capped like traceIndirect(), so both integrators estimate the same paths
+    wavefront.render(local.rays, local.colors, local.random, local.queues, local.arena, std::min(maxDepth, int(MaxDepth)), missColor, caustics);
+    return;
+  }
+
+  RayBuffer &rays = local.rays;
+  RTCIntersectContext context;
+  rtcInitIntersectContext(&context);
+  context.flags = RTC_INTERSECT_CONTEXT_FLAG_COHERENT;
+  RTCRayHitNp stream = rays.pointers();
+  rtcIntersectNp(sceneCam->scene, &context, &stream, rays.count);
+
+  local.colors.resize(rays.count);
+
+  // First-hit values are only gathered for AOVs that are turned on
+  bool record = aovFilm.enabledMask() != 0;
+  bool perLight = aovFilm.enabled(AOV::Lights);
+  bool timed = aovFilm.enabled(AOV::Time);
+  int lights = int(sceneCam->lights.size());
+  if (record)
+  {
+    local.albedos.resize(rays.count);
+    local.normals.resize(rays.count);
+    local.depths.resize(rays.count);
+    local.ids.resize(rays.count);
+    local.lightColors.assign(perLight ? rays.count * lights : 0, Eigen::Vector3f::Zero());
+    local.times.resize(timed ? rays.count : 0);
+  }
+  if (resample)
+    local.surfaces.resize(rays.count);
+
+  for (unsigned k = 0; k < rays.count; k++)
+  {
+    MemoryArena::Scope scope(local.arena);
+    std::chrono::steady_clock::time_point start;
+    if (timed)
+      start = std::chrono::steady_clock::now();
+
+    Eigen::Vector3f incomingRay(rays.dir_x[k], rays.dir_y[k], rays.dir_z[k]);
+    Eigen::Vector3f color(0, 0, 0);
+    // Misses are recorded as white, facing nowhere, at depth 0
+    Eigen::Vector3f albedo(1, 1, 1), normal(0, 0, 0);
+    float depth = 0;
+
+    if (rays.geomID[k] != RTC_INVALID_GEOMETRY_ID)
+    {
+      Eigen::Vector3f intersection = Eigen::Vector3f(rays.org_x[k], rays.org_y[k], rays.org_z[k]) + rays.tfar[k] * incomingRay;
+      Eigen::Vector3f incomingDir = incomingRay.normalized();
+
+      RTCHit hit;
+      hit.Ng_x = rays.Ng_x[k];
+      hit.Ng_y = rays.Ng_y[k];
+      hit.Ng_z = rays.Ng_z[k];
+      hit.u = rays.u[k];
+      hit.v = rays.v[k];
+      hit.primID = rays.primID[k];
+      hit.geomID = rays.geomID[k];
+      hit.instID[0] = rays.instID[k];
+
+      // Shade with the interpolated vertex normal, turned to the side the ray arrived from
+      Eigen::Vector3f geomNorm(hit.Ng_x, hit.Ng_y, hit.Ng_z);
+      Eigen::Vector3f norm = sceneCam->shadingNormal(hit);
+      if (geomNorm.dot(incomingRay) > 0)
+      {
+        geomNorm = geomNorm * -1;
+      }
+      if (norm.dot(geomNorm) < 0)
+      {
+        norm = norm * -1;
+      }
+      norm.normalize();
+
+      shared_ptr<nori::BSDF> material = sceneCam->materials.at(hit.geomID);
+      color += sceneCam->emitted(hit, incomingRay);
+      color += computeShading(incomingDir, intersection, norm, material, local.random, perLight ? &local.lightColors[k * lights] : nullptr, resample);
+      if (maxDepth > 1)
+        color += traceIndirect(intersection, norm, incomingDir, material, local.random, local.arena);
+      if (caustics.built())
+        color += caustics.gather(intersection, norm, material->diffuseReflectance(), local.arena);
+      if (resample)
+      {
+        ShadingPoint &surface = local.surfaces[k];
+        surface.position = intersection;
+        surface.normal = norm;
+        surface.incomingDir = incomingDir;
+        surface.depth = rays.tfar[k] * incomingRay.norm();
+        surface.material = material.get();
+      }
+      if (record)
+      {
+        albedo = material->diffuseReflectance();
+        normal = norm;
+        depth = rays.tfar[k] * incomingRay.norm();
+      }
+    }
+    else
+    {
+      color += sceneCam->environment ? sceneCam->environment->radiance(incomingRay) : missColor;
+      if (resample)
+        local.surfaces[k] = ShadingPoint();
+    }
+
+    local.colors[k] = color;
+    if (record)
+    {
+      local.albedos[k] = albedo;
+      local.normals[k] = normal;
+      local.depths[k] = depth;
+      local.ids[k] = rays.geomID[k] == RTC_INVALID_GEOMETRY_ID ? -1.f : float(rays.geomID[k]);
+      if (timed)
+        local.times[k] = std::chrono::duration<float, std::micro>(std::chrono::steady_clock::now() - start).count();
+    }
+  }
+}
+
+Eigen::Vector3f Renderer::traceIndirect(Eigen::Vector3f position, Eigen::Vector3f normal, Eigen::Vector3f incomingDir,
+                                        shared_ptr<nori::BSDF> material, PCG32 &random, MemoryArena &arena)
+{
+  // Each bounce's position and direction, with the path throughput up to and including
+  // it and the radiance gathered beyond it, for recording into the guide
+  struct Vertex
+  {
+    Eigen::Vector3f position, direction, throughput, radiance;
+    float pdf;
+  };
+  Vertex *vertices = arena.allocate<Vertex>(std::min(maxDepth, int(MaxDepth)));
+  int count = 0;
+
+  bool guided = guiding && guide.trained();
+  Eigen::Vector3f throughput(1, 1, 1), result(0, 0, 0);
+  RTCIntersectContext context;
+  rtcInitIntersectContext(&context);
+
+  for (int depth = 1; depth < std::min(maxDepth, int(MaxDepth)); depth++)
+  {
+    nori::Frame frame(normal);
+    Eigen::Vector3f wi = frame.toLocal(-incomingDir);
+
+    // One-sample MIS: the direction comes from the guide or the BSDF at random, and is
+    // weighted by the mixture of both densities
+    const DTree *tree = guided ? &guide.sampling(position) : nullptr;
+    float choice = random.nextFloat();
+    Eigen::Vector2f u(random.nextFloat(), random.nextFloat());
+    Eigen::Vector3f dir;
+    if (tree && choice < guideFraction)
+    {
+      dir = tree->sample(u);
+    }
+    else
+    {
+      nori::BSDFQueryRecord sampled(wi);
+      if (material->sample(sampled, u).isZero())
+        break;
+      dir = frame.toWorld(sampled.wo);
+    }
+
+    nori::BSDFQueryRecord query(wi, frame.toLocal(dir));
+    float cosine = nori::Frame::cosTheta(query.wo);
+    if (cosine <= 0)
+      break;
+    float pdf = material->pdf(query);
+    if (tree)
+      pdf = guideFraction * tree->pdf(dir) + (1 - guideFraction) * pdf;
+    if (!(pdf > 0))
+      break;
+    throughput = throughput.cwiseProduct(material->eval(query) * (cosine / pdf));
+
+    Vertex &vertex = vertices[count++];
+    vertex.position = position;
+    vertex.direction = dir;
+    vertex.throughput = throughput;
+    vertex.radiance.setZero();
+    vertex.pdf = pdf;
+
+    RTCRayHit rayhit;
+    rayhit.ray.org_x = position.x();
+    rayhit.ray.org_y = position.y();
+    rayhit.ray.org_z = position.z();
+    rayhit.ray.dir_x = dir.x();
+    rayhit.ray.dir_y = dir.y();
+    rayhit.ray.dir_z = dir.z();
+    rayhit.ray.tnear = .01f;
+    rayhit.ray.tfar = std::numeric_limits<float>::infinity();
+    rayhit.ray.time = 0;
+    rayhit.ray.mask = CameraRays;
+    rayhit.ray.id = 0;
+    rayhit.ray.flags = 0;
+    rayhit.hit.geomID = RTC_INVALID_GEOMETRY_ID;
+    rayhit.hit.instID[0] = RTC_INVALID_GEOMETRY_ID;
+    rtcIntersect1(sceneCam->scene, &context, &rayhit);
+    if (rayhit.hit.geomID == RTC_INVALID_GEOMETRY_ID)
+      break;
+
+    // Orient the shading normal as for the first hit
+    position += rayhit.ray.tfar * dir;
+    incomingDir = dir;
+    Eigen::Vector3f geomNorm(rayhit.hit.Ng_x, rayhit.hit.Ng_y, rayhit.hit.Ng_z);
+    normal = sceneCam->shadingNormal(rayhit.hit);
+    if (geomNorm.dot(dir) > 0)
+      geomNorm = -geomNorm;
+    if (normal.dot(geomNorm) < 0)
+      normal = -normal;
+    normal.normalize();
+    material = sceneCam->materials.at(rayhit.hit.geomID);
+
+    Eigen::Vector3f contribution = throughput.cwiseProduct(computeShading(incomingDir, position, normal, material, random));
+    result += contribution;
+    for (int v = 0; v < count; v++)
+      vertices[v].radiance += contribution;
+
+    // Russian roulette from the fourth vertex on
+    if (depth >= 3)
+    {
+      float survival = std::min(throughput.maxCoeff(), 0.95f);
+      if (random.nextFloat() >= survival)
+        break;
+      throughput /= survival;
+    }
+  }
+
+  // The radiance arriving at each vertex along its direction is what was gathered
+  // beyond it, divided by the throughput up to it
+  if (guiding)
+  {
+    for (int v = 0; v < count; v++)
+    {
+      const Vertex &vertex = vertices[v];
+      Eigen::Vector3f incident = vertex.radiance.cwiseQuotient(vertex.throughput.cwiseMax(Eigen::Vector3f::Constant(1e-6f)));
+      float luminance = 0.2126f * incident.x() + 0.7152f * incident.y() + 0.0722f * incident.z();
+      guide.record(vertex.position, vertex.direction, luminance / vertex.pdf);
+    }
+  }
+
+  return result;
+}
+
+RTCRayHit Renderer::castRay(RTCRay ray, bool shadow)
+{
+  /*
+   * The intersect context can be used to set intersection
+   * filters or flags, and it also contains the instance ID stack
+   * used in multi-level instancing.
+   */
+  struct RTCIntersectContext context;
+  rtcInitIntersectContext(&context);
+
+  /*
+   * The ray hit structure holds both the ray and the hit.
+   * The user must initialize it properly -- see API documentation
+   * for rtcIntersect1() for details.
+   */
+
+  struct RTCRayHit rayhit;
+  rayhit.ray = ray;
+  rayhit.hit.geomID = RTC_INVALID_GEOMETRY_ID;
+  rayhit.hit.instID[0] = RTC_INVALID_GEOMETRY_ID;
+
+  /*
+   * There are multiple variants of rtcIntersect. This one
+   * intersects a single ray with the scene.
+   */
+  if (!shadow)
+  {
+    rtcIntersect1(sceneCam->scene, &context, &rayhit);
+  }
+  else if (shadow)
+  {
+    rtcOccluded1(sceneCam->scene, &context, &rayhit.ray);
+  }
+
+  return rayhit;
+}
+
+Eigen::Vector3f Renderer::computeShading(Eigen::Vector3f incomingDir, Eigen::Vector3f intersection, Eigen::Vector3f normal, shared_ptr<nori::BSDF> material,
+                                         PCG32 &random, Eigen::Vector3f *perLight, bool skipResampled)
+{
+  SceneShadowTest doShadowTest(sceneCam->scene, intersection);
+  Eigen::Vector3f color(0, 0, 0);
+
+  for (int i = 0; i < sceneCam->lights.size(); i++)
+  {
+    if (skipResampled && resampler.resamples(i))
+      continue;
+    BaseLight &light = *sceneCam->lights[i];
+
+    Eigen::Vector3f contribution = light.getContribution(incomingDir, intersection, normal, material, doShadowTest, random);
+    color += contribution;
+    if (perLight)
+      perLight[i] = contribution;
+  }
+
+  return color;
+}
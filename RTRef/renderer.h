@@ -0,0 +1,240 @@
+#pragma once
+
+#include <generator.h>
+#include <film.h>
+#include <aov.h>
+#include <raybuffer.h>
+#include <sampler.h>
+#include <resampler.h>
+#include <guiding.h>
+#include <caustics.h>
+#include <wavefront.h>
+#include <tileorder.h>
+#include <numapool.h>
+#include <memoryarena.h>
+#include <tbb/enumerable_thread_specific.h>
+#include <tbb/task_arena.h>
+#include <vector>
+
+// Per-thread buffers for rendering one tile
+struct TileScratch
+{
+  RayBuffer rays;
+  // Subpixel offset of each ray, as (x, y) pairs
+  std::vector<float> offsets;
+  // Point on the aperture for each ray, as uniform (x, y) pairs
+  std::vector<float> lensSamples;
+  FilmTile film;
+  // Shaded radiance of each ray
+  std::vector<Eigen::Vector3f> colors;
+  // First-hit values of each ray for the AOVs, gathered only while AOVs are enabled:
+  // albedo, shading normal, hit distance, geomID (-1 for misses), each light's
+  // contribution (lights per ray, only for AOV::Lights) and shading time in microseconds
+  // (only for AOV::Time)
+  std::vector<Eigen::Vector3f> albedos, normals;
+  std::vector<float> depths, ids;
+  std::vector<Eigen::Vector3f> lightColors;
+  std::vector<float> times;
+  // Surface hit by each ray, gathered only while lights are resampled
+  std::vector<ShadingPoint> surfaces;
+  // Random numbers for the bounces of the tile's paths, seeded per tile and pass
+  PCG32 random;
+  // Queues for the wavefront integrator
+  WavefrontQueues queues;
+  // Memory for the tile's shading: path vertices and search heaps, taken back after
+  // each sample and reset for each tile
+  MemoryArena arena;
+};
+
+// Renders a SceneAndCam into a Film.  Each call to renderPass() adds one sample per
+// pixel at a stratified subpixel position, splatted through the reconstruction
+// filter.  Tiles are spread over a thread pool that is created once and stays
+// resident for the lifetime of the renderer, so repeated passes and frames do not pay
+// for thread startup.
+class Renderer
+{
+public:
+  static const int TileSize = 32;
+
+  /// @param s The scene to render.
+  /// @param width, height The image resolution in pixels.
+  /// @param threads Size of the thread pool; -1 uses all available cores.
+  Renderer(shared_ptr<SceneAndCam> s, int width, int height, int threads = -1);
+
+  /// Render one more sample per pixel with the scene's current camera.
+  void renderPass();
+
+  /// Render a quick low-resolution frame instead of a sample: one ray per
+  /// scale x scale block of pixels, through the block's center, replicated over the
+  /// block.  Used while the view is changing; discards the accumulated samples.
+  void renderPreview(int scale);
+
+  /// Discard the accumulated samples, e.g. after the camera or scene changed.
+  void reset();
+
+  /// Carry the accumulated image over a camera move instead of discarding it.  The
+  /// first surface seen through each pixel's center is found in the new view and
+  /// projected into the previous one; if the previous view saw the same geometry at
+  /// nearly the same point there, its radiance is kept as history (worth at most
+  /// MaxHistory samples) for new samples to blend with.  Other pixels, where the move
+  /// uncovered something, start over.
+  /// @param previous The camera the accumulated image was rendered with.
+  void reproject(const RayCamera &previous);
+
+  // Most samples' worth of weight kept from the previous view, so that stale history
+  // is soon outweighed by new samples
+  static const int MaxHistory = 32;
+
+  /// Change the reconstruction filter.  Discards the accumulated samples.
+  void setFilter(const Filter &filter);
+
+  /// Change the order the tiles are handed out in (Hilbert by default).  The image is
+  /// the same in any order; only the locality of the threads' work changes.
+  void setTileOrder(TileOrder order);
+  TileOrder tileOrder() const { return order; }
+
+  /// Render the plain passes on one pool of threads per NUMA node, optionally pinned to
+  /// the node's CPUs.  The image is cut into bands of tile rows, one per node in
+  /// proportion to its CPUs; a node's threads take only its band's tiles, and its
+  /// band of the film and of the resolved image is allocated and first touched by them
+  /// so that it lives in the node's memory.  Discards the accumulated samples.  Passes with resampled
+  /// lights, previews and reprojection keep using the single pool.
+  void setNuma(bool on, bool pin = true);
+  bool numa() const { return bool(numaPool); }
+
+  /// The filtered radiance so far, as a flat row-major RGB array with row 0 at the
+  /// bottom, laid out like ImgGUI::img_data.  NUMA-aware passes resolve into per-node
+  /// bands, which are gathered here when the image is asked for.
+  const std::vector<float> &image() const;
+
+  unsigned int sampleCount() const { return samples; }
+
+  /// Record the AOVs in mask (a set of aovBit()s) alongside the beauty image from the
+  /// next pass on.  Changing the set clears the AOV planes.
+  void setAOVs(unsigned mask);
+
+  /// The AOV planes, averaged over the samples since the last reset or camera move
+  const AOVFilm &aovs() const { return aovFilm; }
+
+  int width, height;
+
+  // Seen by primary rays that miss, unless the scene has an environment light
+  Eigen::Vector3f missColor;
+
+  // Selects the sample sequence; renders with different seeds are independent
+  unsigned seed = 0;
+
+  // Resampled direct lighting for the point and area lights, off by default.  Each
+  // pass then shades those lights with one shadow ray per pixel.
+  LightResampler resampler;
+
+  // Vertices per path.  1 shades only the first hit, with direct light; more continue
+  // each path from its hits by sampling the BSDF (or the guide) and add the direct light
+  // at every vertex, with Russian roulette from the fourth on.  Paths that escape, or
+  // reach emissive meshes, add nothing: the ambient and environment lights already
+  // account for the sky, and mesh lights sample the BSDF toward themselves.  Paths stop
+  // at MaxDepth vertices whatever maxDepth asks for.
+  int maxDepth = 1;
+  static const int MaxDepth = 16;
+
+  // Path guiding: learn an SD-tree of the light arriving throughout the scene from the
+  // paths (trained over passes that double in number) and, once the first iteration
+  // is done, draw guideFraction of the bounce directions from it, combined with BSDF
+  // sampling by one-sample MIS.  Only used when maxDepth > 1.
+  bool guiding = false;
+  float guideFraction = 0.5f;
+  SDTree guide;
+
+  // Caustics from a photon map, added at the first hits; off while caustics.photons is
+  // 0.  The map is built before the first pass that needs it and kept until cleared.
+  // Only for maxDepth 1: longer paths reach the glossy surfaces and sample the lights
+  // from there, so the map would count the same light again.
+  CausticMap caustics;
+
+  // Trace each tile's paths bounce by bounce through the stages of a wavefront pipeline
+  // instead of one path at a time, when wavefront.enabled.  Used only for plain beauty
+  // passes: passes with AOVs, resampled lights or path guiding keep the per-path code.
+  Wavefront wavefront;
+
+  RTCRayHit castRay(RTCRay ray, bool shadow);
+
+  /// The thread pool the passes run in, e.g. to observe its threads
+  tbb::task_arena &threadPool() { return arena; }
+
+  /// Direct lighting at a hit, with the lights' samples drawn from random (the tile's
+  /// generator, so no state is shared between threads).  If perLight is given, each
+  /// light's contribution is also written to it, indexed like SceneAndCam::lights.  With
+  /// skipResampled, the lights the resampler handles are left out (and left at zero in
+  /// perLight).
+  Eigen::Vector3f computeShading(Eigen::Vector3f incomingDir, Eigen::Vector3f intersection, Eigen::Vector3f normal, std::shared_ptr<nori::BSDF> material,
+                                 PCG32 &random, Eigen::Vector3f *perLight = nullptr, bool skipResampled = false);
+
+private:
+  shared_ptr<SceneAndCam> sceneCam;
+
+  unsigned int samples = 0;
+
+  Film film;
+  // The film resolved after each pass; when radianceStale, the last pass was resolved
+  // into nodeRadiance instead (each node's band of rows, first touched by its threads)
+  mutable std::vector<float> radiance;
+  mutable bool radianceStale = false;
+  std::vector<std::unique_ptr<float[]>> nodeRadiance;
+  std::vector<Tile> tiles;
+  TileOrder order = TileOrder::Hilbert;
+  AOVFilm aovFilm;
+
+  tbb::task_arena arena;
+
+  // Per-node pools when NUMA-aware, with the range of tiles and of film rows each node
+  // renders and resolves (one entry per node, plus the end)
+  std::unique_ptr<NumaPool> numaPool;
+  std::vector<size_t> nodeTileStart;
+  std::vector<int> nodeRowStart;
+
+  // Build the tiles in the current order, grouped by node when NUMA-aware
+  void buildTiles();
+
+  tbb::enumerable_thread_specific<TileScratch> scratch;
+  // One scratch per tile while resampling, since a tile is finished in a second phase
+  // that may run on another thread
+  std::vector<TileScratch> tileScratch;
+
+  // World position and geomID of the first hit through each pixel center, for the
+  // view the film holds; valid until the next reset()
+  std::vector<Eigen::Vector3f> hitPositions;
+  std::vector<unsigned> hitGeomIDs;
+  bool hitsValid = false;
+
+  // Samples' worth of history each pixel kept at the last reprojection, and the pass
+  // count then; a pixel has since gained samples - historySamples more.  Empty when
+  // nothing was reprojected since the last reset()
+  std::vector<float> historyLength;
+  unsigned int historySamples = 0;
+  // Trace primary rays through pixel centers with cam, recording only the hits
+  void traceHits(const RayCamera &cam, std::vector<Eigen::Vector3f> &positions, std::vector<unsigned> &geomIDs);
+
+  void renderTile(const Tile &tile);
+
+  // Pick the pass's sample positions in the tile and trace and shade its rays into local
+  void traceTile(const Tile &tile, TileScratch &local, bool resample);
+
+  // Splat the tile's shaded rays into the film and record its AOVs
+  void splatTile(const Tile &tile, TileScratch &local);
+
+  // renderPass() with resampled direct lighting
+  void renderResampledPass();
+  void renderPreviewTile(const Tile &tile, int scale, int coarseWidth, int coarseHeight);
+
+  // Average the first-hit values of a rendered tile into the enabled AOV planes
+  void recordAOVs(const Tile &tile, const TileScratch &local);
+
+  // Light reflected at a first hit toward -incomingDir from beyond the first bounce
+  Eigen::Vector3f traceIndirect(Eigen::Vector3f position, Eigen::Vector3f normal, Eigen::Vector3f incomingDir,
+                                shared_ptr<nori::BSDF> material, PCG32 &random, MemoryArena &arena);
+
+  // Trace local.rays as one stream and shade each hit (or miss) into local.colors,
+  // gathering first-hit values for the enabled AOVs alongside.  With resample, the
+  // resampled lights are left out and the surfaces are gathered for the resampler.
+  void traceAndShade(TileScratch &local, bool resample = false);
+};
@@ -0,0 +1,162 @@
+#include <resampler.h>
+#include <lights.h>
+#include <algorithm>
+#include <math.h>
+
+static inline float luminance(const Eigen::Vector3f &c)
+{
+  return 0.2126f * c.x() + 0.7152f * c.y() + 0.0722f * c.z();
+}
+
+// Separate random streams for the two phases, independent of the sample pattern
+static const unsigned CandidateStream = 0x5e5eed01u, ShadeStream = 0x5e5eed02u;
+
+void LightResampler::configure(shared_ptr<SceneAndCam> s, int w, int h)
+{
+  sceneCam = s;
+  width = w;
+  height = h;
+
+  emitters.clear();
+  sampled.assign(s->lights.size(), false);
+  for (int i = 0; i < int(s->lights.size()); i++)
+  {
+    Eigen::Vector3f point;
+    if (s->lights[i]->samplePoint(Eigen::Vector2f(0.5f, 0.5f), point))
+    {
+      emitters.push_back(i);
+      sampled[i] = true;
+    }
+  }
+
+  surfaces.assign(width * height, ShadingPoint());
+  previousSurfaces.assign(width * height, ShadingPoint());
+  reservoirs.assign(width * height, Reservoir());
+  resolved.assign(width * height, Reservoir());
+  history.assign(width * height, Reservoir());
+  historyValid = false;
+}
+
+float LightResampler::target(const ShadingPoint &s, int l, const Eigen::Vector3f &point) const
+{
+  if (l < 0 || !s.material)
+    return 0;
+  return std::max(luminance(sceneCam->lights[l]->evalPoint(point, s.incomingDir, s.position, s.normal, *s.material)), 0.f);
+}
+
+bool LightResampler::similar(const ShadingPoint &a, const ShadingPoint &b)
+{
+  // Within about 25 degrees and 10% in depth
+  return a.material && b.material && a.normal.dot(b.normal) > 0.9f && fabsf(a.depth - b.depth) < 0.1f * a.depth;
+}
+
+bool LightResampler::visible(const ShadingPoint &s, const Eigen::Vector3f &point) const
+{
+  return SceneShadowTest(sceneCam->scene, s.position)(point, std::numeric_limits<float>::infinity());
+}
+
+void LightResampler::gather(const Tile &tile, const ShadingPoint *tileSurfaces, unsigned sampleIndex, unsigned seed)
+{
+  int tileWidth = tile.x1 - tile.x0;
+  int lights = int(emitters.size());
+  Sampler random;
+  for (int i = tile.y0; i < tile.y1; i++)
+  {
+    for (int j = tile.x0; j < tile.x1; j++)
+    {
+      int p = width * i + j;
+      const ShadingPoint &s = tileSurfaces[(i - tile.y0) * tileWidth + (j - tile.x0)];
+      surfaces[p] = s;
+      Reservoir &r = reservoirs[p];
+      r = Reservoir();
+      if (!s.material || lights == 0)
+        continue;
+
+      // Candidates come from a light picked uniformly, so each one's resampling weight
+      // is its target over 1 / lights (the point's own density is already divided out
+      // by evalPoint)
+      random.start(j, i, sampleIndex, seed ^ CandidateStream);
+      for (int c = 0; c < candidates; c++)
+      {
+        int l = emitters[std::min(int(random.next1D() * lights), lights - 1)];
+        Eigen::Vector3f point;
+        sceneCam->lights[l]->samplePoint(random.next2D(), point);
+        r.update(l, point, target(s, l, point) * lights, random.next1D());
+      }
+      r.finish(target(s, r.light, r.point));
+
+      if (temporal && historyValid && similar(s, previousSurfaces[p]))
+      {
+        Reservoir previous = history[p];
+        previous.count = std::min(previous.count, float(maxHistory * candidates));
+
+        Reservoir combined;
+        combined.merge(r, target(s, r.light, r.point), random.next1D());
+        combined.merge(previous, target(s, previous.light, previous.point), random.next1D());
+        combined.finish(target(s, combined.light, combined.point));
+        r = combined;
+      }
+    }
+  }
+}
+
+void LightResampler::shade(const Tile &tile, Eigen::Vector3f *colors, Eigen::Vector3f *perLight, unsigned sampleIndex, unsigned seed)
+{
+  int tileWidth = tile.x1 - tile.x0;
+  int lights = int(sceneCam->lights.size());
+  Sampler random;
+  for (int i = tile.y0; i < tile.y1; i++)
+  {
+    for (int j = tile.x0; j < tile.x1; j++)
+    {
+      int p = width * i + j;
+      int k = (i - tile.y0) * tileWidth + (j - tile.x0);
+      const ShadingPoint &s = surfaces[p];
+      Reservoir &r = resolved[p];
+      r = Reservoir();
+      if (!s.material)
+        continue;
+
+      random.start(j, i, sampleIndex, seed ^ ShadeStream);
+      const Reservoir &own = reservoirs[p];
+      r.merge(own, target(s, own.light, own.point), random.next1D());
+      for (int n = 0; n < neighbors; n++)
+      {
+        // Uniform in a disc of the given radius
+        Eigen::Vector2f u = random.next2D();
+        float distance = radius * sqrtf(u.x()), angle = 2 * M_PI * u.y();
+        int x = j + int(roundf(distance * cosf(angle))), y = i + int(roundf(distance * sinf(angle)));
+        if (x < 0 || x >= width || y < 0 || y >= height || (x == j && y == i))
+          continue;
+
+        int q = width * y + x;
+        if (!similar(s, surfaces[q]))
+          continue;
+        const Reservoir &other = reservoirs[q];
+        r.merge(other, target(s, other.light, other.point), random.next1D());
+      }
+      r.finish(target(s, r.light, r.point));
+      if (r.light < 0 || r.weight <= 0)
+        continue;
+
+      // An occluded sample contributes nothing, now or as history
+      if (!visible(s, r.point))
+      {
+        r.weight = 0;
+        continue;
+      }
+
+      Eigen::Vector3f contribution = r.weight * sceneCam->lights[r.light]->evalPoint(r.point, s.incomingDir, s.position, s.normal, *s.material);
+      colors[k] += contribution;
+      if (perLight)
+        perLight[k * lights + r.light] += contribution;
+    }
+  }
+}
+
+void LightResampler::endPass()
+{
+  std::swap(history, resolved);
+  std::swap(previousSurfaces, surfaces);
+  historyValid = true;
+}
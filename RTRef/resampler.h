@@ -0,0 +1,132 @@
+#pragma once
+
+#include <generator.h>
+#include <film.h>
+#include <sampler.h>
+#include <vector>
+
+// The surface seen through a pixel in the current pass
+struct ShadingPoint
+{
+  Eigen::Vector3f position, normal, incomingDir;
+  // Distance from the camera, for judging whether neighbours see the same surface
+  float depth = 0;
+  // Null where the ray missed the scene
+  const nori::BSDF *material = nullptr;
+};
+
+// Weighted reservoir holding one light sample out of a stream of candidates
+struct Reservoir
+{
+  // Index into SceneAndCam::lights, or -1 while empty
+  int light = -1;
+  Eigen::Vector3f point;
+  // Sum of the candidates' resampling weights
+  float weightSum = 0;
+  // Candidates seen, including those merged from other reservoirs
+  float count = 0;
+  // Unbiased contribution weight of the kept sample: weightSum / (count * target)
+  float weight = 0;
+
+  /// Offer a candidate with resampling weight w; u is uniform in [0, 1)
+  void update(int l, const Eigen::Vector3f &p, float w, float u)
+  {
+    weightSum += w;
+    count += 1;
+    if (u * weightSum < w)
+    {
+      light = l;
+      point = p;
+    }
+  }
+
+  /// Offer another reservoir's sample, whose target function here is target
+  void merge(const Reservoir &other, float target, float u)
+  {
+    float w = target * other.weight * other.count;
+    weightSum += w;
+    count += other.count;
+    if (u * weightSum < w)
+    {
+      light = other.light;
+      point = other.point;
+    }
+  }
+
+  /// Set weight once the stream is done; target is the kept sample's target function
+  void finish(float target) { weight = target > 0 ? weightSum / (count * target) : 0; }
+};
+
+// Resampled direct lighting (ReSTIR, Bitterli et al. 2020).  Each pixel streams a
+// number of cheap light candidates (a light picked uniformly, a point picked on it)
+// through a reservoir that keeps one in proportion to its unshadowed contribution,
+// merges in its own reservoir from the previous pass (temporal reuse) and those of a
+// few nearby pixels (spatial reuse), and traces one shadow ray to the sample that
+// survives.  Each pixel so draws on thousands of candidates per pass for the price of
+// one shadow ray.  Reservoirs are combined with the simple 1/M weights, which are
+// slightly biased where neighbours see different occluders; neighbours whose surface
+// differs too much are skipped to keep that small.
+//
+// A pass runs in two phases over the whole image: gather() for every tile, then
+// shade(), since spatial reuse reads reservoirs from neighbouring tiles.  Lights that
+// cannot sample points (ambient) are left to the regular per-light shading.
+class LightResampler
+{
+public:
+  bool enabled = false;
+  // Candidates streamed per pixel per pass
+  int candidates = 32;
+  // Merge each pixel's reservoir from the previous pass; the history is dropped
+  // whenever reset() is called
+  bool temporal = true;
+  // The history's candidate count is clamped to this many times candidates, so that
+  // it does not drown out new samples
+  int maxHistory = 20;
+  // Neighbouring reservoirs merged per pixel, picked within radius pixels
+  int neighbors = 5;
+  float radius = 30;
+
+  /// @param s The scene whose lights are resampled.
+  void configure(shared_ptr<SceneAndCam> s, int width, int height);
+
+  /// Whether light i is shaded here rather than by the per-light loop
+  bool resamples(int i) const { return enabled && sampled[i]; }
+
+  /// Forget the previous pass, e.g. after the camera moved
+  void reset() { historyValid = false; }
+
+  /// First phase: stream this pass's candidates for the tile's pixels (surfaces in
+  /// row-major tile order) and merge in the previous pass
+  void gather(const Tile &tile, const ShadingPoint *surfaces, unsigned sampleIndex, unsigned seed);
+
+  /// Second phase: merge neighbouring reservoirs, trace each pixel's shadow ray and
+  /// add its contribution to colors (tile order).  If perLight is given (lights
+  /// entries per pixel), the contribution is also added to the chosen light's entry.
+  void shade(const Tile &tile, Eigen::Vector3f *colors, Eigen::Vector3f *perLight, unsigned sampleIndex, unsigned seed);
+
+  /// Keep this pass's reservoirs as the next pass's history
+  void endPass();
+
+private:
+  shared_ptr<SceneAndCam> sceneCam;
+  int width = 0, height = 0;
+  // Indices of the lights that can sample points, and a flag per light
+  std::vector<int> emitters;
+  std::vector<bool> sampled;
+
+  // Surfaces of this pass and the previous one
+  std::vector<ShadingPoint> surfaces, previousSurfaces;
+  // Reservoirs after temporal reuse (read by neighbours), after spatial reuse, and from
+  // the previous pass
+  std::vector<Reservoir> reservoirs, resolved, history;
+  bool historyValid = false;
+
+  // Luminance of light l's unshadowed contribution through point at surface s
+  float target(const ShadingPoint &s, int l, const Eigen::Vector3f &point) const;
+
+  // Whether reservoirs from surface b may be reused at surface a
+  static bool similar(const ShadingPoint &a, const ShadingPoint &b);
+
+  // Whether point on a light is visible from the shading point s
+  bool visible(const ShadingPoint &s, const Eigen::Vector3f &point) const;
+};
@@ -0,0 +1,119 @@
+#pragma once
+
+#include <Eigen/Core>
+#include <algorithm>
+#include <stdint.h>
+
+// PCG32 random number generator (O'Neill, pcg-random.org): 64 bits of state, a
+// selectable stream, and good statistical quality for the cost of a multiply-add.
+class PCG32
+{
+public:
+  PCG32(uint64_t initState = 0x853c49e6748fea9bULL, uint64_t initSeq = 0xda3e39cb94b95bdbULL)
+  {
+    seed(initState, initSeq);
+  }
+
+  void seed(uint64_t initState, uint64_t initSeq)
+  {
+    state = 0;
+    inc = (initSeq << 1) | 1;
+    nextUInt();
+    state += initState;
+    nextUInt();
+  }
+
+  uint32_t nextUInt()
+  {
+    uint64_t old = state;
+    state = old * 0x5851f42d4c957f2dULL + inc;
+    uint32_t xorshifted = uint32_t(((old >> 18) ^ old) >> 27);
+    uint32_t rot = uint32_t(old >> 59);
+    return (xorshifted >> rot) | (xorshifted << ((~rot + 1) & 31));
+  }
+
+  /// Uniform in [0, 1)
+  float nextFloat() { return toUnitFloat(nextUInt()); }
+
+  static float toUnitFloat(uint32_t bits)
+  {
+    return std::min(bits * 2.3283064365386963e-10f, 0.99999994f);
+  }
+
+private:
+  uint64_t state, inc;
+};
+
+// Per-pixel sample generator.  The subpixel position of sample i comes from the
+// first two dimensions of the Sobol (0,2)-sequence, scrambled with a random XOR per
+// pixel: any power-of-two run of samples is stratified within the pixel, the sequence
+// can be extended one sample at a time as a progressive render accumulates, and
+// neighbouring pixels do not share a pattern.  Other dimensions are drawn from a PCG32
+// stream seeded by pixel and sample index, so results do not depend on which thread
+// renders a tile.
+class Sampler
+{
+public:
+  /// Prepare to draw the values for sample sampleIndex of pixel (x, y).  Different
+  /// seeds give independent sequences.
+  void start(int x, int y, unsigned sampleIndex, unsigned seed = 0)
+  {
+    uint64_t pixel = ((uint64_t(uint32_t(y)) << 32) | uint32_t(x)) ^ (uint64_t(seed) * 0x2545f4914f6cdd1dULL);
+    PCG32 scramble(mix(pixel), 0);
+    scrambleX = scramble.nextUInt();
+    scrambleY = scramble.nextUInt();
+    index = sampleIndex;
+    rng.seed(mix(pixel ^ (uint64_t(sampleIndex) * 0x9e3779b97f4a7c15ULL)), pixel);
+  }
+
+  /// Position of the current sample within its pixel, in [0, 1)^2
+  Eigen::Vector2f pixelOffset() const
+  {
+    return Eigen::Vector2f(PCG32::toUnitFloat(reverseBits(index) ^ scrambleX),
+                           PCG32::toUnitFloat(sobol2(index) ^ scrambleY));
+  }
+
+  float next1D() { return rng.nextFloat(); }
+
+  Eigen::Vector2f next2D()
+  {
+    float x = rng.nextFloat();
+    return Eigen::Vector2f(x, rng.nextFloat());
+  }
+
+private:
+  unsigned index = 0;
+  uint32_t scrambleX = 0, scrambleY = 0;
+  PCG32 rng;
+
+  // Van der Corput sequence in base 2: the first Sobol dimension
+  static uint32_t reverseBits(uint32_t v)
+  {
+    v = ((v >> 1) & 0x55555555u) | ((v & 0x55555555u) << 1);
+    v = ((v >> 2) & 0x33333333u) | ((v & 0x33333333u) << 2);
+    v = ((v >> 4) & 0x0f0f0f0fu) | ((v & 0x0f0f0f0fu) << 4);
+    v = ((v >> 8) & 0x00ff00ffu) | ((v & 0x00ff00ffu) << 8);
+    return (v >> 16) | (v << 16);
+  }
+
+  // Second Sobol dimension
+  static uint32_t sobol2(uint32_t i)
+  {
+    uint32_t r = 0;
+    for (uint32_t v = 1u << 31; i; i >>= 1, v ^= v >> 1)
+      if (i & 1)
+        r ^= v;
+    return r;
+  }
+
+  // 64-bit finalizer from MurmurHash3, to decorrelate neighbouring seeds
+  static uint64_t mix(uint64_t h)
+  {
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+  }
+};
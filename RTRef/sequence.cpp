@@ -0,0 +1,312 @@
+#include <sequence.h>
+#include <imageio.h>
+#include <timer.h>
+#include <RTUtil/json.hpp>
+
+#include <algorithm>
+#include <fstream>
+#include <future>
+#include <iomanip>
+#include <sstream>
+
+using json = nlohmann::json;
+
+static Eigen::Vector3f toVector3f(const json &j)
+{
+  return Eigen::Vector3f(j.at(0).get<float>(), j.at(1).get<float>(), j.at(2).get<float>());
+}
+
+bool Sequence::load(const std::string &path, Sequence &seq)
+{
+  json j;
+  try
+  {
+    std::ifstream in(path);
+    if (in.fail())
+    {
+      std::cerr << "Unable to open sequence file " << path << std::endl;
+      return false;
+    }
+    in >> j;
+
+    if (j.find("frames") != j.end())
+      seq.frames = j["frames"];
+    if (j.find("samples") != j.end())
+      seq.samples = j["samples"];
+    if (j.find("height") != j.end())
+      seq.height = j["height"];
+    if (j.find("turntable") != j.end())
+      seq.turntable = j["turntable"];
+    if (j.find("pipeline") != j.end())
+      seq.pipeline = j["pipeline"];
+    if (j.find("denoise") != j.end())
+      seq.denoise = j["denoise"];
+    if (j.find("resample") != j.end())
+      seq.resample = j["resample"];
+    if (j.find("depth") != j.end())
+      seq.maxDepth = std::max(int(j["depth"]), 1);
+    if (j.find("guide") != j.end())
+      seq.guiding = j["guide"];
+    if (j.find("caustics") != j.end())
+    {
+      const json &caustics = j["caustics"];
+      seq.photons = caustics.value("photons", 200000);
+      seq.gatherCount = caustics.value("gather", 50);
+      seq.gatherRadius = caustics.value("radius", 0.f);
+    }
+    if (j.find("aovs") != j.end() && !AOVFilm::parse(j["aovs"].get<std::string>(), seq.aovs))
+      return false;
+    if (j.find("filter") != j.end() && !Filter::parse(j["filter"].get<std::string>(), seq.filter))
+    {
+      std::cerr << "Unknown filter " << j["filter"] << " in sequence file" << std::endl;
+      return false;
+    }
+
+    if (j.find("lens") != j.end())
+    {
+      const json &lens = j["lens"];
+      seq.aperture = lens.value("aperture", 0.f);
+      seq.focus = lens.value("focus", 1.f);
+      seq.blades = lens.value("blades", 0);
+      seq.bladeRotation = lens.value("rotation", 0.f) * M_PI / 180;
+    }
+
+    for (const json &k : j.value("camera", json::array()))
+    {
+      CameraKey key;
+      key.frame = k.value("frame", 0.f);
+      key.eye = toVector3f(k.at("eye"));
+      key.target = toVector3f(k.at("target"));
+      key.up = k.find("up") != k.end() ? toVector3f(k["up"]) : Eigen::Vector3f(0, 1, 0);
+      seq.camera.push_back(key);
+    }
+
+    json nodes = j.value("nodes", json::object());
+    for (json::const_iterator n = nodes.begin(); n != nodes.end(); ++n)
+    {
+      std::vector<NodeKey> &track = seq.nodes[n.key()];
+      for (const json &k : n.value())
+      {
+        NodeKey key;
+        key.frame = k.value("frame", 0.f);
+        key.translate = k.find("translate") != k.end() ? toVector3f(k["translate"]) : Eigen::Vector3f(0, 0, 0);
+        key.axis = Eigen::Vector3f(0, 1, 0);
+        key.angle = 0;
+        if (k.find("rotate") != k.end())
+        {
+          key.axis = toVector3f(k["rotate"]).normalized();
+          key.angle = k["rotate"].at(3).get<float>() * M_PI / 180;
+        }
+        key.scale = Eigen::Vector3f(1, 1, 1);
+        if (k.find("scale") != k.end())
+          key.scale = k["scale"].is_number() ? Eigen::Vector3f::Constant(k["scale"].get<float>()) : toVector3f(k["scale"]);
+        track.push_back(key);
+      }
+    }
+  }
+  catch (json::exception &e)
+  {
+    std::cerr << "Error parsing sequence file: " << e.what() << std::endl;
+    return false;
+  }
+
+  // The report averages over the frames, and a turntable turns by 1 / frames per frame
+  if (seq.frames < 1)
+  {
+    std::cerr << "Sequence file asks for " << seq.frames << " frames; it needs at least one" << std::endl;
+    return false;
+  }
+
+  if (seq.photons > 0 && seq.maxDepth > 1)
+  {
+    std::cerr << "Sequence file asks for both caustics and depth above 1; paths already carry caustics" << std::endl;
+    return false;
+  }
+
+  // Tracks are interpolated by searching for the keys around a frame, so sort them
+  std::sort(seq.camera.begin(), seq.camera.end(), [](const CameraKey &a, const CameraKey &b) { return a.frame < b.frame; });
+  for (std::map<std::string, std::vector<NodeKey>>::iterator t = seq.nodes.begin(); t != seq.nodes.end(); ++t)
+    std::sort(t->second.begin(), t->second.end(), [](const NodeKey &a, const NodeKey &b) { return a.frame < b.frame; });
+
+  return true;
+}
+
+// Find the pair of keys around frame and the blend weight between them.  Outside the
+// track, both keys are the first or last key.
+template <class Key>
+static void bracket(const std::vector<Key> &track, float frame, int &k0, int &k1, float &t)
+{
+  k1 = 0;
+  while (k1 < track.size() && track[k1].frame <= frame)
+    k1++;
+  k0 = std::max(k1 - 1, 0);
+  k1 = std::min(k1, int(track.size()) - 1);
+  t = track[k1].frame > track[k0].frame ? (frame - track[k0].frame) / (track[k1].frame - track[k0].frame) : 0.f;
+  t = std::min(std::max(t, 0.f), 1.f);
+}
+
+SequenceRenderer::SequenceRenderer(shared_ptr<SceneAndCam> s, const Sequence &seq)
+    : sceneCam(s), seq(seq), renderer(s, int(s->cam.getAspect() * seq.height), seq.height)
+{
+  for (std::map<std::string, std::vector<NodeKey>>::const_iterator t = seq.nodes.begin(); t != seq.nodes.end(); ++t)
+  {
+    std::map<std::string, int>::iterator n = s->nodeIndex.find(t->first);
+    if (n == s->nodeIndex.end())
+    {
+      printf("warning: sequence animates node %s, which is not in the scene\n", t->first.c_str());
+      continue;
+    }
+    baseTransforms[t->first] = s->nodes[n->second].local;
+  }
+  renderer.setFilter(seq.filter);
+  renderer.setAOVs(seq.aovs | (seq.denoise ? Denoiser::Guides : 0));
+  renderer.resampler.enabled = seq.resample;
+  renderer.resampler.temporal = false;
+  renderer.maxDepth = seq.maxDepth;
+  renderer.guiding = seq.guiding;
+  renderer.caustics.photons = seq.photons;
+  renderer.caustics.gatherCount = seq.gatherCount;
+  renderer.caustics.gatherRadius = seq.gatherRadius;
+  if (seq.aperture > 0)
+    s->cam.setLens(seq.aperture, seq.focus, seq.blades, seq.bladeRotation);
+}
+
+void SequenceRenderer::applyCamera(int frame)
+{
+  if (!seq.camera.empty())
+  {
+    int k0, k1;
+    float t;
+    bracket(seq.camera, frame, k0, k1, t);
+    const CameraKey &a = seq.camera[k0];
+    const CameraKey &b = seq.camera[k1];
+    sceneCam->cam.setView(
+        (1 - t) * a.eye + t * b.eye,
+        (1 - t) * a.target + t * b.target,
+        ((1 - t) * a.up + t * b.up).normalized());
+  }
+  else if (seq.turntable != 0 && frame > 0)
+  {
+    sceneCam->cam.orbit(seq.turntable * M_PI / 180 / seq.frames, 0);
+  }
+}
+
+void SequenceRenderer::applyNodes(int frame)
+{
+  for (std::map<std::string, std::vector<NodeKey>>::const_iterator track = seq.nodes.begin(); track != seq.nodes.end(); ++track)
+  {
+    if (baseTransforms.find(track->first) == baseTransforms.end() || track->second.empty())
+      continue;
+
+    int k0, k1;
+    float t;
+    bracket(track->second, frame, k0, k1, t);
+    const NodeKey &a = track->second[k0];
+    const NodeKey &b = track->second[k1];
+
+    Eigen::Quaternionf qa(Eigen::AngleAxisf(a.angle, a.axis));
+    Eigen::Quaternionf qb(Eigen::AngleAxisf(b.angle, b.axis));
+
+    Eigen::Affine3f keyed = Eigen::Affine3f::Identity();
+    keyed.translate((1 - t) * a.translate + t * b.translate);
+    keyed.rotate(qa.slerp(t, qb));
+    keyed.scale((1 - t) * a.scale + t * b.scale);
+
+    sceneCam->setNodeTransform(track->first, keyed * baseTransforms[track->first]);
+  }
+}
+
+void SequenceRenderer::render(const std::string &outputPrefix)
+{
+  json frames = json::array();
+  std::future<double> encoding;
+  int encodingFrame = -1;
+
+  Timer total;
+  for (int frame = 0; frame < seq.frames; frame++)
+  {
+    Timer frameTimer;
+    json stats;
+    stats["frame"] = frame;
+
+    // Move the camera and nodes; only the animated geometry is refit
+    Timer timer;
+    applyCamera(frame);
+    if (!baseTransforms.empty())
+    {
+      applyNodes(frame);
+      stats["updateMs"] = sceneCam->commitUpdates();
+      renderer.caustics.clear();
+    }
+
+    timer.reset();
+    renderer.reset();
+    for (int s = 0; s < seq.samples; s++)
+      renderer.renderPass();
+    stats["renderMs"] = timer.elapsedMs();
+
+    // Collect the previous frame's encode before handing over the next one
+    if (encoding.valid())
+      frames[encodingFrame]["encodeMs"] = encoding.get();
+
+    std::stringstream name;
+    name << outputPrefix << std::setw(4) << std::setfill('0') << frame;
+    if (seq.aovs)
+      renderer.aovs().write(name.str() + "_");
+    name << ".png";
+
+    shared_ptr<vector<float>> image = make_shared<vector<float>>(renderer.image());
+    int width = renderer.width, height = renderer.height;
+    if (seq.denoise)
+      stats["denoiseMs"] = denoiser.denoise(*image, renderer.aovs(), width, height, *image);
+    std::string path = name.str();
+    auto encode = [image, width, height, path]() -> double {
+      Timer t;
+      writePNG(path, width, height, image->data());
+      return t.elapsedMs();
+    };
+
+    frames.push_back(stats);
+    if (seq.pipeline)
+    {
+      encoding = std::async(std::launch::async, encode);
+      encodingFrame = frame;
+    }
+    else
+    {
+      frames[frame]["encodeMs"] = encode();
+    }
+
+    frames[frame]["frameMs"] = frameTimer.elapsedMs();
+    printf("frame %d: render %.1f ms, total %.1f ms\n", frame, double(frames[frame]["renderMs"]), double(frames[frame]["frameMs"]));
+  }
+
+  if (encoding.valid())
+    frames[encodingFrame]["encodeMs"] = encoding.get();
+
+  double totalMs = total.elapsedMs();
+  double loadMs = sceneCam->report.totalMs;
+  double amortizedMs = (loadMs + totalMs) / seq.frames;
+
+  printf("%d frames in %.1f ms after a %.1f ms load: %.1f ms per frame amortized (vs. %.1f ms reloading per frame)\n",
+         seq.frames, totalMs, loadMs, amortizedMs, totalMs / seq.frames + loadMs);
+
+  json report;
+  report["scene"] = sceneCam->report.scene;
+  report["width"] = renderer.width;
+  report["height"] = renderer.height;
+  report["samples"] = seq.samples;
+  report["pipeline"] = seq.pipeline;
+  report["denoise"] = seq.denoise;
+  report["resample"] = seq.resample;
+  report["depth"] = seq.maxDepth;
+  report["guide"] = seq.guiding;
+  report["photons"] = seq.photons;
+  report["loadMs"] = loadMs;
+  report["totalMs"] = totalMs;
+  report["amortizedFrameMs"] = amortizedMs;
+  report["frames"] = frames;
+
+  std::ofstream out(outputPrefix + "timings.json");
+  out << report.dump(4) << std::endl;
+}
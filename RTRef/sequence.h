@@ -0,0 +1,117 @@
+#pragma once
+
+#include <renderer.h>
+#include <denoiser.h>
+#include <map>
+#include <string>
+#include <vector>
+
+// One keyframe of the camera track
+struct CameraKey
+{
+  float frame;
+  Eigen::Vector3f eye, target, up;
+};
+
+// One keyframe of a node track.  The keyed transform (scale, then rotate about axis
+// by angle radians, then translate) is applied on top of the node's imported
+// transform, in its parent's coordinates.
+struct NodeKey
+{
+  float frame;
+  Eigen::Vector3f translate;
+  Eigen::Vector3f axis;
+  float angle;
+  Eigen::Vector3f scale;
+};
+
+/**
+ * A keyframed animation, read from a JSON file of the form
+ *
+ *   {
+ *     "frames": 48, "samples": 64, "height": 400, "pipeline": true, "filter": "tent", "denoise": true,
+ *     "aovs": "depth,normal,id",
+ *     "camera": [ {"frame": 0, "eye": [0, 1, 5], "target": [0, 0, 0], "up": [0, 1, 0]}, ... ],
+ *     "turntable": 360,
+ *     "nodes": { "bunny": [ {"frame": 0, "translate": [0, 0, 0], "rotate": [0, 1, 0, 90], "scale": [1, 1, 1]}, ... ] }
+ *   }
+ *
+ * Every field is optional.  Keys are interpolated linearly (rotations spherically) and
+ * held constant outside their range.  "turntable" orbits the scene's own camera by the
+ * given number of degrees over the sequence and is ignored when there are camera keys.
+ * "filter" names the reconstruction filter as accepted by Filter::parse.  "lens" turns
+ * the camera into a thin lens: {"aperture": 0.05, "focus": 4, "blades": 6, "rotation": 0},
+ * with the aperture radius and focus distance in scene units and the blade rotation in
+ * degrees; "blades" and "rotation" are optional.  "denoise" runs each finished frame
+ * through the Denoiser before it is written.  "aovs" lists AOVs (as accepted by
+ * AOVFilm::parse) to write next to each frame as NNNN_<name>.pfm.  "resample" shades
+ * point and area lights with resampled light candidates, reused spatially within each
+ * pass only, since temporal reuse would correlate the passes averaged into a frame.  "depth"
+ * traces paths of that many vertices, and "guide" turns on path guiding, whose
+ * training carries over from frame to frame.  "caustics" adds
+ * photon-mapped caustics, {"photons": 200000, "gather": 50, "radius": 0.05}, with the
+ * map reshot on frames where nodes move; only with a depth of 1, since longer paths
+ * already carry the caustics and the map would add them twice.
+ */
+struct Sequence
+{
+  int frames = 1;
+  int samples = 64;
+  int height = 400;
+  float turntable = 0;
+  // Encode frame N on a background thread while frame N + 1 renders
+  bool pipeline = true;
+  Filter filter;
+  bool denoise = false;
+  // Shade point and area lights with the Renderer's LightResampler
+  bool resample = false;
+  // Path vertices and guiding, as for Renderer::maxDepth and Renderer::guiding
+  int maxDepth = 1;
+  bool guiding = false;
+  // Caustic photon map settings, as for CausticMap; no photons turns it off
+  int photons = 0;
+  int gatherCount = 50;
+  float gatherRadius = 0;
+  // Set of aovBit()s to write with each frame
+  unsigned aovs = 0;
+
+  // Thin lens settings; an aperture of 0 keeps the scene's pinhole camera
+  float aperture = 0;
+  float focus = 1;
+  int blades = 0;
+  float bladeRotation = 0;
+
+  std::vector<CameraKey> camera;
+  std::map<std::string, std::vector<NodeKey>> nodes;
+
+  /// Parse a sequence file.  Returns false (after printing the reason) on error.
+  static bool load(const std::string &path, Sequence &seq);
+};
+
+// Renders the frames of a Sequence back to back.  The device, scene, materials and the
+// renderer's thread pool stay resident across frames, so only the first frame pays for
+// import and BVH build; node animation is applied with a refit.
+class SequenceRenderer
+{
+public:
+  /// The scene must have been loaded with LoadOptions::dynamic if the sequence has node tracks.
+  SequenceRenderer(shared_ptr<SceneAndCam> s, const Sequence &seq);
+
+  /// Render every frame to outputPrefix + NNNN.png, print per-frame and amortized
+  /// timings, and write them to outputPrefix + timings.json.
+  void render(const std::string &outputPrefix);
+
+private:
+  shared_ptr<SceneAndCam> sceneCam;
+  Sequence seq;
+  Renderer renderer;
+  Denoiser denoiser;
+
+  // Imported local transforms of the animated nodes
+  std::map<std::string, Eigen::Affine3f, std::less<std::string>,
+           Eigen::aligned_allocator<std::pair<const std::string, Eigen::Affine3f>>>
+      baseTransforms;
+
+  void applyCamera(int frame);
+  void applyNodes(int frame);
+};
@@ -0,0 +1,115 @@
+#include <tileorder.h>
+#include <algorithm>
+
+bool parseTileOrder(const std::string &name, TileOrder &order)
+{
+  if (name == "rows")
+    order = TileOrder::Rows;
+  else if (name == "morton")
+    order = TileOrder::Morton;
+  else if (name == "hilbert")
+    order = TileOrder::Hilbert;
+  else
+    return false;
+  return true;
+}
+
+const char *tileOrderName(TileOrder order)
+{
+  switch (order)
+  {
+  case TileOrder::Morton:
+    return "morton";
+  case TileOrder::Hilbert:
+    return "hilbert";
+  default:
+    return "rows";
+  }
+}
+
+// Spread the low 16 bits of v to the even bits
+static uint32_t spread2(uint32_t v)
+{
+  v &= 0xffff;
+  v = (v | (v << 8)) & 0x00ff00ff;
+  v = (v | (v << 4)) & 0x0f0f0f0f;
+  v = (v | (v << 2)) & 0x33333333;
+  v = (v | (v << 1)) & 0x55555555;
+  return v;
+}
+
+// Spread the low 10 bits of v to every third bit
+static uint32_t spread3(uint32_t v)
+{
+  v &= 0x3ff;
+  v = (v | (v << 16)) & 0x030000ff;
+  v = (v | (v << 8)) & 0x0300f00f;
+  v = (v | (v << 4)) & 0x030c30c3;
+  v = (v | (v << 2)) & 0x09249249;
+  return v;
+}
+
+uint32_t morton2(uint32_t x, uint32_t y)
+{
+  return spread2(x) | (spread2(y) << 1);
+}
+
+uint32_t morton3(uint32_t x, uint32_t y, uint32_t z)
+{
+  return spread3(x) | (spread3(y) << 1) | (spread3(z) << 2);
+}
+
+uint32_t hilbert2(uint32_t n, uint32_t x, uint32_t y)
+{
+  // Descend from the largest quadrants, rotating each one into the curve's base
+  // orientation (Hilbert curve index as in "Hacker's Delight")
+  uint32_t d = 0;
+  for (uint32_t s = n / 2; s > 0; s /= 2)
+  {
+    uint32_t rx = (x & s) > 0, ry = (y & s) > 0;
+    d += s * s * ((3 * rx) ^ ry);
+    if (ry == 0)
+    {
+      if (rx == 1)
+      {
+        x = s - 1 - x;
+        y = s - 1 - y;
+      }
+      std::swap(x, y);
+    }
+  }
+  return d;
+}
+
+std::vector<Tile> makeTiles(int width, int height, int tileSize, TileOrder order)
+{
+  int tilesX = (width + tileSize - 1) / tileSize, tilesY = (height + tileSize - 1) / tileSize;
+  uint32_t n = 1;
+  while (n < uint32_t(std::max(tilesX, tilesY)))
+    n *= 2;
+
+  std::vector<std::pair<uint32_t, Tile>> keyed;
+  for (int ty = 0; ty < tilesY; ty++)
+  {
+    for (int tx = 0; tx < tilesX; tx++)
+    {
+      int x = tx * tileSize, y = ty * tileSize;
+      Tile tile = {x, y, std::min(x + tileSize, width), std::min(y + tileSize, height)};
+      uint32_t key = ty * tilesX + tx;
+      if (order == TileOrder::Morton)
+        key = morton2(tx, ty);
+      else if (order == TileOrder::Hilbert)
+        key = hilbert2(n, tx, ty);
+      keyed.push_back(std::make_pair(key, tile));
+    }
+  }
+  std::sort(keyed.begin(), keyed.end(), [](const std::pair<uint32_t, Tile> &a, const std::pair<uint32_t, Tile> &b) {
+    return a.first < b.first;
+  });
+
+  std::vector<Tile> tiles;
+  tiles.reserve(keyed.size());
+  for (const std::pair<uint32_t, Tile> &k : keyed)
+    tiles.push_back(k.second);
+  return tiles;
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <film.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// Order in which a pass hands out its tiles.  Threads take contiguous runs of the list,
+// so along a space-filling curve each thread's tiles, and the tiles in flight at once,
+// stay close together on screen and so in the scene, and share more of the BVH and
+// geometry in cache than rows spanning the whole image.
+enum class TileOrder
+{
+  Rows,
+  Morton,
+  Hilbert
+};
+
+/// Parse "rows", "morton" or "hilbert".  Returns false for an unknown name.
+bool parseTileOrder(const std::string &name, TileOrder &order);
+
+const char *tileOrderName(TileOrder order);
+
+/// The tileSize x tileSize tiles covering a width x height image (clipped at its
+/// edges), in the given order
+std::vector<Tile> makeTiles(int width, int height, int tileSize, TileOrder order);
+
+/// Interleave the low 16 bits of x and y, x in the even bits
+uint32_t morton2(uint32_t x, uint32_t y);
+
+/// Interleave the low 10 bits of x, y and z, x in the lowest of each three
+uint32_t morton3(uint32_t x, uint32_t y, uint32_t z);
+
+/// Position of cell (x, y) along the Hilbert curve through an n x n grid, n a power of 2
+uint32_t hilbert2(uint32_t n, uint32_t x, uint32_t y);
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <chrono>
+
+// Wall-clock stopwatch used for the load report and render timings
+class Timer
+{
+    std::chrono::steady_clock::time_point start;
+
+public:
+    Timer() : start(std::chrono::steady_clock::now()) {}
+
+    // Restart the timer from zero
+    void reset() { start = std::chrono::steady_clock::now(); }
+
+    // Milliseconds elapsed since construction or the last reset
+    double elapsedMs() const
+    {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+};
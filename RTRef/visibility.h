@@ -0,0 +1,20 @@
+#pragma once
+
+// Embree ray and geometry masks.  A ray only hits geometry whose mask shares a bit with
+// its own, so each kind of ray carries one bit and each geometry the bits of the rays
+// that should see it, as set by the "visibility" entries of the scene info.
+enum RayVisibility : unsigned
+{
+  // Camera rays, and everything that follows a path through the scene after them:
+  // bounces and photons
+  CameraRays = 1u << 0,
+  // Shadow rays toward lights
+  ShadowRays = 1u << 1,
+  // Ambient occlusion rays
+  AmbientRays = 1u << 2,
+  AllRays = CameraRays | ShadowRays | AmbientRays,
+  // Set on every emissive mesh, whatever its visibility, so that a mesh light's BSDF
+  // samples (ShadowRays | EmitterRays) find it while "shadows": false still keeps it
+  // from blocking other lights
+  EmitterRays = 1u << 3
+};
@@ -0,0 +1,351 @@
+#include <wavefront.h>
+#include <timer.h>
+#include <tileorder.h>
+#include <algorithm>
+#include <map>
+
+void Wavefront::configure(shared_ptr<SceneAndCam> s)
+{
+  sceneCam = s;
+
+  // Geometries sharing a BSDF share a bin
+  materials.clear();
+  materialOf.clear();
+  std::map<const nori::BSDF *, int> index;
+  for (const std::pair<const int, shared_ptr<nori::BSDF>> &m : s->materials)
+  {
+    std::map<const nori::BSDF *, int>::iterator it = index.find(m.second.get());
+    if (it == index.end())
+    {
+      it = index.insert(std::make_pair(m.second.get(), int(materials.size()))).first;
+      materials.push_back(m.second);
+    }
+    if (int(materialOf.size()) <= m.first)
+      materialOf.resize(m.first + 1, 0);
+    materialOf[m.first] = it->second;
+  }
+
+  RTCBounds bounds;
+  rtcGetSceneBounds(s->scene, &bounds);
+  boundsLo = Eigen::Vector3f(bounds.lower_x, bounds.lower_y, bounds.lower_z);
+  boundsSize = (Eigen::Vector3f(bounds.upper_x, bounds.upper_y, bounds.upper_z) - boundsLo).cwiseMax(Eigen::Vector3f::Constant(1e-6f));
+
+  sampled.assign(s->lights.size(), false);
+  for (int i = 0; i < int(s->lights.size()); i++)
+  {
+    Eigen::Vector3f point;
+    sampled[i] = s->lights[i]->samplePoint(Eigen::Vector2f(0.5f, 0.5f), point);
+  }
+  resetTimes();
+}
+
+void Wavefront::addTime(Stage stage, double ms)
+{
+  nanoseconds[stage] += (long long)(ms * 1e6);
+}
+
+void Wavefront::resetTimes()
+{
+  for (int s = 0; s < StageCount; s++)
+    nanoseconds[s] = 0;
+  pathRayCount = 0;
+  shadowRayCount = 0;
+}
+
+const char *Wavefront::stageName(Stage stage)
+{
+  static const char *names[StageCount] = {"generate", "intersect", "sort", "shade", "shadow", "accumulate"};
+  return names[stage];
+}
+
+void Wavefront::printTimes() const
+{
+  double total = 0;
+  for (int s = 0; s < StageCount; s++)
+    total += stageMs(Stage(s));
+  printf("wavefront: %.1f ms over all threads, %lld path rays, %lld shadow rays\n", total, pathRays(), shadowRays());
+  for (int s = 0; s < StageCount; s++)
+    printf("  %-10s %9.1f ms (%4.1f%%)\n", stageName(Stage(s)), stageMs(Stage(s)), total > 0 ? 100 * stageMs(Stage(s)) / total : 0.0);
+}
+
+void Wavefront::render(RayBuffer &cameraRays, std::vector<Eigen::Vector3f> &colors, PCG32 &random, WavefrontQueues &q, MemoryArena &arena,
+                       int maxDepth, const Eigen::Vector3f &missColor, const CausticMap &caustics)
+{
+  Timer timer;
+  unsigned n = cameraRays.count;
+  colors.assign(n, Eigen::Vector3f::Zero());
+  q.path.resize(n);
+  for (unsigned k = 0; k < n; k++)
+    q.path[k] = k;
+  q.throughput.assign(n, Eigen::Vector3f::Ones());
+  addTime(Generate, timer.elapsedMs());
+
+  RayBuffer *rays = &cameraRays;
+  for (int depth = 0; depth < maxDepth && rays->count > 0; depth++)
+  {
+    // Camera rays are coherent already
+    if (sortRays && depth > 0)
+    {
+      timer.reset();
+      sortByKey(q);
+      addTime(Sort, timer.elapsedMs());
+    }
+
+    timer.reset();
+    RTCIntersectContext context;
+    rtcInitIntersectContext(&context);
+    context.flags = depth == 0 ? RTC_INTERSECT_CONTEXT_FLAG_COHERENT : RTC_INTERSECT_CONTEXT_FLAG_INCOHERENT;
+    RTCRayHitNp stream = rays->pointers();
+    rtcIntersectNp(sceneCam->scene, &context, &stream, rays->count);
+    pathRayCount += rays->count;
+    addTime(Intersect, timer.elapsedMs());
+
+    timer.reset();
+    sort(q, *rays);
+    addTime(Sort, timer.elapsedMs());
+
+    // Every path adds at most one ray to the next bounce, and one shadow ray per
+    // sampled light
+    timer.reset();
+    q.nextRays.resize(rays->count);
+    q.nextPath.resize(rays->count);
+    q.nextThroughput.resize(rays->count);
+    size_t lights = std::count(sampled.begin(), sampled.end(), true);
+    q.shadow.resize(unsigned(rays->count * lights));
+    q.shadowPath.resize(q.shadow.count);
+    q.shadowRadiance.resize(q.shadow.count);
+    q.nextRays.count = 0;
+    q.shadow.count = 0;
+
+    int materialCount = int(materials.size());
+    for (int m = 0; m < materialCount; m++)
+    {
+      const shared_ptr<nori::BSDF> &material = materials[m];
+      for (unsigned i = q.binStart[m]; i < q.binStart[m + 1]; i++)
+        shadeHit(q, *rays, q.order[i], material, colors, random, arena, depth, maxDepth, caustics);
+    }
+
+    // Camera rays that miss see the background; later misses add nothing
+    if (depth == 0)
+    {
+      for (unsigned i = q.binStart[materialCount]; i < q.binStart[materialCount + 1]; i++)
+      {
+        unsigned k = q.order[i];
+        Eigen::Vector3f dir(rays->dir_x[k], rays->dir_y[k], rays->dir_z[k]);
+        colors[q.path[k]] += sceneCam->environment ? sceneCam->environment->radiance(dir) : missColor;
+      }
+    }
+    addTime(Shade, timer.elapsedMs());
+
+    timer.reset();
+    if (q.shadow.count > 0)
+    {
+      rtcInitIntersectContext(&context);
+      RTCRayHitNp shadowStream = q.shadow.pointers();
+      rtcOccludedNp(sceneCam->scene, &context, &shadowStream.ray, q.shadow.count);
+      shadowRayCount += q.shadow.count;
+    }
+    addTime(Shadow, timer.elapsedMs());
+
+    // Occluded rays come back with tfar = -inf
+    timer.reset();
+    for (unsigned s = 0; s < q.shadow.count; s++)
+      if (q.shadow.tfar[s] >= 0)
+        colors[q.shadowPath[s]] += q.shadowRadiance[s];
+    addTime(Accumulate, timer.elapsedMs());
+
+    std::swap(q.rays, q.nextRays);
+    std::swap(q.path, q.nextPath);
+    std::swap(q.throughput, q.nextThroughput);
+    rays = &q.rays;
+  }
+}
+
+void Wavefront::sortByKey(WavefrontQueues &q)
+{
+  RayBuffer &rays = q.rays;
+  unsigned n = rays.count;
+  q.rayKeys.resize(n);
+  for (unsigned k = 0; k < n; k++)
+  {
+    // 3 bits of octant above 9 bits per axis of origin
+    uint32_t octant = (rays.dir_x[k] < 0) | (rays.dir_y[k] < 0) << 1 | (rays.dir_z[k] < 0) << 2;
+    Eigen::Vector3f p = (Eigen::Vector3f(rays.org_x[k], rays.org_y[k], rays.org_z[k]) - boundsLo).cwiseQuotient(boundsSize);
+    p = (p * 511.f).cwiseMax(Eigen::Vector3f::Zero()).cwiseMin(Eigen::Vector3f::Constant(511.f));
+    uint32_t key = octant << 27 | morton3(uint32_t(p.x()), uint32_t(p.y()), uint32_t(p.z()));
+    q.rayKeys[k] = uint64_t(key) << 32 | k;
+  }
+  std::sort(q.rayKeys.begin(), q.rayKeys.begin() + n);
+
+  // Gather into the next bounce's (still unused) queue and swap it in
+  RayBuffer &sorted = q.nextRays;
+  sorted.resize(n);
+  q.nextPath.resize(n);
+  q.nextThroughput.resize(n);
+  for (unsigned i = 0; i < n; i++)
+  {
+    unsigned k = unsigned(q.rayKeys[i]);
+    sorted.org_x[i] = rays.org_x[k];
+    sorted.org_y[i] = rays.org_y[k];
+    sorted.org_z[i] = rays.org_z[k];
+    sorted.dir_x[i] = rays.dir_x[k];
+    sorted.dir_y[i] = rays.dir_y[k];
+    sorted.dir_z[i] = rays.dir_z[k];
+    sorted.tnear[i] = rays.tnear[k];
+    sorted.tfar[i] = rays.tfar[k];
+    sorted.time[i] = rays.time[k];
+    sorted.mask[i] = rays.mask[k];
+    sorted.id[i] = i;
+    sorted.flags[i] = rays.flags[k];
+    sorted.geomID[i] = RTC_INVALID_GEOMETRY_ID;
+    sorted.instID[i] = RTC_INVALID_GEOMETRY_ID;
+    q.nextPath[i] = q.path[k];
+    q.nextThroughput[i] = q.throughput[k];
+  }
+  std::swap(q.rays, q.nextRays);
+  std::swap(q.path, q.nextPath);
+  std::swap(q.throughput, q.nextThroughput);
+}
+
+void Wavefront::sort(WavefrontQueues &q, const RayBuffer &rays)
+{
+  // Misses go in a bin after the materials
+  int bins = int(materials.size()) + 1;
+  q.binStart.assign(bins + 1, 0);
+  for (unsigned k = 0; k < rays.count; k++)
+  {
+    unsigned geomID = rays.geomID[k];
+    int bin = geomID == RTC_INVALID_GEOMETRY_ID ? bins - 1 : materialOf[geomID];
+    q.binStart[bin + 1]++;
+  }
+  for (int b = 0; b < bins; b++)
+    q.binStart[b + 1] += q.binStart[b];
+
+  // Place each ray after the ones before it in its bin, keeping their order within it
+  q.order.resize(rays.count);
+  std::vector<unsigned> &next = q.binNext;
+  next.assign(q.binStart.begin(), q.binStart.end() - 1);
+  for (unsigned k = 0; k < rays.count; k++)
+  {
+    unsigned geomID = rays.geomID[k];
+    int bin = geomID == RTC_INVALID_GEOMETRY_ID ? bins - 1 : materialOf[geomID];
+    q.order[next[bin]++] = k;
+  }
+}
+
+void Wavefront::shadeHit(WavefrontQueues &q, const RayBuffer &rays, unsigned k, const shared_ptr<nori::BSDF> &material,
+                         std::vector<Eigen::Vector3f> &colors, PCG32 &random, MemoryArena &arena, int depth, int maxDepth,
+                         const CausticMap &caustics)
+{
+  Eigen::Vector3f ray(rays.dir_x[k], rays.dir_y[k], rays.dir_z[k]);
+  Eigen::Vector3f position = Eigen::Vector3f(rays.org_x[k], rays.org_y[k], rays.org_z[k]) + rays.tfar[k] * ray;
+  Eigen::Vector3f incomingDir = ray.normalized();
+
+  RTCHit hit;
+  hit.Ng_x = rays.Ng_x[k];
+  hit.Ng_y = rays.Ng_y[k];
+  hit.Ng_z = rays.Ng_z[k];
+  hit.u = rays.u[k];
+  hit.v = rays.v[k];
+  hit.primID = rays.primID[k];
+  hit.geomID = rays.geomID[k];
+  hit.instID[0] = rays.instID[k];
+
+  // Shade with the interpolated vertex normal, turned to the side the ray arrived from
+  Eigen::Vector3f geomNorm(hit.Ng_x, hit.Ng_y, hit.Ng_z);
+  Eigen::Vector3f normal = sceneCam->shadingNormal(hit);
+  if (geomNorm.dot(ray) > 0)
+    geomNorm = -geomNorm;
+  if (normal.dot(geomNorm) < 0)
+    normal = -normal;
+  normal.normalize();
+
+  unsigned path = q.path[k];
+  Eigen::Vector3f throughput = q.throughput[k];
+  Eigen::Vector3f color(0, 0, 0);
+  if (depth == 0)
+  {
+    color += sceneCam->emitted(hit, ray);
+    if (caustics.built())
+      color += caustics.gather(position, normal, material->diffuseReflectance(), arena);
+  }
+
+  SceneShadowTest doShadowTest(sceneCam->scene, position);
+  for (int i = 0; i < int(sceneCam->lights.size()); i++)
+  {
+    const BaseLight &light = *sceneCam->lights[i];
+    if (!sampled[i])
+    {
+      color += sceneCam->lights[i]->getContribution(incomingDir, position, normal, material, doShadowTest, random);
+      continue;
+    }
+
+    // Deferred to the shadow stage
+    Eigen::Vector3f point;
+    light.samplePoint(Eigen::Vector2f(random.nextFloat(), random.nextFloat()), point);
+    Eigen::Vector3f contribution = light.evalPoint(point, incomingDir, position, normal, *material);
+    if (contribution.isZero())
+      continue;
+
+    Eigen::Vector3f toLight = point - position;
+    float distance = toLight.norm();
+    Eigen::Vector3f dir = toLight / distance;
+    unsigned s = q.shadow.count++;
+    q.shadow.org_x[s] = position.x();
+    q.shadow.org_y[s] = position.y();
+    q.shadow.org_z[s] = position.z();
+    q.shadow.dir_x[s] = dir.x();
+    q.shadow.dir_y[s] = dir.y();
+    q.shadow.dir_z[s] = dir.z();
+    q.shadow.tnear[s] = .01f;
+    q.shadow.tfar[s] = distance - .02f;
+    q.shadow.time[s] = 0;
+    q.shadow.mask[s] = ShadowRays;
+    q.shadow.id[s] = s;
+    q.shadow.flags[s] = 0;
+    q.shadowPath[s] = path;
+    q.shadowRadiance[s] = throughput.cwiseProduct(contribution);
+  }
+  colors[path] += throughput.cwiseProduct(color);
+
+  if (depth + 1 >= maxDepth)
+    return;
+
+  // Russian roulette from the fourth vertex on
+  if (depth >= 3)
+  {
+    float survival = std::min(throughput.maxCoeff(), 0.95f);
+    if (random.nextFloat() >= survival)
+      return;
+    throughput /= survival;
+  }
+
+  // Continue the path by sampling the BSDF
+  nori::Frame frame(normal);
+  nori::BSDFQueryRecord sampled(frame.toLocal(-incomingDir));
+  if (material->sample(sampled, Eigen::Vector2f(random.nextFloat(), random.nextFloat())).isZero())
+    return;
+  float cosine = nori::Frame::cosTheta(sampled.wo);
+  float pdf = material->pdf(sampled);
+  if (cosine <= 0 || !(pdf > 0))
+    return;
+  Eigen::Vector3f dir = frame.toWorld(sampled.wo);
+
+  unsigned r = q.nextRays.count++;
+  q.nextRays.org_x[r] = position.x();
+  q.nextRays.org_y[r] = position.y();
+  q.nextRays.org_z[r] = position.z();
+  q.nextRays.dir_x[r] = dir.x();
+  q.nextRays.dir_y[r] = dir.y();
+  q.nextRays.dir_z[r] = dir.z();
+  q.nextRays.tnear[r] = .01f;
+  q.nextRays.tfar[r] = std::numeric_limits<float>::infinity();
+  q.nextRays.time[r] = 0;
+  q.nextRays.mask[r] = CameraRays;
+  q.nextRays.id[r] = r;
+  q.nextRays.flags[r] = 0;
+  q.nextRays.geomID[r] = RTC_INVALID_GEOMETRY_ID;
+  q.nextRays.instID[r] = RTC_INVALID_GEOMETRY_ID;
+  q.nextPath[r] = path;
+  q.nextThroughput[r] = throughput.cwiseProduct(material->eval(sampled) * (cosine / pdf));
+}
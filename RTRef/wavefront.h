@@ -0,0 +1,121 @@
+#pragma once
+
+#include <generator.h>
+#include <raybuffer.h>
+#include <sampler.h>
+#include <caustics.h>
+#include <atomic>
+#include <vector>
+
+// Per-thread queues of the wavefront pipeline, kept between tiles so that they only
+// allocate while they grow
+struct WavefrontQueues
+{
+  // Paths being extended, and those continuing to the next bounce: each path's ray, the
+  // index of the camera ray (and so the pixel sample) it adds to, and its throughput
+  RayBuffer rays, nextRays;
+  std::vector<unsigned> path, nextPath;
+  std::vector<Eigen::Vector3f> throughput, nextThroughput;
+
+  // Indices into rays of the current bounce's hits, grouped by material, and where each
+  // material's group starts (one entry per material, plus the end)
+  std::vector<unsigned> order;
+  std::vector<unsigned> binStart, binNext;
+
+  // Sort keys of the rays (in the high 32 bits) and their indices, for sortRays
+  std::vector<uint64_t> rayKeys;
+
+  // Shadow rays toward sampled points on lights, with the path they add to and the
+  // radiance they carry if nothing blocks them
+  RayBuffer shadow;
+  std::vector<unsigned> shadowPath;
+  std::vector<Eigen::Vector3f> shadowRadiance;
+};
+
+// Wavefront path tracer: instead of following each path to its end before starting the
+// next, every stage runs over all paths of a tile at once on structure-of-arrays queues.
+//   generate   camera rays and the initial path states
+//   intersect  the queue's rays as one stream
+//   sort       the hits into bins by material (a counting sort over material indices)
+//   shade      bin by bin, so each material's code and data stay hot: emission, the
+//              lights that trace their own rays, and one sampled point on each of the
+//              other lights (written to the shadow queue), then a BSDF sample that
+//              writes the path's next ray
+//   shadow     the shadow queue as one stream of occlusion rays
+//   accumulate the unblocked shadow rays' radiance into their paths' pixels
+// until no paths are left or they reach the maximum depth.  Each stage's time is
+// counted separately.  The lights that trace their own rays (ambient, environment and
+// mesh lights) do so within the shade stage.
+class Wavefront
+{
+public:
+  enum Stage
+  {
+    Generate,
+    Intersect,
+    Sort,
+    Shade,
+    Shadow,
+    Accumulate,
+    StageCount
+  };
+
+  // Used by the renderer in place of its per-ray integrator when set
+  bool enabled = false;
+
+  // Reorder each bounce's rays before tracing them, by direction octant and then by
+  // the Morton code of their origins within the scene's bounds, so that rays traced
+  // one after another take similar paths through the BVH
+  bool sortRays = false;
+
+  Wavefront() { resetTimes(); }
+
+  /// Index the scene's materials for sorting
+  void configure(shared_ptr<SceneAndCam> s);
+
+  /// Trace paths of up to maxDepth vertices from the camera rays in cameraRays and
+  /// write each one's radiance to colors.  Misses see missColor unless the scene has an
+  /// environment light; caustics, if built, are added at the first hits.
+  void render(RayBuffer &cameraRays, std::vector<Eigen::Vector3f> &colors, PCG32 &random, WavefrontQueues &queues, MemoryArena &arena,
+              int maxDepth, const Eigen::Vector3f &missColor, const CausticMap &caustics);
+
+  /// Add to a stage's time
+  void addTime(Stage stage, double ms);
+
+  /// Milliseconds spent in a stage, summed over threads, since the last resetTimes()
+  double stageMs(Stage stage) const { return nanoseconds[stage].load() * 1e-6; }
+  /// Rays traced by the intersect and shadow stages since the last resetTimes()
+  long long pathRays() const { return pathRayCount.load(); }
+  long long shadowRays() const { return shadowRayCount.load(); }
+  void resetTimes();
+
+  static const char *stageName(Stage stage);
+
+  /// Print the stage times
+  void printTimes() const;
+
+private:
+  shared_ptr<SceneAndCam> sceneCam;
+
+  // The distinct materials, and the index among them of each geomID's material
+  std::vector<shared_ptr<nori::BSDF>> materials;
+  std::vector<int> materialOf;
+  // Whether each light is sampled through samplePoint() and the shadow queue
+  std::vector<bool> sampled;
+  // The scene's bounds, for the rays' Morton codes
+  Eigen::Vector3f boundsLo, boundsSize;
+
+  std::atomic<long long> nanoseconds[StageCount];
+  std::atomic<long long> pathRayCount, shadowRayCount;
+
+  // Sort the rays and path states of q by their sort keys (see sortRays)
+  void sortByKey(WavefrontQueues &q);
+
+  // Fill q.order and q.binStart from the hits in rays
+  void sort(WavefrontQueues &q, const RayBuffer &rays);
+
+  // Shade the hit of ray k at the given depth, adding its emission and the lights
+  // that trace their own rays to colors and queueing its shadow rays and next ray
+  void shadeHit(WavefrontQueues &q, const RayBuffer &rays, unsigned k, const shared_ptr<nori::BSDF> &material,
+                std::vector<Eigen::Vector3f> &colors, PCG32 &random, MemoryArena &arena, int depth, int maxDepth, const CausticMap &caustics);
+};
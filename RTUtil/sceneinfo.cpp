@@ -7,6 +7,7 @@
  * Author: srm, Spring 2020
  */
 
+#include <algorithm>
 #include <fstream>
 
 #include "sceneinfo.hpp"
@@ -46,7 +47,7 @@ void from_json(const nlohmann::json &j, Eigen::Matrix<T, n, 1> &val) {
         val[i] = j.at(i);
 }
 
-void readLightInfo(const json &sceneInfo, SceneInfo &info) {
+void readLightInfo(const json &sceneInfo, const std::string &directory, SceneInfo &info) {
     info.backgroundRadiance = Eigen::Vector3f::Zero();
     bool backgroundSet = false;
     for (const auto &lightInfo : sceneInfo["lights"]) {
@@ -57,6 +58,9 @@ void readLightInfo(const json &sceneInfo, SceneInfo &info) {
         Eigen::Vector2f size;
         Eigen::Vector3f radiance;
         float range = std::numeric_limits<float>::infinity();
+        int samples = 1;
+        bool cache = false;
+        std::string file;
         if (lightInfo["type"] == "point") {
             type = LightType::Point;
             from_json(lightInfo["position"], position);
@@ -74,17 +78,35 @@ void readLightInfo(const json &sceneInfo, SceneInfo &info) {
             if (lightInfo.find("range") != lightInfo.end()) {
                 range = lightInfo["range"];
             }
+            if (lightInfo.find("samples") != lightInfo.end()) {
+                samples = std::max(int(lightInfo["samples"]), 1);
+            }
+            if (lightInfo.find("cache") != lightInfo.end()) {
+                cache = lightInfo["cache"];
+            }
             if (!backgroundSet) {
                 info.backgroundRadiance = radiance;
                 backgroundSet = true;
             }
+        } else if (lightInfo["type"] == "environment") {
+            type = LightType::Environment;
+            file = lightInfo["file"];
+            if (!file.empty() && file[0] != '/')
+                file = directory + file;
+            radiance = Eigen::Vector3f::Ones();
+            if (lightInfo.find("radiance") != lightInfo.end()) {
+                from_json(lightInfo["radiance"], radiance);
+            }
+            if (lightInfo.find("samples") != lightInfo.end()) {
+                samples = std::max(int(lightInfo["samples"]), 1);
+            }
         } else {
             std::cerr << "warning: unkonwn light type '" << lightInfo["type"] << "' encountered; ignored." << std::endl;
             continue;
         }
         // LightInfo foo(std::initializer_list<LightInfo> { nodeName, type, power, position, normal, up, size, radiance, range });
         info.lights.push_back(make_shared<LightInfo>(
-            LightInfo { nodeName, type, power, position, normal, up, size, radiance, range }
+            LightInfo { nodeName, type, power, position, normal, up, size, radiance, range, samples, cache, file }
             ));
     }
 }
@@ -114,6 +136,22 @@ void readMaterialInfo(const json &sceneInfo, SceneInfo &info) {
 
 }
 
+void readVisibilityInfo(const json &sceneInfo, SceneInfo &info) {
+    if (sceneInfo.find("visibility") == sceneInfo.end())
+        return;
+    for (const auto &visInfo : sceneInfo["visibility"]) {
+        VisibilityInfo visibility = { true, true, true };
+        if (visInfo.find("camera") != visInfo.end())
+            visibility.camera = visInfo["camera"];
+        if (visInfo.find("shadows") != visInfo.end())
+            visibility.shadows = visInfo["shadows"];
+        if (visInfo.find("ambient") != visInfo.end())
+            visibility.ambient = visInfo["ambient"];
+        std::string nodeName = visInfo["node"];
+        info.nodeVisibility.insert({nodeName, visibility});
+    }
+}
+
 bool readSceneInfo(const std::string infoPath, SceneInfo &info) {
 
     /*
@@ -132,10 +170,15 @@ bool readSceneInfo(const std::string infoPath, SceneInfo &info) {
         return false;
     }
 
-    readLightInfo(sceneInfo, info);
+    // Files named by the info are found relative to it
+    size_t slash = infoPath.find_last_of('/');
+    std::string directory = slash == std::string::npos ? "" : infoPath.substr(0, slash + 1);
+    readLightInfo(sceneInfo, directory, info);
 
     readMaterialInfo(sceneInfo, info); 
 
+    readVisibilityInfo(sceneInfo, info);
+
     return true;   
 }
 
@@ -23,9 +23,10 @@ namespace nori { class BSDF; }
 
 namespace RTUtil {
 
-    // An enumeration to distinguish different types of lights
+    // An enumeration to distinguish different types of lights.  Emissive lights come from
+    // emissive materials in the scene file rather than from the scene information.
     enum LightType {
-        Point, Area, Ambient
+        Point, Area, Ambient, Environment, Emissive
     };
 
     /**
@@ -59,12 +60,38 @@ namespace RTUtil {
         // For Area lights: the width and height of the rectangular source
         Eigen::Vector2f size;
 
-        // For Ambient lights: the (constant) ambient radiance
+        // For Ambient lights: the (constant) ambient radiance.  For Environment lights: a
+        // scale applied to the map's radiance
         Eigen::Vector3f radiance;
 
         // For Ambient lights: the maximum distance of an occluder for ambient light.  Setting
         // this to positive infinity gives standard ambient occlusion.
         float range;    
+
+        // For Ambient lights: the number of occlusion rays traced per shading point.  For
+        // Environment lights: the number of light and BSDF samples per shading point
+        int samples;
+
+        // For Ambient lights: interpolate occlusion from an irradiance cache instead of
+        // tracing rays at every shading point
+        bool cache;
+
+        // For Environment lights: path of a latitude-longitude HDR image, relative to the
+        // scene information file
+        std::string file;
+    };
+
+
+    /**
+     * Which kinds of rays see the geometry below a node.  Geometry that casts no shadows
+     * is skipped by shadow rays, and geometry not visible to ambient light by ambient
+     * occlusion rays; geometry not visible to the camera is also skipped by the rays
+     * that continue paths from it.
+     */
+    struct RTUTIL_EXPORT VisibilityInfo {
+        bool camera;
+        bool shadows;
+        bool ambient;
     };
 
 
@@ -84,6 +111,10 @@ namespace RTUtil {
         // preceding maps
         std::shared_ptr<nori::BSDF> defaultMaterial;
 
+        // Map from a node name to the visibility of the geometry below it, down to any
+        // descendant node with an entry of its own
+        std::map<std::string, VisibilityInfo> nodeVisibility;
+
         // A list of the lightInfo data for each light in the scene
         std::vector<std::shared_ptr<LightInfo>> lights;
 